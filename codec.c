@@ -0,0 +1,361 @@
+/*
+ * Lossless frame compression for recordings
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *    Each pixel is predicted from its left, upper and upper-left neighbours
+ *    of the same color (the median edge detector from LOCO-I / JPEG-LS).
+ *    The prediction residuals are zigzag mapped and written as Rice codes,
+ *    choosing the Rice parameter separately for every block of residuals.
+ *
+ *    16 bit frames that use only 12 bits per sample are packed instead,
+ *    three bytes for every two samples after a one byte shift header.
+ *
+ */
+
+#include <string.h>
+
+#include "codec.h"
+#include "mono16.h"
+
+#define BLOCK           16      /* residuals per Rice parameter */
+#define MAX_K           7
+#define ESCAPE_ZEROS    16      /* unary prefixes this long are followed by the raw value */
+
+/* worst case bits for one block: parameter + escaped residuals */
+#define BLOCK_MAX_BYTES ((3 + BLOCK * (ESCAPE_ZEROS + 8) + 7) / 8)
+
+typedef struct __bitwriter
+{
+    uint8_t     *p;
+    uint8_t     *end;
+    uint32_t    acc;
+    int         n;
+} bitwriter_t;
+
+typedef struct __bitreader
+{
+    const uint8_t   *p;
+    const uint8_t   *end;
+    uint64_t        acc;
+    int             n;
+} bitreader_t;
+
+/* nbits <= 24 */
+static inline void put_bits(bitwriter_t *bw, uint32_t value, int nbits)
+{
+    bw->acc = (bw->acc << nbits) | value;
+    bw->n += nbits;
+    while (bw->n >= 8) {
+        bw->n -= 8;
+        *bw->p++ = (uint8_t)(bw->acc >> bw->n);
+    }
+}
+
+static inline void flush_bits(bitwriter_t *bw)
+{
+    if (bw->n > 0)
+        *bw->p++ = (uint8_t)(bw->acc << (8 - bw->n));
+    bw->n = 0;
+}
+
+static inline void refill(bitreader_t *br)
+{
+    /* reading past the end yields zeros, caught by the caller's checks */
+    while (br->n <= 56) {
+        br->acc |= (uint64_t)(br->p < br->end ? *br->p : 0) << (56 - br->n);
+        br->p++;
+        br->n += 8;
+    }
+}
+
+/* nbits <= 24, caller has refilled */
+static inline uint32_t get_bits(bitreader_t *br, int nbits)
+{
+    uint32_t v;
+
+    if (nbits == 0)
+        return 0;
+    v = (uint32_t)(br->acc >> (64 - nbits));
+    br->acc <<= nbits;
+    br->n -= nbits;
+    return v;
+}
+
+static inline int med_predict(int a, int b, int c)
+{
+    int mn = a < b ? a : b;
+    int mx = a < b ? b : a;
+
+    if (c >= mx)
+        return mn;
+    if (c <= mn)
+        return mx;
+    return a + b - c;
+}
+
+/* neighbours of the same color, s is 2 for Bayer data and 1 for mono */
+static inline int predict(const uint8_t *row, const uint8_t *up, uint32_t x, uint32_t s)
+{
+    int a, b, c;
+
+    if (up == NULL)
+        return x >= s ? row[x - s] : 0;
+    if (x < s)
+        return up[x];
+
+    a = row[x - s];
+    b = up[x];
+    c = up[x - s];
+    return med_predict(a, b, c);
+}
+
+static void encode_block(bitwriter_t *bw, const uint8_t *u, int count)
+{
+    int i, k;
+    uint32_t sum = 0;
+
+    for (i = 0; i < count; i++)
+        sum += u[i];
+
+    k = 0;
+    while (k < MAX_K && ((uint32_t)count << k) < sum)
+        k++;
+
+    put_bits(bw, k, 3);
+    for (i = 0; i < count; i++) {
+        uint32_t q = u[i] >> k;
+        if (q < ESCAPE_ZEROS) {
+            put_bits(bw, 1, q + 1);
+            put_bits(bw, u[i] & ((1 << k) - 1), k);
+        } else {
+            put_bits(bw, 0, ESCAPE_ZEROS);
+            put_bits(bw, u[i], 8);
+        }
+    }
+}
+
+static gboolean decode_block(bitreader_t *br, uint8_t *u, int count)
+{
+    int i, k, q;
+
+    refill(br);
+    k = get_bits(br, 3);
+    for (i = 0; i < count; i++) {
+        refill(br);
+        /* at most ESCAPE_ZEROS leading zeros */
+        q = 0;
+        while (q < ESCAPE_ZEROS && !(br->acc & 0x8000000000000000ULL)) {
+            br->acc <<= 1;
+            br->n--;
+            q++;
+        }
+        if (q == ESCAPE_ZEROS) {
+            u[i] = get_bits(br, 8);
+        } else {
+            get_bits(br, 1);
+            u[i] = (q << k) | get_bits(br, k);
+        }
+    }
+
+    /* refill() pads with zeros past the end, so check afterwards that no
+     * more bits were consumed than the stream holds */
+    return (br->p - br->end) * 8 <= br->n;
+}
+
+static uint32_t predictor_step(const dc1394video_frame_t *frame)
+{
+    return frame->color_coding == DC1394_COLOR_CODING_RAW8 ? 2 : 1;
+}
+
+gboolean codec_supports_frame(const dc1394video_frame_t *frame)
+{
+    return codec_for_frame(frame) != CODEC_NONE;
+}
+
+codec_t codec_for_frame(const dc1394video_frame_t *frame)
+{
+    switch (frame->color_coding) {
+        case DC1394_COLOR_CODING_MONO8:
+        case DC1394_COLOR_CODING_RAW8:
+            return CODEC_MED_RICE;
+        case DC1394_COLOR_CODING_MONO16:
+        case DC1394_COLOR_CODING_RAW16:
+            return CODEC_PACK12;
+        default:
+            return CODEC_NONE;
+    }
+}
+
+static size_t
+encode_med_rice(const dc1394video_frame_t *frame, uint8_t *dst, size_t dst_capacity)
+{
+    bitwriter_t bw;
+    uint8_t u[BLOCK];
+    uint32_t x, y, s, w, h, stride;
+    int nu;
+
+    w = frame->size[0];
+    h = frame->size[1];
+    stride = frame->stride ? frame->stride : w;
+    s = predictor_step(frame);
+
+    bw.p = dst;
+    bw.end = dst + dst_capacity;
+    bw.acc = 0;
+    bw.n = 0;
+    nu = 0;
+
+    for (y = 0; y < h; y++) {
+        const uint8_t *row = frame->image + (y * stride);
+        const uint8_t *up = y >= s ? row - (s * stride) : NULL;
+
+        for (x = 0; x < w; x++) {
+            int8_t e = (int8_t)(row[x] - predict(row, up, x, s));
+            u[nu++] = (uint8_t)((e << 1) ^ (e >> 7));
+            if (nu == BLOCK) {
+                if (bw.p + BLOCK_MAX_BYTES >= bw.end)
+                    return 0;
+                encode_block(&bw, u, nu);
+                nu = 0;
+            }
+        }
+    }
+
+    if (bw.p + BLOCK_MAX_BYTES + 1 >= bw.end)
+        return 0;
+    if (nu)
+        encode_block(&bw, u, nu);
+    flush_bits(&bw);
+
+    return bw.p - dst;
+}
+
+/* The shift header is followed by the rows, each packed on its own */
+static size_t
+encode_pack12(const dc1394video_frame_t *frame, uint8_t *dst, size_t dst_capacity)
+{
+    uint32_t y, w, h, stride;
+    size_t row_bytes;
+    int shift;
+
+    w = frame->size[0];
+    h = frame->size[1];
+    stride = frame->stride ? frame->stride : w * 2;
+    row_bytes = mono16_pack12_bytes(w);
+
+    if (1 + (row_bytes * h) >= dst_capacity)
+        return 0;
+    if ((shift = mono16_pack12_shift(frame)) < 0)
+        return 0;
+
+    dst[0] = shift;
+    for (y = 0; y < h; y++)
+        mono16_pack12(frame->image + (y * stride), frame->little_endian, shift,
+                      dst + 1 + (y * row_bytes), w);
+
+    return 1 + (row_bytes * h);
+}
+
+size_t codec_encode_frame(const dc1394video_frame_t *frame, uint8_t *dst, size_t dst_capacity)
+{
+    g_return_val_if_fail(frame != NULL, 0);
+    g_return_val_if_fail(dst != NULL, 0);
+
+    switch (codec_for_frame(frame)) {
+        case CODEC_MED_RICE:
+            return encode_med_rice(frame, dst, dst_capacity);
+        case CODEC_PACK12:
+            return encode_pack12(frame, dst, dst_capacity);
+        default:
+            return 0;
+    }
+}
+
+static dc1394error_t
+decode_pack12(const uint8_t *src, size_t nsrc, dc1394video_frame_t *frame)
+{
+    uint32_t y, w, h, stride;
+    size_t row_bytes;
+
+    w = frame->size[0];
+    h = frame->size[1];
+    stride = frame->stride ? frame->stride : w * 2;
+    row_bytes = mono16_pack12_bytes(w);
+
+    if (nsrc != 1 + (row_bytes * h) || (src[0] != 0 && src[0] != 4))
+        return DC1394_FAILURE;
+
+    for (y = 0; y < h; y++)
+        mono16_unpack12(src + 1 + (y * row_bytes), frame->little_endian, src[0],
+                        frame->image + (y * stride), w);
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t codec_decode_frame(codec_t codec, const uint8_t *src, size_t nsrc, dc1394video_frame_t *frame)
+{
+    bitreader_t br;
+    uint8_t u[BLOCK];
+    uint32_t x, y, s, w, h, stride;
+    uint64_t remaining;
+    int nu, iu;
+
+    g_return_val_if_fail(src != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+    g_return_val_if_fail(frame != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+
+    if (codec == CODEC_NONE || codec != codec_for_frame(frame))
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+    if (codec == CODEC_PACK12)
+        return decode_pack12(src, nsrc, frame);
+
+    w = frame->size[0];
+    h = frame->size[1];
+    stride = frame->stride ? frame->stride : w;
+    s = predictor_step(frame);
+
+    br.p = src;
+    br.end = src + nsrc;
+    br.acc = 0;
+    br.n = 0;
+    nu = iu = 0;
+    remaining = (uint64_t)w * h;
+
+    for (y = 0; y < h; y++) {
+        uint8_t *row = frame->image + (y * stride);
+        const uint8_t *up = y >= s ? row - (s * stride) : NULL;
+
+        for (x = 0; x < w; x++) {
+            int e;
+
+            if (iu == nu) {
+                nu = remaining < BLOCK ? (int)remaining : BLOCK;
+                if (!decode_block(&br, u, nu))
+                    return DC1394_FAILURE;
+                remaining -= nu;
+                iu = 0;
+            }
+
+            e = (u[iu] >> 1) ^ -(int)(u[iu] & 1);
+            iu++;
+            row[x] = (uint8_t)(predict(row, up, x, s) + e);
+        }
+    }
+
+    return DC1394_SUCCESS;
+}
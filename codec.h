@@ -0,0 +1,72 @@
+/*
+ * Lossless frame compression for recordings
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Codec identifiers, stored in the low byte of a recorded frame's flags
+ */
+typedef enum {
+    CODEC_NONE =        0,
+    CODEC_MED_RICE =    1,      /* LOCO-I median prediction + adaptive Rice codes */
+    CODEC_PACK12 =      2       /* 16 bit samples packed to 12 bits, see mono16.h */
+} codec_t;
+
+/**
+ * Returns TRUE if frames with this color coding can be compressed
+ * (MONO8, RAW8, MONO16 and RAW16). RAW8 frames are predicted from pixels
+ * of the same Bayer color.
+ */
+gboolean codec_supports_frame(const dc1394video_frame_t *frame);
+
+/**
+ * The codec codec_encode_frame() uses for frame: CODEC_MED_RICE for 8 bit
+ * frames, CODEC_PACK12 for 16 bit ones, CODEC_NONE otherwise
+ */
+codec_t codec_for_frame(const dc1394video_frame_t *frame);
+
+/**
+ * Compresses the image of frame into dst with codec_for_frame(). Returns
+ * the compressed size, or 0 if the frame is not supported or would not
+ * compress to fewer than dst_capacity bytes (store it uncompressed
+ * instead). 16 bit frames are only packed if no sample needs more than 12
+ * bits, either the low or the high 12.
+ */
+size_t codec_encode_frame(const dc1394video_frame_t *frame, uint8_t *dst, size_t dst_capacity);
+
+/**
+ * Decompresses nsrc bytes into the image of frame. The geometry, stride and
+ * color coding of frame must already be set and its image must hold
+ * stride*size[1] bytes.
+ */
+dc1394error_t codec_decode_frame(codec_t codec, const uint8_t *src, size_t nsrc, dc1394video_frame_t *frame);
+
+G_END_DECLS
+
+#endif
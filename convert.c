@@ -0,0 +1,429 @@
+/*
+ * Frame conversion split into row bands on a shared thread pool
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "convert.h"
+#include "demosaic.h"
+#include "yuv.h"
+
+/* below this a band costs more to hand over than to convert */
+#define MIN_BAND_ROWS   64
+
+typedef dc1394error_t (*band_func_t)(gpointer data, uint32_t y0, uint32_t y1);
+
+typedef struct __convert_job
+{
+    band_func_t         func;
+    gpointer            data;
+    uint32_t            height;
+    uint32_t            band_rows;
+    gint                nbands;
+    volatile gint       next;           /* next band to claim */
+    volatile gint       err;            /* first error of any band */
+    gint                nhelpers;
+    gint                helpers_done;   /* guarded by lock */
+} convert_job_t;
+
+typedef struct __debayer_bands
+{
+    const dc1394video_frame_t *in;
+    uint8_t                 *dst;
+    size_t                  dst_stride;
+    dc1394bayer_method_t    method;
+    gboolean                bgr;
+} debayer_bands_t;
+
+typedef struct __yuv_bands
+{
+    const dc1394video_frame_t *in;
+    uint8_t                 *dst;
+    size_t                  dst_stride;
+    gboolean                bgr;
+} yuv_bands_t;
+
+typedef struct __bgr_bands
+{
+    const uint8_t   *src;
+    size_t          src_stride;
+    uint8_t         *dst;
+    size_t          dst_stride;
+    uint32_t        width;
+} bgr_bands_t;
+
+G_LOCK_DEFINE_STATIC(pool);
+static GThreadPool *pool = NULL;
+static GMutex *lock = NULL;
+static GCond *cond = NULL;
+static int nthreads = 0;
+
+void convert_set_threads(int n)
+{
+    G_LOCK(pool);
+    nthreads = MAX(0, n);
+    G_UNLOCK(pool);
+}
+
+int convert_get_threads(void)
+{
+    int n;
+
+    G_LOCK(pool);
+    n = nthreads ? nthreads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    G_UNLOCK(pool);
+    return MAX(1, n);
+}
+
+/* Claims and converts bands until none are left */
+static void
+job_work(convert_job_t *job)
+{
+    dc1394error_t err;
+    uint32_t y0;
+    gint b;
+
+    while ((b = g_atomic_int_exchange_and_add(&(job->next), 1)) < job->nbands) {
+        y0 = b * job->band_rows;
+        err = job->func(job->data, y0, MIN(job->height, y0 + job->band_rows));
+        if (err != DC1394_SUCCESS)
+            g_atomic_int_compare_and_exchange(&(job->err), DC1394_SUCCESS, err);
+    }
+}
+
+/* Runs on the pool threads. The job lives on the caller's stack until
+ * every helper has checked in, even those that found no band left. */
+static void
+helper_func(gpointer data, gpointer user_data)
+{
+    convert_job_t *job = (convert_job_t *)data;
+
+    job_work(job);
+
+    g_mutex_lock(lock);
+    job->helpers_done++;
+    g_cond_broadcast(cond);
+    g_mutex_unlock(lock);
+}
+
+static GThreadPool *
+get_pool(void)
+{
+    GThreadPool *p;
+    int n;
+
+    if (!g_thread_supported())
+        return NULL;
+
+    n = convert_get_threads();
+
+    G_LOCK(pool);
+    if (pool == NULL && n > 1) {
+        lock = g_mutex_new();
+        cond = g_cond_new();
+        pool = g_thread_pool_new(helper_func, NULL, n - 1, TRUE, NULL);
+    }
+    p = pool;
+    G_UNLOCK(pool);
+    return p;
+}
+
+/* Converts rows 0 to height-1 in bands whose first row is a multiple of
+ * align, on the pool and this thread, and waits for all of them */
+static dc1394error_t
+run_bands(band_func_t func, gpointer data, uint32_t height, uint32_t align)
+{
+    convert_job_t job;
+    GThreadPool *p;
+    int i, n;
+
+    p = get_pool();
+    n = MIN(convert_get_threads(), (int)(height / MIN_BAND_ROWS));
+    if (p == NULL || n <= 1)
+        return func(data, 0, height);
+
+    memset(&job, 0, sizeof(job));
+    job.func = func;
+    job.data = data;
+    job.height = height;
+    job.band_rows = (((height + n - 1) / n) + align - 1) / align * align;
+    job.nbands = (height + job.band_rows - 1) / job.band_rows;
+    job.err = DC1394_SUCCESS;
+    job.nhelpers = job.nbands - 1;
+
+    for (i = 0; i < job.nhelpers; i++)
+        g_thread_pool_push(p, &job, NULL);
+
+    job_work(&job);
+
+    g_mutex_lock(lock);
+    while (job.helpers_done < job.nhelpers)
+        g_cond_wait(cond, lock);
+    g_mutex_unlock(lock);
+
+    return (dc1394error_t)job.err;
+}
+
+/* Sizes out as an RGB8 copy of in, reallocating its image if needed */
+static dc1394error_t
+prepare_rgb8(dc1394video_frame_t *in, dc1394video_frame_t *out)
+{
+    uint64_t nbytes;
+
+    nbytes = (uint64_t)in->size[0] * in->size[1] * 3;
+    if (out->image == NULL || out->allocated_image_bytes < nbytes) {
+        free(out->image);
+        out->image = (unsigned char *)malloc(nbytes);
+        out->allocated_image_bytes = out->image ? nbytes : 0;
+        if (out->image == NULL)
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    out->size[0] = in->size[0];
+    out->size[1] = in->size[1];
+    out->position[0] = in->position[0];
+    out->position[1] = in->position[1];
+    out->color_coding = DC1394_COLOR_CODING_RGB8;
+    out->color_filter = in->color_filter;
+    out->data_depth = 8;
+    out->stride = in->size[0] * 3;
+    out->video_mode = in->video_mode;
+    out->padding_bytes = 0;
+    out->image_bytes = out->total_bytes = nbytes;
+    out->little_endian = DC1394_FALSE;
+    out->data_in_padding = DC1394_FALSE;
+    out->timestamp = in->timestamp;
+    out->id = in->id;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+debayer_band(gpointer data, uint32_t y0, uint32_t y1)
+{
+    debayer_bands_t *d = (debayer_bands_t *)data;
+    const dc1394video_frame_t *in = d->in;
+
+    return (d->bgr ? demosaic_bgr8_rows : demosaic_rgb8_rows)(
+                in->image, in->stride ? in->stride : in->size[0],
+                d->dst, d->dst_stride, in->size[0], in->size[1], y0, y1,
+                in->color_filter, d->method);
+}
+
+/* whatever demosaic_frame() hands on to libdc1394 */
+static gboolean
+debayer_here(const dc1394video_frame_t *in, dc1394bayer_method_t method)
+{
+    return (in->color_coding == DC1394_COLOR_CODING_RAW8 || in->color_coding == DC1394_COLOR_CODING_MONO8) &&
+           demosaic_method_supported(method) && in->size[0] >= 2 && in->size[1] >= 2;
+}
+
+dc1394error_t convert_debayer(dc1394video_frame_t *in, dc1394video_frame_t *out, dc1394bayer_method_t method)
+{
+    debayer_bands_t d;
+    dc1394error_t err;
+
+    g_return_val_if_fail(in != NULL && in->image != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+    g_return_val_if_fail(out != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+
+    if (!debayer_here(in, method))
+        return demosaic_frame(in, out, method);
+
+    err = prepare_rgb8(in, out);
+    if (err != DC1394_SUCCESS)
+        return err;
+
+    d.in = in;
+    d.dst = out->image;
+    d.dst_stride = out->stride;
+    d.method = method;
+    d.bgr = FALSE;
+    return run_bands(debayer_band, &d, in->size[1], 2);
+}
+
+dc1394error_t convert_debayer_to_bgr(dc1394video_frame_t *in, uint8_t *bgr, size_t bgr_stride,
+                dc1394bayer_method_t method)
+{
+    dc1394video_frame_t rgb;
+    debayer_bands_t d;
+    dc1394error_t err;
+
+    g_return_val_if_fail(in != NULL && in->image != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+    g_return_val_if_fail(bgr != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+
+    if (debayer_here(in, method)) {
+        d.in = in;
+        d.dst = bgr;
+        d.dst_stride = bgr_stride;
+        d.method = method;
+        d.bgr = TRUE;
+        return run_bands(debayer_band, &d, in->size[1], 2);
+    }
+
+    /* libdc1394 only writes RGB, so swap afterwards */
+    memset(&rgb, 0, sizeof(rgb));
+    err = demosaic_frame(in, &rgb, method);
+    if (err == DC1394_SUCCESS)
+        err = convert_rgb8_to_bgr(rgb.image, (size_t)in->size[0] * 3, bgr, bgr_stride,
+                                  in->size[0], in->size[1]);
+    free(rgb.image);
+    return err;
+}
+
+static dc1394error_t
+to_rgb8_band(gpointer data, uint32_t y0, uint32_t y1)
+{
+    dc1394video_frame_t *in = ((dc1394video_frame_t **)data)[0];
+    dc1394video_frame_t *out = ((dc1394video_frame_t **)data)[1];
+    uint32_t bits;
+
+    dc1394_get_color_coding_bit_size(in->color_coding, &bits);
+    return dc1394_convert_to_RGB8(in->image + ((uint64_t)y0 * in->size[0] * bits / 8),
+                                  out->image + ((uint64_t)y0 * out->stride),
+                                  in->size[0], y1 - y0,
+                                  in->yuv_byte_order, in->color_coding, in->data_depth);
+}
+
+static dc1394error_t
+yuv_band(gpointer data, uint32_t y0, uint32_t y1)
+{
+    yuv_bands_t *d = (yuv_bands_t *)data;
+    const dc1394video_frame_t *in = d->in;
+    uint32_t bits;
+
+    dc1394_get_color_coding_bit_size(in->color_coding, &bits);
+    return (d->bgr ? yuv_to_bgr8_rows : yuv_to_rgb8_rows)(
+                in->image, in->stride ? in->stride : (uint64_t)in->size[0] * bits / 8,
+                d->dst, d->dst_stride, in->size[0], y0, y1,
+                in->color_coding, (dc1394byte_order_t)in->yuv_byte_order);
+}
+
+dc1394error_t convert_to_rgb8(dc1394video_frame_t *in, dc1394video_frame_t *out)
+{
+    dc1394video_frame_t *frames[2];
+    dc1394error_t err;
+    yuv_bands_t d;
+    uint32_t bits;
+
+    g_return_val_if_fail(in != NULL && in->image != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+    g_return_val_if_fail(out != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+
+    if (yuv_coding_supported(in->color_coding)) {
+        err = prepare_rgb8(in, out);
+        if (err != DC1394_SUCCESS)
+            return err;
+
+        d.in = in;
+        d.dst = out->image;
+        d.dst_stride = out->stride;
+        d.bgr = FALSE;
+        return run_bands(yuv_band, &d, in->size[1], 1);
+    }
+
+    /* libdc1394 converts whole packed rows; anything else, or rows with
+     * padding, is left to it in one piece */
+    switch (in->color_coding) {
+        case DC1394_COLOR_CODING_MONO8:
+        case DC1394_COLOR_CODING_RGB8:
+            if (dc1394_get_color_coding_bit_size(in->color_coding, &bits) == DC1394_SUCCESS &&
+                (in->stride == 0 || in->stride == (uint64_t)in->size[0] * bits / 8))
+                break;
+            /* fall through */
+        default:
+            out->color_coding = DC1394_COLOR_CODING_RGB8;
+            return dc1394_convert_frames(in, out);
+    }
+
+    err = prepare_rgb8(in, out);
+    if (err != DC1394_SUCCESS)
+        return err;
+
+    frames[0] = in;
+    frames[1] = out;
+    return run_bands(to_rgb8_band, frames, in->size[1], 1);
+}
+
+dc1394error_t convert_to_bgr8(dc1394video_frame_t *in, uint8_t *bgr, size_t bgr_stride)
+{
+    dc1394video_frame_t rgb;
+    dc1394error_t err;
+    yuv_bands_t d;
+
+    g_return_val_if_fail(in != NULL && in->image != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+    g_return_val_if_fail(bgr != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+
+    if (yuv_coding_supported(in->color_coding)) {
+        d.in = in;
+        d.dst = bgr;
+        d.dst_stride = bgr_stride;
+        d.bgr = TRUE;
+        return run_bands(yuv_band, &d, in->size[1], 1);
+    }
+
+    if (in->color_coding == DC1394_COLOR_CODING_RGB8)
+        return convert_rgb8_to_bgr(in->image, in->stride ? in->stride : (size_t)in->size[0] * 3,
+                                   bgr, bgr_stride, in->size[0], in->size[1]);
+
+    /* anything else through RGB8, then swapped */
+    memset(&rgb, 0, sizeof(rgb));
+    err = convert_to_rgb8(in, &rgb);
+    if (err == DC1394_SUCCESS)
+        err = convert_rgb8_to_bgr(rgb.image, (size_t)in->size[0] * 3, bgr, bgr_stride,
+                                  in->size[0], in->size[1]);
+    free(rgb.image);
+    return err;
+}
+
+static dc1394error_t
+bgr_band(gpointer data, uint32_t y0, uint32_t y1)
+{
+    bgr_bands_t *b = (bgr_bands_t *)data;
+    const uint8_t *s;
+    uint8_t *d, t;
+    uint32_t x, y;
+
+    for (y = y0; y < y1; y++) {
+        s = b->src + (y * b->src_stride);
+        d = b->dst + (y * b->dst_stride);
+        for (x = 0; x < b->width; x++) {
+            t = s[(3 * x) + 2];
+            d[(3 * x) + 1] = s[(3 * x) + 1];
+            d[(3 * x) + 2] = s[3 * x];
+            d[3 * x] = t;
+        }
+    }
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t convert_rgb8_to_bgr(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+                uint32_t width, uint32_t height)
+{
+    bgr_bands_t b;
+
+    g_return_val_if_fail(src != NULL && dst != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+
+    b.src = src;
+    b.src_stride = src_stride;
+    b.dst = dst;
+    b.dst_stride = dst_stride;
+    b.width = width;
+    return run_bands(bgr_band, &b, height, 1);
+}
@@ -0,0 +1,83 @@
+/*
+ * Frame conversion split into row bands on a shared thread pool
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _CONVERT_H_
+#define _CONVERT_H_
+
+#include <inttypes.h>
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Each conversion splits the frame into bands of rows, converts them on a
+ * persistent pool of threads (and the calling thread) and returns once
+ * the whole frame is done, so any tool can call them in place of the
+ * libdc1394 functions. Bands read the rows either side of them that the
+ * Bayer neighbourhood needs, so the result is identical to converting the
+ * frame in one piece. Small frames, or programs that have not called
+ * g_thread_init(), are converted on the calling thread.
+ */
+
+/**
+ * Threads converting each frame, including the caller; 0 means one per
+ * CPU (the default). Takes effect when the pool is first used.
+ */
+void convert_set_threads(int nthreads);
+
+int convert_get_threads(void);
+
+/**
+ * Like demosaic_frame()
+ */
+dc1394error_t convert_debayer(dc1394video_frame_t *in, dc1394video_frame_t *out, dc1394bayer_method_t method);
+
+/**
+ * Like convert_debayer(), but writes BGR8 rows of bgr_stride bytes
+ * straight into bgr, e.g. an IplImage's imageData, in one pass
+ */
+dc1394error_t convert_debayer_to_bgr(dc1394video_frame_t *in, uint8_t *bgr, size_t bgr_stride,
+                dc1394bayer_method_t method);
+
+/**
+ * Like dc1394_convert_frames() with out->color_coding RGB8; YUV, MONO and
+ * RGB frames become RGB8, YUV with the kernels in yuv.h. out->image is
+ * reallocated if allocated_image_bytes is too small.
+ */
+dc1394error_t convert_to_rgb8(dc1394video_frame_t *in, dc1394video_frame_t *out);
+
+/**
+ * Like convert_to_rgb8(), but writes BGR8 rows of bgr_stride bytes
+ * straight into bgr. YUV frames are converted in one pass.
+ */
+dc1394error_t convert_to_bgr8(dc1394video_frame_t *in, uint8_t *bgr, size_t bgr_stride);
+
+/**
+ * Swaps the R and B samples of an RGB8 image, e.g. for OpenCV. src and dst
+ * may be the same.
+ */
+dc1394error_t convert_rgb8_to_bgr(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+                uint32_t width, uint32_t height);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,402 @@
+/*
+ * Check and time the demosaicing kernels
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *    Checks every demosaicing kernel the CPU supports against the scalar
+ *    reference, bit for bit, for each Bayer pattern and method and for
+ *    awkward image sizes, then reports their throughput in Mpix/s. Exits
+ *    non zero if any result differs. Finally compares demosaicing into
+ *    BGR (for OpenCV) in one pass with demosaicing to RGB into a
+ *    temporary image and swapping R and B in a second pass, and reports
+ *    the bytes each moves per frame. The 16 bit byte swap and window/level
+ *    kernels, which follow the same implementation choice, are checked
+ *    and timed too, as are the YUV to RGB kernels. With --check only the
+ *    comparisons are run; demosaic-check, built from this file for make
+ *    check, always runs that way.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+#include "utils.h"
+#include "demosaic.h"
+#include "convert.h"
+#include "mono16.h"
+#include "yuv.h"
+
+static const dc1394bayer_method_t methods[] = {
+    DC1394_BAYER_METHOD_NEAREST, DC1394_BAYER_METHOD_BILINEAR,
+    DC1394_BAYER_METHOD_HQLINEAR, DC1394_BAYER_METHOD_EDGESENSE
+};
+
+/* odd, tiny and not a multiple of any vector width */
+static const uint32_t check_sizes[][2] = { { 2, 2 }, { 3, 3 }, { 5, 4 }, { 33, 7 }, { 64, 2 }, { 97, 31 }, { 130, 5 } };
+
+static double
+now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec * 1000.0) + (tv.tv_usec / 1000.0);
+}
+
+static void
+fill_mosaic(uint8_t *bayer, size_t nbytes)
+{
+    uint32_t s = 12345;
+    size_t i;
+
+    for (i = 0; i < nbytes; i++) {
+        s = (s * 1103515245) + 12345;
+        bayer[i] = s >> 16;
+    }
+}
+
+/* Compares demosaic_rgb8() to the reference for one geometry; the rows
+ * are padded so stride handling is checked too */
+static int
+check_size(uint32_t width, uint32_t height)
+{
+    size_t stride = width + 3;
+    uint8_t *bayer, *want, *got;
+    int f, m, bad = 0;
+
+    bayer = g_malloc(stride * height);
+    want = g_malloc((size_t)width * height * 3);
+    got = g_malloc((size_t)width * height * 3);
+    fill_mosaic(bayer, stride * height);
+
+    for (f = DC1394_COLOR_FILTER_MIN; f <= DC1394_COLOR_FILTER_MAX; f++) {
+        for (m = 0; m < G_N_ELEMENTS(methods); m++) {
+            memset(got, 0, (size_t)width * height * 3);
+            demosaic_rgb8_reference(bayer, stride, want, width * 3, width, height, f, methods[m]);
+            demosaic_rgb8(bayer, stride, got, width * 3, width, height, f, methods[m]);
+            if (memcmp(want, got, (size_t)width * height * 3) != 0) {
+                printf("%-8s %-9s filter %d %ux%u differs from the reference\n",
+                        demosaic_impl_to_string(demosaic_get_impl()), demosaic_method_to_string(methods[m]),
+                        f, width, height);
+                bad++;
+            }
+
+            /* BGR is the reference with R and B swapped */
+            demosaic_bgr8_rows(bayer, stride, got, width * 3, width, height, 0, height, f, methods[m]);
+            convert_rgb8_to_bgr(got, width * 3, got, width * 3, width, height);
+            if (memcmp(want, got, (size_t)width * height * 3) != 0) {
+                printf("%-8s %-9s filter %d %ux%u BGR differs from the reference\n",
+                        demosaic_impl_to_string(demosaic_get_impl()), demosaic_method_to_string(methods[m]),
+                        f, width, height);
+                bad++;
+            }
+        }
+    }
+
+    g_free(bayer);
+    g_free(want);
+    g_free(got);
+    return bad;
+}
+
+/* Compares the 16 bit kernels with the scalar ones for n samples, in
+ * both byte orders and for full, 12 bit and narrow windows */
+static int
+check_mono16(const uint8_t *samples, size_t n)
+{
+    static const uint32_t windows[][2] = { { 0, 65535 }, { 0, 4095 }, { 1000, 1003 }, { 60000, 65535 } };
+    demosaic_impl_t impl = demosaic_get_impl();
+    uint8_t *want, *got;
+    int w, le, bad = 0;
+
+    want = g_malloc(n * 2);
+    got = g_malloc(n * 2);
+
+    for (w = 0; w < G_N_ELEMENTS(windows); w++) {
+        for (le = 0; le < 2; le++) {
+            demosaic_set_impl(DEMOSAIC_IMPL_SCALAR);
+            mono16_window_level(samples, le, want, n, windows[w][0], windows[w][1]);
+            demosaic_set_impl(impl);
+            memset(got, 0, n);
+            mono16_window_level(samples, le, got, n, windows[w][0], windows[w][1]);
+            if (memcmp(want, got, n) != 0) {
+                printf("%-8s window %u,%u %s endian %zu samples differs from scalar\n",
+                        demosaic_impl_to_string(impl), windows[w][0], windows[w][1],
+                        le ? "little" : "big", n);
+                bad++;
+            }
+        }
+    }
+
+    demosaic_set_impl(DEMOSAIC_IMPL_SCALAR);
+    mono16_swap(samples, want, n);
+    demosaic_set_impl(impl);
+    mono16_swap(samples, got, n);
+    if (memcmp(want, got, n * 2) != 0) {
+        printf("%-8s swap %zu samples differs from scalar\n", demosaic_impl_to_string(impl), n);
+        bad++;
+    }
+
+    g_free(want);
+    g_free(got);
+    return bad;
+}
+
+static const struct {
+    dc1394color_coding_t coding;
+    dc1394byte_order_t order;
+    const char *name;
+} yuv_codings[] = {
+    { DC1394_COLOR_CODING_YUV411, DC1394_BYTE_ORDER_UYVY, "yuv411" },
+    { DC1394_COLOR_CODING_YUV422, DC1394_BYTE_ORDER_UYVY, "uyvy" },
+    { DC1394_COLOR_CODING_YUV422, DC1394_BYTE_ORDER_YUYV, "yuyv" },
+    { DC1394_COLOR_CODING_YUV444, DC1394_BYTE_ORDER_UYVY, "yuv444" },
+};
+
+/* Compares the YUV kernels with the scalar ones for every coding, to RGB
+ * and to BGR. width is rounded down to the 4 pixels YUV411 needs */
+static int
+check_yuv(const uint8_t *samples, uint32_t width, uint32_t height)
+{
+    demosaic_impl_t impl = demosaic_get_impl();
+    uint8_t *want, *got;
+    size_t stride, n;
+    int c, bgr, bad = 0;
+
+    width &= ~3;
+    if (width == 0)
+        return 0;
+    n = (size_t)width * height * 3;
+    want = g_malloc(n);
+    got = g_malloc(n);
+
+    for (c = 0; c < G_N_ELEMENTS(yuv_codings); c++) {
+        stride = yuv_codings[c].coding == DC1394_COLOR_CODING_YUV411 ? width * 3 / 2 :
+                 yuv_codings[c].coding == DC1394_COLOR_CODING_YUV422 ? width * 2 : width * 3;
+        for (bgr = 0; bgr < 2; bgr++) {
+            dc1394error_t (*conv)(const uint8_t *, size_t, uint8_t *, size_t, uint32_t, uint32_t, uint32_t,
+                                  dc1394color_coding_t, dc1394byte_order_t) =
+                bgr ? yuv_to_bgr8_rows : yuv_to_rgb8_rows;
+
+            demosaic_set_impl(DEMOSAIC_IMPL_SCALAR);
+            conv(samples, stride, want, width * 3, width, 0, height, yuv_codings[c].coding, yuv_codings[c].order);
+            demosaic_set_impl(impl);
+            memset(got, 0, n);
+            conv(samples, stride, got, width * 3, width, 0, height, yuv_codings[c].coding, yuv_codings[c].order);
+            if (memcmp(want, got, n) != 0) {
+                printf("%-8s %s to %s %ux%u differs from scalar\n", demosaic_impl_to_string(impl),
+                        yuv_codings[c].name, bgr ? "bgr" : "rgb", width, height);
+                bad++;
+            }
+        }
+    }
+
+    g_free(want);
+    g_free(got);
+    return bad;
+}
+
+static void
+run_yuv(const uint8_t *samples, uint8_t *rgb, uint32_t width, uint32_t height, int nframes)
+{
+    double start, elapsed;
+    size_t stride;
+    int c, i;
+
+    width &= ~3;
+    if (width == 0)
+        return;
+
+    for (c = 0; c < G_N_ELEMENTS(yuv_codings); c++) {
+        stride = yuv_codings[c].coding == DC1394_COLOR_CODING_YUV411 ? width * 3 / 2 :
+                 yuv_codings[c].coding == DC1394_COLOR_CODING_YUV422 ? width * 2 : width * 3;
+        start = now_ms();
+        for (i = 0; i < nframes; i++)
+            yuv_to_rgb8_rows(samples, stride, rgb, width * 3, width, 0, height,
+                             yuv_codings[c].coding, yuv_codings[c].order);
+        elapsed = now_ms() - start;
+
+        printf("%-8s %-13s %8.1f Mpix/s\n", demosaic_impl_to_string(demosaic_get_impl()), yuv_codings[c].name,
+                ((double)nframes * width * height / 1e6) / (elapsed / 1000.0));
+    }
+}
+
+static void
+run_mono16(const uint8_t *samples, uint8_t *out, uint32_t width, uint32_t height, int nframes)
+{
+    double start, swap, window, npix = (double)width * height;
+    int i;
+
+    start = now_ms();
+    for (i = 0; i < nframes; i++)
+        mono16_swap(samples, out, npix);
+    swap = now_ms() - start;
+
+    start = now_ms();
+    for (i = 0; i < nframes; i++)
+        mono16_window_level(samples, FALSE, out, npix, 0, 4095);
+    window = now_ms() - start;
+
+    printf("%-8s mono16 swap   %8.1f Mpix/s\n",
+            demosaic_impl_to_string(demosaic_get_impl()), (nframes * npix / 1e6) / (swap / 1000.0));
+    printf("%-8s mono16 window %8.1f Mpix/s\n",
+            demosaic_impl_to_string(demosaic_get_impl()), (nframes * npix / 1e6) / (window / 1000.0));
+}
+
+static void
+run_impl(uint8_t *bayer, uint8_t *rgb, uint32_t width, uint32_t height, int nframes)
+{
+    double start, elapsed;
+    int i, m;
+
+    for (m = 0; m < G_N_ELEMENTS(methods); m++) {
+        start = now_ms();
+        for (i = 0; i < nframes; i++)
+            demosaic_rgb8(bayer, width, rgb, width * 3, width, height, DC1394_COLOR_FILTER_RGGB, methods[m]);
+        elapsed = now_ms() - start;
+
+        printf("%-8s %-9s %8.1f Mpix/s, %7.1f fps\n",
+                demosaic_impl_to_string(demosaic_get_impl()), demosaic_method_to_string(methods[m]),
+                ((double)nframes * width * height / 1e6) / (elapsed / 1000.0),
+                nframes / (elapsed / 1000.0));
+    }
+}
+
+/* Demosaics to BGR as opencvutils used to, into a temporary RGB image
+ * then swapping into the destination, and in one pass */
+static void
+run_bgr(uint8_t *bayer, uint8_t *bgr, uint32_t width, uint32_t height, int nframes)
+{
+    double start, separate, fused, npix = (double)width * height;
+    uint8_t *tmp;
+    int i;
+
+    start = now_ms();
+    for (i = 0; i < nframes; i++) {
+        tmp = g_malloc(npix * 3);
+        demosaic_rgb8(bayer, width, tmp, width * 3, width, height, DC1394_COLOR_FILTER_RGGB,
+                      DC1394_BAYER_METHOD_BILINEAR);
+        convert_rgb8_to_bgr(tmp, width * 3, bgr, width * 3, width, height);
+        g_free(tmp);
+    }
+    separate = now_ms() - start;
+
+    start = now_ms();
+    for (i = 0; i < nframes; i++)
+        demosaic_bgr8_rows(bayer, width, bgr, width * 3, width, height, 0, height,
+                           DC1394_COLOR_FILTER_RGGB, DC1394_BAYER_METHOD_BILINEAR);
+    fused = now_ms() - start;
+
+    /* separate: read mosaic, write RGB, read RGB, write BGR;
+     * fused: read mosaic, write BGR */
+    printf("%-8s bgr separate %7.2f MB/frame %7.1f fps\n",
+            demosaic_impl_to_string(demosaic_get_impl()), npix * 10 / 1e6, nframes / (separate / 1000.0));
+    printf("%-8s bgr fused    %7.2f MB/frame %7.1f fps\n",
+            demosaic_impl_to_string(demosaic_get_impl()), npix * 4 / 1e6, nframes / (fused / 1000.0));
+}
+
+int main(int argc, char **argv)
+{
+    demosaic_impl_t impl;
+    uint8_t *bayer, *rgb, *samples;
+    int nframes, width, height, i, bad;
+    gboolean check_only;
+
+    /* Option parsing */
+    GError *error = NULL;
+    GOptionContext *context;
+    GOptionEntry entries[] =
+    {
+      { "frames", 'n', 0, G_OPTION_ARG_INT, &nframes, "Frames to demosaic per kernel", "500" },
+      { "width", 'W', 0, G_OPTION_ARG_INT, &width, "Frame width", "640" },
+      { "height", 'H', 0, G_OPTION_ARG_INT, &height, "Frame height", "480" },
+      { "check", 'c', 0, G_OPTION_ARG_NONE, &check_only, "Only check the kernels against the reference", NULL },
+      { NULL }
+    };
+
+    context = g_option_context_new("- Demosaicing Benchmark");
+    g_option_context_set_summary(context,
+            "Checks the demosaicing kernels against the\n"
+            "reference and measures their throughput");
+    g_option_context_add_main_entries (context, entries, NULL);
+
+    /* Defaults */
+    nframes = 500;
+    width = 640;
+    height = 480;
+#ifdef DEMOSAIC_CHECK_ONLY
+    check_only = TRUE;
+#else
+    check_only = FALSE;
+#endif
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        printf( "Error: %s\n%s",
+                error->message,
+                g_option_context_get_help(context, TRUE, NULL));
+        exit(1);
+    }
+    if (nframes <= 0 || width < 2 || height < 2)
+        app_exit(3, context, "Error: Frames must be positive and the geometry at least 2x2");
+
+    bayer = g_malloc((size_t)width * height);
+    rgb = g_malloc((size_t)width * height * 3);
+    fill_mosaic(bayer, (size_t)width * height);
+    /* large enough for YUV444 too */
+    samples = g_malloc((size_t)width * height * 3);
+    fill_mosaic(samples, (size_t)width * height * 3);
+
+    if (check_only)
+        printf("checking at %dx%d\n", width, height);
+    else
+        printf("%d frames of %dx%d\n", nframes, width, height);
+
+    bad = 0;
+    for (impl = DEMOSAIC_IMPL_SCALAR; impl <= DEMOSAIC_IMPL_AVX2; impl++) {
+        if (!demosaic_set_impl(impl)) {
+            printf("%-8s not supported\n", demosaic_impl_to_string(impl));
+            continue;
+        }
+
+        for (i = 0; i < G_N_ELEMENTS(check_sizes); i++)
+            bad += check_size(check_sizes[i][0], check_sizes[i][1]);
+        bad += check_size(width, height);
+        for (i = 0; i < G_N_ELEMENTS(check_sizes); i++)
+            bad += check_mono16(samples, check_sizes[i][0] * check_sizes[i][1]);
+        bad += check_mono16(samples, (size_t)width * height);
+        for (i = 0; i < G_N_ELEMENTS(check_sizes); i++)
+            bad += check_yuv(samples, check_sizes[i][0], check_sizes[i][1]);
+        bad += check_yuv(samples, width, height);
+
+        if (check_only)
+            continue;
+        run_impl(bayer, rgb, width, height, nframes);
+        run_bgr(bayer, rgb, width, height, nframes);
+        run_mono16(samples, rgb, width, height, nframes);
+        run_yuv(samples, rgb, width, height, nframes);
+    }
+
+    g_free(samples);
+    g_free(bayer);
+    g_free(rgb);
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,1105 @@
+/*
+ * Bayer demosaicing of RAW8 frames, with SIMD kernels chosen at runtime
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "demosaic.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DEMOSAIC_X86 1
+#include <immintrin.h>
+#define TARGET(_isa) __attribute__((target(_isa)))
+#endif
+
+/* slack around every row buffer, so the kernels can read one vector past
+ * either end and write whole vectors */
+#define ROW_PAD     64
+
+#define R   0
+#define G   1
+#define B   2
+
+/*
+ * Rows are processed in three steps, each with scalar and SIMD versions:
+ *
+ *  1. split a mosaic row into its even and odd columns (half rows), padded
+ *     with the mirrored samples beyond each end
+ *  2. compute R, G and B for the even and odd columns, which within a row
+ *     always see the same neighbourhood, and interleave them into full
+ *     width planes
+ *  3. pack the three planes into RGB8
+ */
+typedef struct __half_row
+{
+    uint8_t     *e;     /* e[i] = column 2i, valid from e[-1] */
+    uint8_t     *o;     /* o[i] = column 2i+1, valid from o[-1] */
+    int64_t     y;      /* source row held, or -1 */
+} half_row_t;
+
+/* the neighbours of a sample, each as a pointer indexed like the half rows */
+enum {
+    T_C, T_W, T_E, T_W2, T_E2, T_N, T_S, T_N2, T_S2, T_NW, T_NE, T_SW, T_SE, NTAPS
+};
+
+typedef const uint8_t *taps_t[NTAPS];
+
+typedef struct __kernels
+{
+    void (*split)(const uint8_t *src, uint32_t pairs, uint8_t *e, uint8_t *o);
+    void (*nearest)(const half_row_t *c, const half_row_t *p, gboolean g_even, uint32_t nh,
+                    uint8_t *x, uint8_t *g, uint8_t *y);
+    void (*bilinear)(taps_t even, taps_t odd, gboolean g_even, gboolean edge, uint32_t nh,
+                    uint8_t *x, uint8_t *g, uint8_t *y);
+    void (*hqlinear)(taps_t even, taps_t odd, gboolean g_even, uint32_t nh,
+                    uint8_t *x, uint8_t *g, uint8_t *y);
+    void (*pack)(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint8_t *rgb, uint32_t width);
+} kernels_t;
+
+static const struct {
+    const char              *name;
+    dc1394bayer_method_t    method;
+} method_names[] = {
+    { "nearest", DC1394_BAYER_METHOD_NEAREST },
+    { "bilinear", DC1394_BAYER_METHOD_BILINEAR },
+    { "hqlinear", DC1394_BAYER_METHOD_HQLINEAR },
+    { "edgesense", DC1394_BAYER_METHOD_EDGESENSE },
+};
+
+/* set once at startup, before any frames are converted */
+static dc1394bayer_method_t current_method = DC1394_BAYER_METHOD_NEAREST;
+
+/* colors at (row & 1, column & 1) of each dc1394color_filter_t */
+static const int patterns[4][2][2] = {
+    { { R, G }, { G, B } },     /* RGGB */
+    { { G, B }, { R, G } },     /* GBRG */
+    { { G, R }, { B, G } },     /* GRBG */
+    { { B, G }, { G, R } },     /* BGGR */
+};
+
+static inline uint32_t
+mirror(int64_t x, uint32_t n)
+{
+    if (x < 0)
+        x = -x;
+    if (x >= n)
+        x = (2 * ((int64_t)n - 1)) - x;
+    return (uint32_t)CLAMP(x, 0, (int64_t)n - 1);
+}
+
+static inline uint8_t
+avg2(uint8_t a, uint8_t b)
+{
+    return (a + b + 1) >> 1;
+}
+
+static inline uint8_t
+avg4(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+{
+    return (a + b + c + d + 2) >> 2;
+}
+
+/* Taps of both column phases; r holds the rows y-2 to y+2 */
+static void
+make_taps(const half_row_t *const *r, taps_t even, taps_t odd)
+{
+    const half_row_t *u2 = r[0], *u1 = r[1], *c = r[2], *d1 = r[3], *d2 = r[4];
+
+    even[T_C] = c->e;       odd[T_C] = c->o;
+    even[T_W] = c->o - 1;   odd[T_W] = c->e;
+    even[T_E] = c->o;       odd[T_E] = c->e + 1;
+    even[T_W2] = c->e - 1;  odd[T_W2] = c->o - 1;
+    even[T_E2] = c->e + 1;  odd[T_E2] = c->o + 1;
+    even[T_N] = u1->e;      odd[T_N] = u1->o;
+    even[T_S] = d1->e;      odd[T_S] = d1->o;
+    even[T_N2] = u2->e;     odd[T_N2] = u2->o;
+    even[T_S2] = d2->e;     odd[T_S2] = d2->o;
+    even[T_NW] = u1->o - 1; odd[T_NW] = u1->e;
+    even[T_NE] = u1->o;     odd[T_NE] = u1->e + 1;
+    even[T_SW] = d1->o - 1; odd[T_SW] = d1->e;
+    even[T_SE] = d1->o;     odd[T_SE] = d1->e + 1;
+}
+
+/*
+ * Malvar, He and Cutler's gradient corrected linear interpolation, in
+ * sixteenths. At a G site X lies left and right, Y above and below; at a
+ * chroma site the missing colors are G and the opposite chroma.
+ */
+#define HQ_X_AT_G(c, we, ns, we2, ns2, d)   ((10 * (c)) + (8 * (we)) - (2 * (we2)) - (2 * (d)) + (ns2))
+#define HQ_Y_AT_G(c, we, ns, we2, ns2, d)   ((10 * (c)) + (8 * (ns)) - (2 * (ns2)) - (2 * (d)) + (we2))
+#define HQ_G_AT_C(c, we, ns, we2, ns2, d)   ((8 * (c)) + (4 * ((we) + (ns))) - (2 * ((we2) + (ns2))))
+#define HQ_C_AT_C(c, we, ns, we2, ns2, d)   ((12 * (c)) + (4 * (d)) - (3 * ((we2) + (ns2))))
+
+static inline uint8_t
+hq_round(int v)
+{
+    v = (v + 8) >> 4;
+    return (uint8_t)CLAMP(v, 0, 255);
+}
+
+/* G at a chroma site along the flatter direction */
+static inline uint8_t
+edge_g(uint8_t w, uint8_t e, uint8_t n, uint8_t s)
+{
+    int dh = abs(w - e), dv = abs(n - s);
+
+    if (dh < dv)
+        return avg2(w, e);
+    if (dv < dh)
+        return avg2(n, s);
+    return avg4(w, e, n, s);
+}
+
+static gboolean
+check_args(const uint8_t *bayer, uint8_t *rgb, uint32_t width, uint32_t height,
+           dc1394color_filter_t filter, dc1394bayer_method_t method)
+{
+    return bayer && rgb && width >= 2 && height >= 2 &&
+           filter >= DC1394_COLOR_FILTER_MIN && filter <= DC1394_COLOR_FILTER_MAX &&
+           demosaic_method_supported(method);
+}
+
+gboolean demosaic_method_supported(dc1394bayer_method_t method)
+{
+    return method == DC1394_BAYER_METHOD_NEAREST || method == DC1394_BAYER_METHOD_BILINEAR ||
+           method == DC1394_BAYER_METHOD_HQLINEAR || method == DC1394_BAYER_METHOD_EDGESENSE;
+}
+
+gboolean demosaic_method_from_string(const char *name, dc1394bayer_method_t *method)
+{
+    int i;
+
+    g_return_val_if_fail(name != NULL, FALSE);
+
+    for (i = 0; i < G_N_ELEMENTS(method_names); i++) {
+        if (strcmp(name, method_names[i].name) == 0) {
+            *method = method_names[i].method;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+const char *demosaic_method_to_string(dc1394bayer_method_t method)
+{
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(method_names); i++) {
+        if (method_names[i].method == method)
+            return method_names[i].name;
+    }
+    return "unknown";
+}
+
+void demosaic_set_method(dc1394bayer_method_t method)
+{
+    g_return_if_fail(demosaic_method_supported(method));
+    current_method = method;
+}
+
+dc1394bayer_method_t demosaic_get_method(void)
+{
+    return current_method;
+}
+
+dc1394error_t demosaic_rgb8_reference(const uint8_t *bayer, size_t stride, uint8_t *rgb, size_t rgb_stride,
+                uint32_t width, uint32_t height, dc1394color_filter_t filter, dc1394bayer_method_t method)
+{
+    const int (*pat)[2];
+    uint32_t x, y;
+    int c, site;
+
+    if (!check_args(bayer, rgb, width, height, filter, method))
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    pat = patterns[filter - DC1394_COLOR_FILTER_MIN];
+
+#define PX(_x, _y)      bayer[((size_t)mirror(_y, height) * stride) + mirror(_x, width)]
+#define COLOR(_x, _y)   pat[(_y) & 1][(_x) & 1]
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            uint8_t *out = rgb + (y * rgb_stride) + (3 * x);
+            int64_t xl = (int64_t)x - 1, xr = (int64_t)x + 1;
+            int64_t yu = (int64_t)y - 1, yd = (int64_t)y + 1;
+
+            site = COLOR(x, y);
+            for (c = R; c <= B; c++) {
+                if (method == DC1394_BAYER_METHOD_NEAREST) {
+                    int64_t x0 = x & ~1, x1 = x | 1, py = y ^ 1;
+                    int64_t xg = COLOR(x0, y) == G ? x0 : x1;
+
+                    if (c == G)
+                        out[c] = PX(xg, y);
+                    else if (c == COLOR(x0, y) || c == COLOR(x1, y))
+                        out[c] = PX(xg == x0 ? x1 : x0, y);
+                    else
+                        out[c] = PX(xg, py);
+                } else if (c == site) {
+                    out[c] = PX(x, y);
+                } else if (method == DC1394_BAYER_METHOD_HQLINEAR) {
+                    int cc = PX(x, y);
+                    int we = PX(xl, y) + PX(xr, y);
+                    int ns = PX(x, yu) + PX(x, yd);
+                    int we2 = PX(xl - 1, y) + PX(xr + 1, y);
+                    int ns2 = PX(x, yu - 1) + PX(x, yd + 1);
+                    int d = PX(xl, yu) + PX(xr, yu) + PX(xl, yd) + PX(xr, yd);
+
+                    if (site == G && COLOR(x + 1, y) == c)
+                        out[c] = hq_round(HQ_X_AT_G(cc, we, ns, we2, ns2, d));
+                    else if (site == G)
+                        out[c] = hq_round(HQ_Y_AT_G(cc, we, ns, we2, ns2, d));
+                    else if (c == G)
+                        out[c] = hq_round(HQ_G_AT_C(cc, we, ns, we2, ns2, d));
+                    else
+                        out[c] = hq_round(HQ_C_AT_C(cc, we, ns, we2, ns2, d));
+                } else if (site == G) {
+                    if (COLOR(x + 1, y) == c)
+                        out[c] = avg2(PX(xl, y), PX(xr, y));
+                    else
+                        out[c] = avg2(PX(x, yu), PX(x, yd));
+                } else if (c == G && method == DC1394_BAYER_METHOD_EDGESENSE) {
+                    out[c] = edge_g(PX(xl, y), PX(xr, y), PX(x, yu), PX(x, yd));
+                } else if (c == G) {
+                    out[c] = avg4(PX(xl, y), PX(xr, y), PX(x, yu), PX(x, yd));
+                } else {
+                    out[c] = avg4(PX(xl, yu), PX(xr, yu), PX(xl, yd), PX(xr, yd));
+                }
+            }
+        }
+    }
+
+#undef PX
+#undef COLOR
+
+    return DC1394_SUCCESS;
+}
+
+/*
+ * Scalar kernels
+ */
+static void
+split_scalar(const uint8_t *src, uint32_t pairs, uint8_t *e, uint8_t *o)
+{
+    uint32_t i;
+
+    for (i = 0; i < pairs; i++) {
+        e[i] = src[2 * i];
+        o[i] = src[(2 * i) + 1];
+    }
+}
+
+static void
+nearest_scalar(const half_row_t *c, const half_row_t *p, gboolean g_even, uint32_t nh,
+               uint8_t *x, uint8_t *g, uint8_t *y)
+{
+    const uint8_t *cg = g_even ? c->e : c->o;
+    const uint8_t *cx = g_even ? c->o : c->e;
+    const uint8_t *py = g_even ? p->e : p->o;
+    uint32_t i;
+
+    for (i = 0; i < nh; i++) {
+        g[2 * i] = g[(2 * i) + 1] = cg[i];
+        x[2 * i] = x[(2 * i) + 1] = cx[i];
+        y[2 * i] = y[(2 * i) + 1] = py[i];
+    }
+}
+
+/* One site of bilinear, or of edge sensing which only differs in G */
+static inline void
+bilinear_site(taps_t t, uint32_t i, gboolean g_site, gboolean edge, uint8_t *x, uint8_t *g, uint8_t *y)
+{
+    if (g_site) {
+        *g = t[T_C][i];
+        *x = avg2(t[T_W][i], t[T_E][i]);
+        *y = avg2(t[T_N][i], t[T_S][i]);
+    } else {
+        *x = t[T_C][i];
+        *g = edge ? edge_g(t[T_W][i], t[T_E][i], t[T_N][i], t[T_S][i]) :
+                    avg4(t[T_W][i], t[T_E][i], t[T_N][i], t[T_S][i]);
+        *y = avg4(t[T_NW][i], t[T_NE][i], t[T_SW][i], t[T_SE][i]);
+    }
+}
+
+static void
+bilinear_scalar(taps_t even, taps_t odd, gboolean g_even, gboolean edge, uint32_t nh,
+                uint8_t *x, uint8_t *g, uint8_t *y)
+{
+    uint32_t i;
+
+    for (i = 0; i < nh; i++) {
+        bilinear_site(even, i, g_even, edge, &x[2 * i], &g[2 * i], &y[2 * i]);
+        bilinear_site(odd, i, !g_even, edge, &x[(2 * i) + 1], &g[(2 * i) + 1], &y[(2 * i) + 1]);
+    }
+}
+
+static inline void
+hq_site(taps_t t, uint32_t i, gboolean g_site, uint8_t *x, uint8_t *g, uint8_t *y)
+{
+    int c = t[T_C][i];
+    int we = t[T_W][i] + t[T_E][i];
+    int ns = t[T_N][i] + t[T_S][i];
+    int we2 = t[T_W2][i] + t[T_E2][i];
+    int ns2 = t[T_N2][i] + t[T_S2][i];
+    int d = t[T_NW][i] + t[T_NE][i] + t[T_SW][i] + t[T_SE][i];
+
+    if (g_site) {
+        *g = c;
+        *x = hq_round(HQ_X_AT_G(c, we, ns, we2, ns2, d));
+        *y = hq_round(HQ_Y_AT_G(c, we, ns, we2, ns2, d));
+    } else {
+        *x = c;
+        *g = hq_round(HQ_G_AT_C(c, we, ns, we2, ns2, d));
+        *y = hq_round(HQ_C_AT_C(c, we, ns, we2, ns2, d));
+    }
+}
+
+static void
+hqlinear_scalar(taps_t even, taps_t odd, gboolean g_even, uint32_t nh,
+                uint8_t *x, uint8_t *g, uint8_t *y)
+{
+    uint32_t i;
+
+    for (i = 0; i < nh; i++) {
+        hq_site(even, i, g_even, &x[2 * i], &g[2 * i], &y[2 * i]);
+        hq_site(odd, i, !g_even, &x[(2 * i) + 1], &g[(2 * i) + 1], &y[(2 * i) + 1]);
+    }
+}
+
+static void
+pack_scalar(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint8_t *rgb, uint32_t width)
+{
+    uint32_t i;
+
+    for (i = 0; i < width; i++) {
+        rgb[3 * i] = r[i];
+        rgb[(3 * i) + 1] = g[i];
+        rgb[(3 * i) + 2] = b[i];
+    }
+}
+
+static const kernels_t kernels_scalar = {
+    split_scalar, nearest_scalar, bilinear_scalar, hqlinear_scalar, pack_scalar
+};
+
+#ifdef DEMOSAIC_X86
+
+/*
+ * SSE2 kernels, 16 half row samples (32 pixels) at a time
+ */
+#define LD128(_p)       _mm_loadu_si128((const __m128i *)(_p))
+#define ST128(_p, _v)   _mm_storeu_si128((__m128i *)(_p), _v)
+
+static inline TARGET("sse2") __m128i
+avg4_sse2(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i lo, hi;
+
+    lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+                       _mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero)));
+    hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+                       _mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero)));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+    return _mm_packus_epi16(lo, hi);
+}
+
+/* SSE2 has no unsigned byte compare, so compare through min */
+static inline TARGET("sse2") __m128i
+edge_g_sse2(__m128i w, __m128i e, __m128i n, __m128i s)
+{
+    __m128i dh = _mm_or_si128(_mm_subs_epu8(w, e), _mm_subs_epu8(e, w));
+    __m128i dv = _mm_or_si128(_mm_subs_epu8(n, s), _mm_subs_epu8(s, n));
+    __m128i eq = _mm_cmpeq_epi8(dh, dv);
+    __m128i lt = _mm_andnot_si128(eq, _mm_cmpeq_epi8(_mm_min_epu8(dh, dv), dh));
+    __m128i gt = _mm_andnot_si128(_mm_or_si128(eq, lt), _mm_set1_epi8(-1));
+
+    return _mm_or_si128(_mm_or_si128(_mm_and_si128(lt, _mm_avg_epu8(w, e)),
+                                     _mm_and_si128(gt, _mm_avg_epu8(n, s))),
+                        _mm_and_si128(eq, avg4_sse2(w, e, n, s)));
+}
+
+/* stores the even and odd column values interleaved */
+static inline TARGET("sse2") void
+store_pairs_sse2(uint8_t *dst, __m128i e, __m128i o)
+{
+    ST128(dst, _mm_unpacklo_epi8(e, o));
+    ST128(dst + 16, _mm_unpackhi_epi8(e, o));
+}
+
+static TARGET("sse2") void
+split_sse2(const uint8_t *src, uint32_t pairs, uint8_t *e, uint8_t *o)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    __m128i a, b;
+    uint32_t i;
+
+    for (i = 0; i + 16 <= pairs; i += 16) {
+        a = LD128(src + (2 * i));
+        b = LD128(src + (2 * i) + 16);
+        ST128(e + i, _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+        ST128(o + i, _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+    split_scalar(src + (2 * i), pairs - i, e + i, o + i);
+}
+
+static TARGET("sse2") void
+nearest_sse2(const half_row_t *c, const half_row_t *p, gboolean g_even, uint32_t nh,
+             uint8_t *x, uint8_t *g, uint8_t *y)
+{
+    const uint8_t *cg = g_even ? c->e : c->o;
+    const uint8_t *cx = g_even ? c->o : c->e;
+    const uint8_t *py = g_even ? p->e : p->o;
+    __m128i v;
+    uint32_t i;
+
+    for (i = 0; i < nh; i += 16) {
+        v = LD128(cg + i);
+        store_pairs_sse2(g + (2 * i), v, v);
+        v = LD128(cx + i);
+        store_pairs_sse2(x + (2 * i), v, v);
+        v = LD128(py + i);
+        store_pairs_sse2(y + (2 * i), v, v);
+    }
+}
+
+static inline TARGET("sse2") void
+bilinear_site_sse2(taps_t t, uint32_t i, gboolean g_site, gboolean edge, __m128i *x, __m128i *g, __m128i *y)
+{
+    __m128i w = LD128(t[T_W] + i), e = LD128(t[T_E] + i);
+    __m128i n = LD128(t[T_N] + i), s = LD128(t[T_S] + i);
+
+    if (g_site) {
+        *g = LD128(t[T_C] + i);
+        *x = _mm_avg_epu8(w, e);
+        *y = _mm_avg_epu8(n, s);
+    } else {
+        *x = LD128(t[T_C] + i);
+        *g = edge ? edge_g_sse2(w, e, n, s) : avg4_sse2(w, e, n, s);
+        *y = avg4_sse2(LD128(t[T_NW] + i), LD128(t[T_NE] + i), LD128(t[T_SW] + i), LD128(t[T_SE] + i));
+    }
+}
+
+static TARGET("sse2") void
+bilinear_sse2(taps_t even, taps_t odd, gboolean g_even, gboolean edge, uint32_t nh,
+              uint8_t *x, uint8_t *g, uint8_t *y)
+{
+    __m128i xe, ge, ye, xo, go, yo;
+    uint32_t i;
+
+    for (i = 0; i < nh; i += 16) {
+        bilinear_site_sse2(even, i, g_even, edge, &xe, &ge, &ye);
+        bilinear_site_sse2(odd, i, !g_even, edge, &xo, &go, &yo);
+        store_pairs_sse2(x + (2 * i), xe, xo);
+        store_pairs_sse2(g + (2 * i), ge, go);
+        store_pairs_sse2(y + (2 * i), ye, yo);
+    }
+}
+
+/* The two HQ formulas of one half (hi or lo bytes) of a site, in 16 bits */
+static inline TARGET("sse2") void
+hq_half_sse2(const __m128i *v, gboolean hi, gboolean g_site, __m128i *a, __m128i *b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i w[NTAPS], c, we, ns, we2, ns2, d;
+    int k;
+
+#define K(_n)       _mm_set1_epi16(_n)
+#define MUL(_n, _v) _mm_mullo_epi16(K(_n), _v)
+#define ADD         _mm_add_epi16
+#define SUB         _mm_sub_epi16
+
+    for (k = 0; k < NTAPS; k++)
+        w[k] = hi ? _mm_unpackhi_epi8(v[k], zero) : _mm_unpacklo_epi8(v[k], zero);
+
+    c = w[T_C];
+    we = ADD(w[T_W], w[T_E]);
+    ns = ADD(w[T_N], w[T_S]);
+    we2 = ADD(w[T_W2], w[T_E2]);
+    ns2 = ADD(w[T_N2], w[T_S2]);
+    d = ADD(ADD(w[T_NW], w[T_NE]), ADD(w[T_SW], w[T_SE]));
+
+    if (g_site) {
+        *a = SUB(ADD(ADD(MUL(10, c), MUL(8, we)), ns2), ADD(MUL(2, we2), MUL(2, d)));
+        *b = SUB(ADD(ADD(MUL(10, c), MUL(8, ns)), we2), ADD(MUL(2, ns2), MUL(2, d)));
+    } else {
+        *a = SUB(ADD(MUL(8, c), MUL(4, ADD(we, ns))), MUL(2, ADD(we2, ns2)));
+        *b = SUB(ADD(MUL(12, c), MUL(4, d)), MUL(3, ADD(we2, ns2)));
+    }
+    *a = _mm_srai_epi16(ADD(*a, K(8)), 4);
+    *b = _mm_srai_epi16(ADD(*b, K(8)), 4);
+
+#undef K
+#undef MUL
+#undef ADD
+#undef SUB
+}
+
+static inline TARGET("sse2") void
+hq_site_sse2(taps_t t, uint32_t i, gboolean g_site, __m128i *x, __m128i *g, __m128i *y)
+{
+    __m128i v[NTAPS], alo, blo, ahi, bhi, a, b;
+    int k;
+
+    for (k = 0; k < NTAPS; k++)
+        v[k] = LD128(t[k] + i);
+
+    hq_half_sse2(v, FALSE, g_site, &alo, &blo);
+    hq_half_sse2(v, TRUE, g_site, &ahi, &bhi);
+    a = _mm_packus_epi16(alo, ahi);
+    b = _mm_packus_epi16(blo, bhi);
+
+    if (g_site) {
+        *g = v[T_C]; *x = a; *y = b;
+    } else {
+        *x = v[T_C]; *g = a; *y = b;
+    }
+}
+
+static TARGET("sse2") void
+hqlinear_sse2(taps_t even, taps_t odd, gboolean g_even, uint32_t nh,
+              uint8_t *x, uint8_t *g, uint8_t *y)
+{
+    __m128i xe, ge, ye, xo, go, yo;
+    uint32_t i;
+
+    for (i = 0; i < nh; i += 16) {
+        hq_site_sse2(even, i, g_even, &xe, &ge, &ye);
+        hq_site_sse2(odd, i, !g_even, &xo, &go, &yo);
+        store_pairs_sse2(x + (2 * i), xe, xo);
+        store_pairs_sse2(g + (2 * i), ge, go);
+        store_pairs_sse2(y + (2 * i), ye, yo);
+    }
+}
+
+/*
+ * AVX2 kernels, 32 half row samples (64 pixels) at a time. The SSSE3
+ * byte shuffle, which every AVX2 CPU has, also packs RGB.
+ */
+#define LD256(_p)       _mm256_loadu_si256((const __m256i *)(_p))
+#define ST256(_p, _v)   _mm256_storeu_si256((__m256i *)(_p), _v)
+
+static inline TARGET("avx2") __m256i
+avg4_avx2(__m256i a, __m256i b, __m256i c, __m256i d)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i two = _mm256_set1_epi16(2);
+    __m256i lo, hi;
+
+    lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero)),
+                          _mm256_add_epi16(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(d, zero)));
+    hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero)),
+                          _mm256_add_epi16(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(d, zero)));
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+    return _mm256_packus_epi16(lo, hi);
+}
+
+static inline TARGET("avx2") __m256i
+edge_g_avx2(__m256i w, __m256i e, __m256i n, __m256i s)
+{
+    __m256i dh = _mm256_or_si256(_mm256_subs_epu8(w, e), _mm256_subs_epu8(e, w));
+    __m256i dv = _mm256_or_si256(_mm256_subs_epu8(n, s), _mm256_subs_epu8(s, n));
+    __m256i eq = _mm256_cmpeq_epi8(dh, dv);
+    __m256i lt = _mm256_andnot_si256(eq, _mm256_cmpeq_epi8(_mm256_min_epu8(dh, dv), dh));
+    __m256i gt = _mm256_andnot_si256(_mm256_or_si256(eq, lt), _mm256_set1_epi8(-1));
+
+    return _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(lt, _mm256_avg_epu8(w, e)),
+                                           _mm256_and_si256(gt, _mm256_avg_epu8(n, s))),
+                           _mm256_and_si256(eq, avg4_avx2(w, e, n, s)));
+}
+
+/* unpack works within 128 bit lanes, so put the lane halves back in order */
+static inline TARGET("avx2") void
+store_pairs_avx2(uint8_t *dst, __m256i e, __m256i o)
+{
+    __m256i lo = _mm256_unpacklo_epi8(e, o);
+    __m256i hi = _mm256_unpackhi_epi8(e, o);
+
+    ST256(dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+    ST256(dst + 32, _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+static TARGET("avx2") void
+split_avx2(const uint8_t *src, uint32_t pairs, uint8_t *e, uint8_t *o)
+{
+    const __m256i mask = _mm256_set1_epi16(0x00ff);
+    __m256i a, b;
+    uint32_t i;
+
+    for (i = 0; i + 32 <= pairs; i += 32) {
+        a = LD256(src + (2 * i));
+        b = LD256(src + (2 * i) + 32);
+        ST256(e + i, _mm256_permute4x64_epi64(
+                        _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)), 0xd8));
+        ST256(o + i, _mm256_permute4x64_epi64(
+                        _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), 0xd8));
+    }
+    split_sse2(src + (2 * i), pairs - i, e + i, o + i);
+}
+
+static TARGET("avx2") void
+nearest_avx2(const half_row_t *c, const half_row_t *p, gboolean g_even, uint32_t nh,
+             uint8_t *x, uint8_t *g, uint8_t *y)
+{
+    const uint8_t *cg = g_even ? c->e : c->o;
+    const uint8_t *cx = g_even ? c->o : c->e;
+    const uint8_t *py = g_even ? p->e : p->o;
+    __m256i v;
+    uint32_t i;
+
+    for (i = 0; i < nh; i += 32) {
+        v = LD256(cg + i);
+        store_pairs_avx2(g + (2 * i), v, v);
+        v = LD256(cx + i);
+        store_pairs_avx2(x + (2 * i), v, v);
+        v = LD256(py + i);
+        store_pairs_avx2(y + (2 * i), v, v);
+    }
+}
+
+static inline TARGET("avx2") void
+bilinear_site_avx2(taps_t t, uint32_t i, gboolean g_site, gboolean edge, __m256i *x, __m256i *g, __m256i *y)
+{
+    __m256i w = LD256(t[T_W] + i), e = LD256(t[T_E] + i);
+    __m256i n = LD256(t[T_N] + i), s = LD256(t[T_S] + i);
+
+    if (g_site) {
+        *g = LD256(t[T_C] + i);
+        *x = _mm256_avg_epu8(w, e);
+        *y = _mm256_avg_epu8(n, s);
+    } else {
+        *x = LD256(t[T_C] + i);
+        *g = edge ? edge_g_avx2(w, e, n, s) : avg4_avx2(w, e, n, s);
+        *y = avg4_avx2(LD256(t[T_NW] + i), LD256(t[T_NE] + i), LD256(t[T_SW] + i), LD256(t[T_SE] + i));
+    }
+}
+
+static TARGET("avx2") void
+bilinear_avx2(taps_t even, taps_t odd, gboolean g_even, gboolean edge, uint32_t nh,
+              uint8_t *x, uint8_t *g, uint8_t *y)
+{
+    __m256i xe, ge, ye, xo, go, yo;
+    uint32_t i;
+
+    for (i = 0; i < nh; i += 32) {
+        bilinear_site_avx2(even, i, g_even, edge, &xe, &ge, &ye);
+        bilinear_site_avx2(odd, i, !g_even, edge, &xo, &go, &yo);
+        store_pairs_avx2(x + (2 * i), xe, xo);
+        store_pairs_avx2(g + (2 * i), ge, go);
+        store_pairs_avx2(y + (2 * i), ye, yo);
+    }
+}
+
+static inline TARGET("avx2") void
+hq_half_avx2(const __m256i *v, gboolean hi, gboolean g_site, __m256i *a, __m256i *b)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i w[NTAPS], c, we, ns, we2, ns2, d;
+    int k;
+
+#define K(_n)       _mm256_set1_epi16(_n)
+#define MUL(_n, _v) _mm256_mullo_epi16(K(_n), _v)
+#define ADD         _mm256_add_epi16
+#define SUB         _mm256_sub_epi16
+
+    for (k = 0; k < NTAPS; k++)
+        w[k] = hi ? _mm256_unpackhi_epi8(v[k], zero) : _mm256_unpacklo_epi8(v[k], zero);
+
+    c = w[T_C];
+    we = ADD(w[T_W], w[T_E]);
+    ns = ADD(w[T_N], w[T_S]);
+    we2 = ADD(w[T_W2], w[T_E2]);
+    ns2 = ADD(w[T_N2], w[T_S2]);
+    d = ADD(ADD(w[T_NW], w[T_NE]), ADD(w[T_SW], w[T_SE]));
+
+    if (g_site) {
+        *a = SUB(ADD(ADD(MUL(10, c), MUL(8, we)), ns2), ADD(MUL(2, we2), MUL(2, d)));
+        *b = SUB(ADD(ADD(MUL(10, c), MUL(8, ns)), we2), ADD(MUL(2, ns2), MUL(2, d)));
+    } else {
+        *a = SUB(ADD(MUL(8, c), MUL(4, ADD(we, ns))), MUL(2, ADD(we2, ns2)));
+        *b = SUB(ADD(MUL(12, c), MUL(4, d)), MUL(3, ADD(we2, ns2)));
+    }
+    *a = _mm256_srai_epi16(ADD(*a, K(8)), 4);
+    *b = _mm256_srai_epi16(ADD(*b, K(8)), 4);
+
+#undef K
+#undef MUL
+#undef ADD
+#undef SUB
+}
+
+static inline TARGET("avx2") void
+hq_site_avx2(taps_t t, uint32_t i, gboolean g_site, __m256i *x, __m256i *g, __m256i *y)
+{
+    __m256i v[NTAPS], alo, blo, ahi, bhi, a, b;
+    int k;
+
+    for (k = 0; k < NTAPS; k++)
+        v[k] = LD256(t[k] + i);
+
+    /* unpack and pack both work within lanes, so the order comes back */
+    hq_half_avx2(v, FALSE, g_site, &alo, &blo);
+    hq_half_avx2(v, TRUE, g_site, &ahi, &bhi);
+    a = _mm256_packus_epi16(alo, ahi);
+    b = _mm256_packus_epi16(blo, bhi);
+
+    if (g_site) {
+        *g = v[T_C]; *x = a; *y = b;
+    } else {
+        *x = v[T_C]; *g = a; *y = b;
+    }
+}
+
+static TARGET("avx2") void
+hqlinear_avx2(taps_t even, taps_t odd, gboolean g_even, uint32_t nh,
+              uint8_t *x, uint8_t *g, uint8_t *y)
+{
+    __m256i xe, ge, ye, xo, go, yo;
+    uint32_t i;
+
+    for (i = 0; i < nh; i += 32) {
+        hq_site_avx2(even, i, g_even, &xe, &ge, &ye);
+        hq_site_avx2(odd, i, !g_even, &xo, &go, &yo);
+        store_pairs_avx2(x + (2 * i), xe, xo);
+        store_pairs_avx2(g + (2 * i), ge, go);
+        store_pairs_avx2(y + (2 * i), ye, yo);
+    }
+}
+
+/* byte k of each 16 byte block of RGB output is channel k%3 of pixel k/3 */
+static const int8_t pack_shuffle[3][3][16] __attribute__((aligned(16))) = {
+    { { 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+      { -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+      { -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 } },
+    { { -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+      { 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+      { -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 } },
+    { { -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 },
+      { -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 },
+      { 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 } },
+};
+
+static TARGET("avx2") void
+pack_avx2(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint8_t *rgb, uint32_t width)
+{
+    __m128i vr, vg, vb;
+    uint32_t i;
+    int k;
+
+    for (i = 0; i + 16 <= width; i += 16) {
+        vr = LD128(r + i);
+        vg = LD128(g + i);
+        vb = LD128(b + i);
+        for (k = 0; k < 3; k++) {
+            ST128(rgb + (3 * i) + (16 * k),
+                  _mm_or_si128(_mm_or_si128(
+                        _mm_shuffle_epi8(vr, LD128(pack_shuffle[R][k])),
+                        _mm_shuffle_epi8(vg, LD128(pack_shuffle[G][k]))),
+                        _mm_shuffle_epi8(vb, LD128(pack_shuffle[B][k]))));
+        }
+    }
+    pack_scalar(r + i, g + i, b + i, rgb + (3 * i), width - i);
+}
+
+static const kernels_t kernels_sse2 = {
+    split_sse2, nearest_sse2, bilinear_sse2, hqlinear_sse2, pack_scalar
+};
+static const kernels_t kernels_avx2 = {
+    split_avx2, nearest_avx2, bilinear_avx2, hqlinear_avx2, pack_avx2
+};
+
+#endif /* DEMOSAIC_X86 */
+
+G_LOCK_DEFINE_STATIC(impl);
+static demosaic_impl_t current_impl = DEMOSAIC_IMPL_AUTO;
+static const kernels_t *current_kernels = NULL;
+
+static gboolean
+impl_available(demosaic_impl_t impl)
+{
+    switch (impl) {
+        case DEMOSAIC_IMPL_SCALAR:
+            return TRUE;
+#ifdef DEMOSAIC_X86
+        case DEMOSAIC_IMPL_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case DEMOSAIC_IMPL_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return FALSE;
+    }
+}
+
+gboolean demosaic_set_impl(demosaic_impl_t impl)
+{
+    const kernels_t *k;
+
+    if (impl == DEMOSAIC_IMPL_AUTO) {
+        for (impl = DEMOSAIC_IMPL_AVX2; impl > DEMOSAIC_IMPL_SCALAR; impl--) {
+            if (impl_available(impl))
+                break;
+        }
+    }
+    if (!impl_available(impl))
+        return FALSE;
+
+    switch (impl) {
+#ifdef DEMOSAIC_X86
+        case DEMOSAIC_IMPL_SSE2:
+            k = &kernels_sse2;
+            break;
+        case DEMOSAIC_IMPL_AVX2:
+            k = &kernels_avx2;
+            break;
+#endif
+        default:
+            k = &kernels_scalar;
+            break;
+    }
+
+    G_LOCK(impl);
+    current_impl = impl;
+    current_kernels = k;
+    G_UNLOCK(impl);
+    return TRUE;
+}
+
+static const kernels_t *
+get_kernels(void)
+{
+    const kernels_t *k;
+
+    G_LOCK(impl);
+    k = current_kernels;
+    G_UNLOCK(impl);
+
+    if (k == NULL) {
+        demosaic_set_impl(DEMOSAIC_IMPL_AUTO);
+        return get_kernels();
+    }
+    return k;
+}
+
+demosaic_impl_t demosaic_get_impl(void)
+{
+    demosaic_impl_t impl;
+
+    get_kernels();
+    G_LOCK(impl);
+    impl = current_impl;
+    G_UNLOCK(impl);
+    return impl;
+}
+
+const char *demosaic_impl_to_string(demosaic_impl_t impl)
+{
+    switch (impl) {
+        case DEMOSAIC_IMPL_AUTO:
+            return "auto";
+        case DEMOSAIC_IMPL_SCALAR:
+            return "scalar";
+        case DEMOSAIC_IMPL_SSE2:
+            return "sse2";
+        case DEMOSAIC_IMPL_AVX2:
+            return "avx2";
+    }
+    return "unknown";
+}
+
+void demosaic_pack_rgb8(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint8_t *rgb, uint32_t width)
+{
+    get_kernels()->pack(r, g, b, rgb, width);
+}
+
+/* Splits source row y into h, unless it is already there */
+static void
+load_half_row(const kernels_t *k, half_row_t *h, const uint8_t *bayer, size_t stride,
+              uint32_t width, uint32_t y)
+{
+    const uint8_t *src = bayer + ((size_t)y * stride);
+    uint32_t ne = (width + 1) / 2, no = width / 2;
+
+    if (h->y == y)
+        return;
+
+    k->split(src, no, h->e, h->o);
+    if (ne > no)
+        h->e[no] = src[width - 1];
+
+    /* mirrored samples beyond each end */
+    h->e[-1] = src[mirror(-2, width)];
+    h->o[-1] = src[mirror(-1, width)];
+    h->e[ne] = src[mirror(2 * (int64_t)ne, width)];
+    h->o[no] = src[mirror((2 * (int64_t)no) + 1, width)];
+    h->y = y;
+}
+
+static dc1394error_t
+demosaic_rows(const uint8_t *bayer, size_t stride, uint8_t *rgb, size_t rgb_stride,
+              uint32_t width, uint32_t height, uint32_t y0, uint32_t y1,
+              dc1394color_filter_t filter, dc1394bayer_method_t method, gboolean bgr);
+
+dc1394error_t demosaic_rgb8(const uint8_t *bayer, size_t stride, uint8_t *rgb, size_t rgb_stride,
+                uint32_t width, uint32_t height, dc1394color_filter_t filter, dc1394bayer_method_t method)
+{
+    return demosaic_rows(bayer, stride, rgb, rgb_stride, width, height, 0, height, filter, method, FALSE);
+}
+
+dc1394error_t demosaic_rgb8_rows(const uint8_t *bayer, size_t stride, uint8_t *rgb, size_t rgb_stride,
+                uint32_t width, uint32_t height, uint32_t y0, uint32_t y1,
+                dc1394color_filter_t filter, dc1394bayer_method_t method)
+{
+    return demosaic_rows(bayer, stride, rgb, rgb_stride, width, height, y0, y1, filter, method, FALSE);
+}
+
+dc1394error_t demosaic_bgr8_rows(const uint8_t *bayer, size_t stride, uint8_t *bgr, size_t bgr_stride,
+                uint32_t width, uint32_t height, uint32_t y0, uint32_t y1,
+                dc1394color_filter_t filter, dc1394bayer_method_t method)
+{
+    return demosaic_rows(bayer, stride, bgr, bgr_stride, width, height, y0, y1, filter, method, TRUE);
+}
+
+/* bgr only swaps the planes handed to the pack step, so costs nothing */
+static dc1394error_t
+demosaic_rows(const uint8_t *bayer, size_t stride, uint8_t *rgb, size_t rgb_stride,
+              uint32_t width, uint32_t height, uint32_t y0, uint32_t y1,
+              dc1394color_filter_t filter, dc1394bayer_method_t method, gboolean bgr)
+{
+    const kernels_t *k;
+    const int (*pat)[2];
+    half_row_t rows[5], *r[5];
+    taps_t even, odd;
+    uint8_t *mem, *planes[3];
+    size_t half_bytes, plane_bytes;
+    uint32_t y, nh;
+    int i, x_color, reach;
+    gboolean g_even;
+
+    if (!check_args(bayer, rgb, width, height, filter, method) || y0 > y1 || y1 > height)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    k = get_kernels();
+    pat = patterns[filter - DC1394_COLOR_FILTER_MIN];
+    nh = (width + 1) / 2;
+
+    /* rows either side each method reads (nearest loads its pair below) */
+    reach = method == DC1394_BAYER_METHOD_HQLINEAR ? 2 : method == DC1394_BAYER_METHOD_NEAREST ? 0 : 1;
+
+    /* one allocation for the half rows and planes of the whole frame */
+    half_bytes = nh + (2 * ROW_PAD);
+    plane_bytes = (2 * nh) + (2 * ROW_PAD);
+    mem = (uint8_t *)calloc(1, (10 * half_bytes) + (3 * plane_bytes));
+    if (mem == NULL)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+
+    for (i = 0; i < 5; i++) {
+        rows[i].e = mem + (((2 * i) * half_bytes) + ROW_PAD);
+        rows[i].o = mem + ((((2 * i) + 1) * half_bytes) + ROW_PAD);
+        rows[i].y = -1;
+    }
+    for (i = 0; i < 3; i++)
+        planes[i] = mem + (10 * half_bytes) + (i * plane_bytes);
+
+    for (y = y0; y < y1; y++) {
+        /* the rows in use are at most two apart, so never share a slot */
+        for (i = 0; i < 5; i++) {
+            uint32_t yr = mirror((int64_t)y + i - 2, height);
+
+            r[i] = &rows[yr % 5];
+            if (ABS(i - 2) <= reach)
+                load_half_row(k, r[i], bayer, stride, width, yr);
+        }
+
+        /* X is the other color of this row, Y that of the rows above and below */
+        g_even = pat[y & 1][0] == G;
+        x_color = g_even ? pat[y & 1][1] : pat[y & 1][0];
+
+        if (method == DC1394_BAYER_METHOD_NEAREST) {
+            uint32_t yp = mirror(y ^ 1, height);
+
+            load_half_row(k, &rows[yp % 5], bayer, stride, width, yp);
+            k->nearest(r[2], &rows[yp % 5], g_even, nh,
+                       planes[x_color], planes[G], planes[B - x_color]);
+        } else {
+            make_taps((const half_row_t *const *)r, even, odd);
+            if (method == DC1394_BAYER_METHOD_HQLINEAR)
+                k->hqlinear(even, odd, g_even, nh,
+                            planes[x_color], planes[G], planes[B - x_color]);
+            else
+                k->bilinear(even, odd, g_even, method == DC1394_BAYER_METHOD_EDGESENSE, nh,
+                            planes[x_color], planes[G], planes[B - x_color]);
+        }
+
+        k->pack(planes[bgr ? B : R], planes[G], planes[bgr ? R : B], rgb + (y * rgb_stride), width);
+    }
+
+    free(mem);
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t demosaic_frame(dc1394video_frame_t *in, dc1394video_frame_t *out, dc1394bayer_method_t method)
+{
+    uint64_t nbytes;
+    dc1394error_t err;
+
+    g_return_val_if_fail(in != NULL && in->image != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+    g_return_val_if_fail(out != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+
+    if ((in->color_coding != DC1394_COLOR_CODING_RAW8 && in->color_coding != DC1394_COLOR_CODING_MONO8) ||
+        !demosaic_method_supported(method) || in->size[0] < 2 || in->size[1] < 2)
+        return dc1394_debayer_frames(in, out, method);
+
+    nbytes = (uint64_t)in->size[0] * in->size[1] * 3;
+    if (out->image == NULL || out->allocated_image_bytes < nbytes) {
+        free(out->image);
+        out->image = (unsigned char *)malloc(nbytes);
+        out->allocated_image_bytes = out->image ? nbytes : 0;
+        if (out->image == NULL)
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    err = demosaic_rgb8(in->image, in->stride ? in->stride : in->size[0],
+                        out->image, (size_t)in->size[0] * 3,
+                        in->size[0], in->size[1], in->color_filter, method);
+    if (err != DC1394_SUCCESS)
+        return err;
+
+    out->size[0] = in->size[0];
+    out->size[1] = in->size[1];
+    out->position[0] = in->position[0];
+    out->position[1] = in->position[1];
+    out->color_coding = DC1394_COLOR_CODING_RGB8;
+    out->color_filter = in->color_filter;
+    out->data_depth = 8;
+    out->stride = in->size[0] * 3;
+    out->video_mode = in->video_mode;
+    out->padding_bytes = 0;
+    out->image_bytes = out->total_bytes = nbytes;
+    out->little_endian = DC1394_FALSE;
+    out->data_in_padding = DC1394_FALSE;
+    out->timestamp = in->timestamp;
+    out->id = in->id;
+    return DC1394_SUCCESS;
+}
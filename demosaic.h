@@ -0,0 +1,146 @@
+/*
+ * Bayer demosaicing of RAW8 frames, with SIMD kernels chosen at runtime
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _DEMOSAIC_H_
+#define _DEMOSAIC_H_
+
+#include <inttypes.h>
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Our own demosaicing for 8 bit Bayer data, for all four
+ * dc1394color_filter_t patterns. Every implementation gives bit identical
+ * results to demosaic_rgb8_reference():
+ *
+ *  nearest:   each 2x2 cell of the mosaic takes its R, B and the G from the
+ *             same row for both of its pixels in that row
+ *  bilinear:  missing colors are the rounded mean of the 2 or 4 nearest
+ *             samples of that color, (a+b+1)/2 or (a+b+c+d+2)/4
+ *  hqlinear:  Malvar-He-Cutler, bilinear corrected by the gradient of the
+ *             color present, over a 5x5 neighbourhood; the sharpest
+ *  edgesense: bilinear, except G at R and B sites is the mean of the two
+ *             neighbours across the smaller difference (of all four if
+ *             equal), which avoids zippering along edges
+ *
+ * Edges are mirrored (x=-1 reads x=1), which keeps the Bayer phase. Images
+ * must be at least 2x2.
+ */
+typedef enum {
+    DEMOSAIC_IMPL_AUTO,         /* the fastest the CPU supports */
+    DEMOSAIC_IMPL_SCALAR,
+    DEMOSAIC_IMPL_SSE2,
+    DEMOSAIC_IMPL_AVX2
+} demosaic_impl_t;
+
+#define DEMOSAIC_METHOD_NAMES "nearest, bilinear, hqlinear, edgesense"
+
+/**
+ * TRUE for the methods this module implements, NEAREST, BILINEAR, HQLINEAR
+ * and EDGESENSE
+ */
+gboolean demosaic_method_supported(dc1394bayer_method_t method);
+
+/**
+ * Parses a method name (see DEMOSAIC_METHOD_NAMES). Returns FALSE if the
+ * name is not recognised.
+ */
+gboolean demosaic_method_from_string(const char *name, dc1394bayer_method_t *method);
+
+const char *demosaic_method_to_string(dc1394bayer_method_t method);
+
+/**
+ * The method the tools demosaic with, NEAREST unless set, e.g. from
+ * GOPTION_ENTRY_BAYER_METHOD
+ */
+void demosaic_set_method(dc1394bayer_method_t method);
+
+dc1394bayer_method_t demosaic_get_method(void);
+
+/**
+ * GOption entry to choose the demosaicing method, by name
+ */
+#define GOPTION_ENTRY_BAYER_METHOD(_name)                                                       \
+      { "bayer-method", 'B', 0, G_OPTION_ARG_STRING, _name, "Demosaicing method: " DEMOSAIC_METHOD_NAMES, "nearest" }
+
+/**
+ * Selects the kernels used by every later call. Returns FALSE (and keeps
+ * the current kernels) if the CPU, or this build, lacks impl.
+ */
+gboolean demosaic_set_impl(demosaic_impl_t impl);
+
+/**
+ * The kernels in use; never DEMOSAIC_IMPL_AUTO
+ */
+demosaic_impl_t demosaic_get_impl(void);
+
+const char *demosaic_impl_to_string(demosaic_impl_t impl);
+
+/**
+ * Interleaves width samples from three planes into RGB8 with the current
+ * kernels; pass the planes as b, g, r for BGR8
+ */
+void demosaic_pack_rgb8(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint8_t *rgb, uint32_t width);
+
+/**
+ * Demosaics a width x height mosaic into interleaved RGB8
+ */
+dc1394error_t demosaic_rgb8(const uint8_t *bayer, size_t stride, uint8_t *rgb, size_t rgb_stride,
+                uint32_t width, uint32_t height, dc1394color_filter_t filter, dc1394bayer_method_t method);
+
+/**
+ * As demosaic_rgb8() but only for output rows y0 to y1-1 of the image, so
+ * bands of one frame can be demosaiced in parallel. The rows either side
+ * of the band are read as needed, the output is the same as for the whole
+ * image.
+ */
+dc1394error_t demosaic_rgb8_rows(const uint8_t *bayer, size_t stride, uint8_t *rgb, size_t rgb_stride,
+                uint32_t width, uint32_t height, uint32_t y0, uint32_t y1,
+                dc1394color_filter_t filter, dc1394bayer_method_t method);
+
+/**
+ * As demosaic_rgb8_rows() but with the samples of each pixel in B, G, R
+ * order, as OpenCV expects, with no extra pass over the image
+ */
+dc1394error_t demosaic_bgr8_rows(const uint8_t *bayer, size_t stride, uint8_t *bgr, size_t bgr_stride,
+                uint32_t width, uint32_t height, uint32_t y0, uint32_t y1,
+                dc1394color_filter_t filter, dc1394bayer_method_t method);
+
+/**
+ * The straightforward per pixel implementation the kernels are checked
+ * against
+ */
+dc1394error_t demosaic_rgb8_reference(const uint8_t *bayer, size_t stride, uint8_t *rgb, size_t rgb_stride,
+                uint32_t width, uint32_t height, dc1394color_filter_t filter, dc1394bayer_method_t method);
+
+/**
+ * A drop in for dc1394_debayer_frames(); out becomes an RGB8 frame, its
+ * image reallocated if allocated_image_bytes is too small. 8 bit frames
+ * with a supported method are demosaiced here, anything else is passed on
+ * to libdc1394.
+ */
+dc1394error_t demosaic_frame(dc1394video_frame_t *in, dc1394video_frame_t *out, dc1394bayer_method_t method);
+
+G_END_DECLS
+
+#endif
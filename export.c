@@ -0,0 +1,682 @@
+/*
+ * Export of frames as PGM/PPM images and NumPy arrays
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "export.h"
+#include "demosaic.h"
+#include "mono16.h"
+#include "yuv.h"
+
+/* the .npy header is rewritten with the final item count on close, so
+ * it is given a fixed size; a multiple of 64 keeps the data aligned */
+#define NPY_MAGIC           "\x93NUMPY"
+#define NPY_HEADER_BYTES    128
+#define NPY_MAX_DIMS        4
+
+#define AVI_MAX_HEADER      2048
+#define AVIF_HASINDEX       0x10
+#define AVIIF_KEYFRAME      0x10
+
+struct __npy_writer
+{
+    FILE            *fp;
+    gchar           *dtype;
+    uint32_t        shape[NPY_MAX_DIMS];
+    unsigned int    ndim;
+    size_t          item_bytes;
+    uint64_t        count;
+    gboolean        failed;
+};
+
+struct __video_writer
+{
+    FILE                *fp;
+    gboolean            owns_fp;
+    gboolean            seekable;
+    video_container_t   container;
+    uint32_t            width;
+    uint32_t            height;
+    gboolean            gray;
+    uint32_t            rate;           /* frames per 1000 seconds */
+    size_t              frame_bytes;    /* encoded frame */
+    size_t              row_bytes;      /* AVI: DIB row, padded to 4 bytes */
+    size_t              header_bytes;
+    uint64_t            promised;       /* frames in the header of a pipe */
+    uint64_t            count;
+    gboolean            failed;
+};
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v; p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+unsigned int export_bytes_per_pixel(const dc1394video_frame_t *frame)
+{
+    switch (frame->color_coding) {
+        case DC1394_COLOR_CODING_MONO8:
+        case DC1394_COLOR_CODING_RAW8:
+            return 1;
+        case DC1394_COLOR_CODING_MONO16:
+        case DC1394_COLOR_CODING_RAW16:
+            return 2;
+        case DC1394_COLOR_CODING_RGB8:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+/* Writes the rows of frame without padding. If swap is TRUE 16 bit
+ * samples are byte swapped on the way, a row at a time */
+static gboolean
+write_rows(FILE *fp, dc1394video_frame_t *frame, unsigned int bpp, gboolean swap)
+{
+    size_t row_bytes = (size_t)frame->size[0] * bpp;
+    size_t stride = frame->stride ? frame->stride : row_bytes;
+    uint8_t *row = NULL;
+    uint32_t y;
+    gboolean ok = TRUE;
+
+    if (!swap && stride == row_bytes)
+        return fwrite(frame->image, row_bytes, frame->size[1], fp) == frame->size[1];
+
+    if (swap)
+        row = g_malloc(row_bytes);
+
+    for (y = 0; ok && y < frame->size[1]; y++) {
+        const uint8_t *src = frame->image + (y * stride);
+        if (swap) {
+            mono16_swap(src, row, frame->size[0]);
+            src = row;
+        }
+        ok = fwrite(src, row_bytes, 1, fp) == 1;
+    }
+
+    g_free(row);
+    return ok;
+}
+
+static gboolean
+write_pnm(dc1394video_frame_t *frame, const char *filename, const char *magic, unsigned int bpp, unsigned int maxval, gboolean swap)
+{
+    FILE *fp;
+    gboolean ok;
+
+    fp = fopen(filename, "wb");
+    if (fp == NULL)
+        return FALSE;
+
+    ok = fprintf(fp, "%s\n%u %u\n%u\n", magic, frame->size[0], frame->size[1], maxval) > 0 &&
+         write_rows(fp, frame, bpp, swap);
+
+    return (fclose(fp) == 0) && ok;
+}
+
+gboolean export_frame_pgm(dc1394video_frame_t *frame, const char *filename)
+{
+    unsigned int bpp;
+
+    g_return_val_if_fail(frame != NULL && frame->image != NULL, FALSE);
+    g_return_val_if_fail(filename != NULL, FALSE);
+
+    bpp = export_bytes_per_pixel(frame);
+    if (bpp == 1)
+        return write_pnm(frame, filename, "P5", 1, 255, FALSE);
+    if (bpp != 2)
+        return FALSE;
+
+    /* PGM is big endian. The frame says what order the camera sent the
+     * samples in, which for a recording made on this host is its own */
+    return write_pnm(frame, filename, "P5", 2, mono16_max_value(frame),
+                     frame->little_endian ? TRUE : FALSE);
+}
+
+/* Debayers a RAW8 frame, or converts a YUV one, into scratch as RGB8,
+ * growing its image if needed */
+static gboolean
+rgb8_to_scratch(dc1394video_frame_t *frame, dc1394video_frame_t *scratch)
+{
+    uint64_t nbytes;
+    uint32_t bits;
+
+    nbytes = (uint64_t)frame->size[0] * frame->size[1] * 3;
+    if (scratch->image == NULL || scratch->allocated_image_bytes < nbytes) {
+        free(scratch->image);
+        scratch->image = (unsigned char *)malloc(nbytes);
+        scratch->allocated_image_bytes = scratch->image ? nbytes : 0;
+        if (scratch->image == NULL)
+            return FALSE;
+    }
+
+    scratch->color_coding = DC1394_COLOR_CODING_RGB8;
+    if (yuv_coding_supported(frame->color_coding)) {
+        dc1394_get_color_coding_bit_size(frame->color_coding, &bits);
+        if (yuv_to_rgb8_rows(frame->image, frame->stride ? frame->stride : (size_t)frame->size[0] * bits / 8,
+                             scratch->image, (size_t)frame->size[0] * 3, frame->size[0], 0, frame->size[1],
+                             frame->color_coding, (dc1394byte_order_t)frame->yuv_byte_order) != DC1394_SUCCESS)
+            return FALSE;
+    } else if (demosaic_frame(frame, scratch, demosaic_get_method()) != DC1394_SUCCESS) {
+        return FALSE;
+    }
+
+    scratch->size[0] = frame->size[0];
+    scratch->size[1] = frame->size[1];
+    scratch->stride = frame->size[0] * 3;
+    return TRUE;
+}
+
+gboolean export_frame_ppm(dc1394video_frame_t *frame, dc1394video_frame_t *scratch, const char *filename)
+{
+    g_return_val_if_fail(frame != NULL && frame->image != NULL, FALSE);
+    g_return_val_if_fail(filename != NULL, FALSE);
+
+    if (frame->color_coding == DC1394_COLOR_CODING_RGB8)
+        return write_pnm(frame, filename, "P6", 3, 255, FALSE);
+    if (frame->color_coding != DC1394_COLOR_CODING_RAW8 && !yuv_coding_supported(frame->color_coding))
+        return FALSE;
+
+    g_return_val_if_fail(scratch != NULL, FALSE);
+
+    if (!rgb8_to_scratch(frame, scratch))
+        return FALSE;
+    return write_pnm(scratch, filename, "P6", 3, 255, FALSE);
+}
+
+static gboolean
+npy_write_header(npy_writer_t *npy)
+{
+    char header[NPY_HEADER_BYTES];
+    GString *dict;
+    unsigned int i;
+    size_t len;
+
+    dict = g_string_new(NULL);
+    g_string_append_printf(dict, "{'descr': '%s', 'fortran_order': False, 'shape': (%" PRIu64 ",",
+                           npy->dtype, npy->count);
+    for (i = 0; i < npy->ndim; i++)
+        g_string_append_printf(dict, "%s%u", i ? ", " : " ", npy->shape[i]);
+    g_string_append(dict, "), }");
+
+    /* magic, version 1.0, little endian header length, then the dict
+     * padded with spaces and ending in a newline */
+    len = 10 + dict->len + 1;
+    if (len > NPY_HEADER_BYTES) {
+        g_string_free(dict, TRUE);
+        return FALSE;
+    }
+
+    memset(header, ' ', sizeof(header));
+    memcpy(header, NPY_MAGIC, 6);
+    header[6] = 1;
+    header[7] = 0;
+    header[8] = (NPY_HEADER_BYTES - 10) & 0xff;
+    header[9] = (NPY_HEADER_BYTES - 10) >> 8;
+    memcpy(header + 10, dict->str, dict->len);
+    header[NPY_HEADER_BYTES - 1] = '\n';
+    g_string_free(dict, TRUE);
+
+    return fseeko(npy->fp, 0, SEEK_SET) == 0 &&
+           fwrite(header, sizeof(header), 1, npy->fp) == 1;
+}
+
+npy_writer_t *npy_writer_open(const char *filename, const char *dtype, const uint32_t *shape, unsigned int ndim)
+{
+    npy_writer_t *npy;
+    unsigned int i;
+
+    g_return_val_if_fail(filename != NULL, NULL);
+    g_return_val_if_fail(dtype != NULL && strlen(dtype) >= 3, NULL);
+    g_return_val_if_fail(ndim <= NPY_MAX_DIMS, NULL);
+
+    npy = g_new0(npy_writer_t, 1);
+    npy->dtype = g_strdup(dtype);
+    npy->ndim = ndim;
+    npy->item_bytes = atoi(dtype + 2);
+    for (i = 0; i < ndim; i++) {
+        npy->shape[i] = shape[i];
+        npy->item_bytes *= shape[i];
+    }
+
+    npy->fp = fopen(filename, "wb");
+    if (npy->fp == NULL || npy->item_bytes == 0 || !npy_write_header(npy)) {
+        if (npy->fp)
+            fclose(npy->fp);
+        g_free(npy->dtype);
+        g_free(npy);
+        return NULL;
+    }
+
+    return npy;
+}
+
+npy_writer_t *npy_writer_open_frames(const char *filename, const dc1394video_frame_t *format)
+{
+    uint32_t shape[3];
+    unsigned int bpp;
+    const char *dtype;
+
+    g_return_val_if_fail(format != NULL, NULL);
+
+    bpp = export_bytes_per_pixel(format);
+    shape[0] = format->size[1];
+    shape[1] = format->size[0];
+    shape[2] = 3;
+
+    switch (bpp) {
+        case 1:
+            return npy_writer_open(filename, "|u1", shape, 2);
+        case 2:
+            dtype = format->little_endian ? "<u2" : ">u2";
+            return npy_writer_open(filename, dtype, shape, 2);
+        case 3:
+            return npy_writer_open(filename, "|u1", shape, 3);
+        default:
+            return NULL;
+    }
+}
+
+gboolean npy_writer_append(npy_writer_t *npy, const void *item)
+{
+    g_return_val_if_fail(npy != NULL, FALSE);
+
+    if (fwrite(item, npy->item_bytes, 1, npy->fp) != 1) {
+        npy->failed = TRUE;
+        return FALSE;
+    }
+    npy->count++;
+    return TRUE;
+}
+
+gboolean npy_writer_append_frame(npy_writer_t *npy, dc1394video_frame_t *frame)
+{
+    unsigned int bpp;
+
+    g_return_val_if_fail(npy != NULL, FALSE);
+    g_return_val_if_fail(frame != NULL && frame->image != NULL, FALSE);
+
+    bpp = export_bytes_per_pixel(frame);
+    if ((size_t)frame->size[0] * frame->size[1] * bpp != npy->item_bytes)
+        return FALSE;
+
+    if (!write_rows(npy->fp, frame, bpp, FALSE)) {
+        npy->failed = TRUE;
+        return FALSE;
+    }
+    npy->count++;
+    return TRUE;
+}
+
+uint64_t npy_writer_get_count(npy_writer_t *npy)
+{
+    g_return_val_if_fail(npy != NULL, 0);
+    return npy->count;
+}
+
+gboolean npy_writer_close(npy_writer_t *npy)
+{
+    gboolean ok;
+
+    g_return_val_if_fail(npy != NULL, FALSE);
+
+    ok = !npy->failed && npy_write_header(npy);
+    ok = (fclose(npy->fp) == 0) && ok;
+    g_free(npy->dtype);
+    g_free(npy);
+    return ok;
+}
+
+/* Builds the AVI headers for nframes frames into buf, up to and including
+ * the start of the movi list. Returns the header length. */
+static size_t
+avi_build_header(video_writer_t *video, uint8_t *buf, uint64_t nframes)
+{
+    size_t pos, hdrl, strl, strf, palette;
+    uint64_t movi_bytes;
+    int i;
+
+#define FOURCC(_s)  do { memcpy(buf + pos, _s, 4); pos += 4; } while (0)
+#define U32(_v)     do { put_le32(buf + pos, (uint32_t)(_v)); pos += 4; } while (0)
+#define U16(_v)     do { put_le16(buf + pos, (uint16_t)(_v)); pos += 2; } while (0)
+
+    memset(buf, 0, AVI_MAX_HEADER);
+    palette = video->gray ? 256 * 4 : 0;
+    movi_bytes = 4 + (nframes * (8 + video->frame_bytes));
+
+    pos = 0;
+    FOURCC("RIFF"); U32(0); FOURCC("AVI ");
+
+    FOURCC("LIST"); hdrl = pos; U32(0); FOURCC("hdrl");
+    FOURCC("avih"); U32(56);
+    U32(1e9 / video->rate);                             /* microseconds per frame */
+    U32(video->frame_bytes * (video->rate / 1000.0));   /* max bytes per second */
+    U32(0);                                             /* padding granularity */
+    U32(AVIF_HASINDEX);
+    U32(nframes);
+    U32(0);                                             /* initial frames */
+    U32(1);                                             /* streams */
+    U32(video->frame_bytes);                            /* suggested buffer */
+    U32(video->width);
+    U32(video->height);
+    pos += 16;                                          /* reserved */
+
+    FOURCC("LIST"); strl = pos; U32(0); FOURCC("strl");
+    FOURCC("strh"); U32(56);
+    FOURCC("vids"); FOURCC("DIB ");
+    U32(0);                                             /* flags */
+    U16(0); U16(0);                                     /* priority, language */
+    U32(0);                                             /* initial frames */
+    U32(1000); U32(video->rate);                        /* scale, rate */
+    U32(0);                                             /* start */
+    U32(nframes);                                       /* length */
+    U32(video->frame_bytes);                            /* suggested buffer */
+    U32(0xffffffff);                                    /* quality */
+    U32(video->frame_bytes);                            /* sample size */
+    U16(0); U16(0); U16(video->width); U16(video->height);
+
+    /* BITMAPINFOHEADER, rows bottom up, then the gray palette */
+    FOURCC("strf"); strf = pos; U32(0);
+    U32(40);
+    U32(video->width);
+    U32(video->height);
+    U16(1);                                             /* planes */
+    U16(video->gray ? 8 : 24);
+    U32(0);                                             /* BI_RGB */
+    U32(video->frame_bytes);
+    U32(0); U32(0);                                     /* pixels per meter */
+    U32(video->gray ? 256 : 0);                         /* colors used */
+    U32(0);                                             /* colors important */
+    for (i = 0; palette && i < 256; i++) {
+        buf[pos++] = i; buf[pos++] = i; buf[pos++] = i; buf[pos++] = 0;
+    }
+    put_le32(buf + strf, pos - strf - 4);
+    put_le32(buf + strl, pos - strl - 4);
+    put_le32(buf + hdrl, pos - hdrl - 4);
+
+    FOURCC("LIST"); U32(movi_bytes); FOURCC("movi");
+
+    /* the index follows the frames */
+    put_le32(buf + 4, (pos - 8) + (movi_bytes - 4) + 8 + (nframes * 16));
+
+#undef FOURCC
+#undef U32
+#undef U16
+
+    return pos;
+}
+
+/* Largest frame count whose AVI still fits the 32 bit RIFF size */
+static uint64_t
+avi_max_frames(video_writer_t *video)
+{
+    return (G_MAXUINT32 - AVI_MAX_HEADER) / (8 + video->frame_bytes + 16);
+}
+
+static gboolean
+video_write_header(video_writer_t *video, uint64_t nframes)
+{
+    uint8_t buf[AVI_MAX_HEADER];
+    char *hdr;
+    gboolean ok;
+
+    if (video->container == VIDEO_Y4M) {
+        hdr = g_strdup_printf("YUV4MPEG2 W%u H%u F%u:1000 Ip A1:1 C%s\n",
+                              video->width, video->height, video->rate,
+                              video->gray ? "mono" : "444");
+        ok = fputs(hdr, video->fp) >= 0;
+        g_free(hdr);
+        return ok;
+    }
+
+    video->header_bytes = avi_build_header(video, buf, nframes);
+    return fwrite(buf, video->header_bytes, 1, video->fp) == 1;
+}
+
+video_writer_t *video_writer_open(const char *filename, video_container_t container,
+                const dc1394video_frame_t *format, double fps, uint64_t nframes)
+{
+    video_writer_t *video;
+    struct stat st;
+
+    g_return_val_if_fail(filename != NULL, NULL);
+    g_return_val_if_fail(format != NULL, NULL);
+    g_return_val_if_fail(fps > 0, NULL);
+
+    switch (format->color_coding) {
+        case DC1394_COLOR_CODING_MONO8:
+        case DC1394_COLOR_CODING_MONO16:
+        case DC1394_COLOR_CODING_RGB8:
+        case DC1394_COLOR_CODING_RAW8:
+        case DC1394_COLOR_CODING_YUV411:
+        case DC1394_COLOR_CODING_YUV422:
+        case DC1394_COLOR_CODING_YUV444:
+            break;
+        default:
+            return NULL;
+    }
+
+    video = g_new0(video_writer_t, 1);
+    video->container = container;
+    video->width = format->size[0];
+    video->height = format->size[1];
+    video->gray = format->color_coding == DC1394_COLOR_CODING_MONO8 ||
+                  format->color_coding == DC1394_COLOR_CODING_MONO16;
+    video->rate = MAX(1, (uint32_t)floor((fps * 1000) + 0.5));
+
+    if (container == VIDEO_Y4M) {
+        video->row_bytes = video->width;
+        video->frame_bytes = (size_t)video->width * video->height * (video->gray ? 1 : 3);
+    } else {
+        video->row_bytes = ((video->width * (video->gray ? 1 : 3)) + 3) & ~3;
+        video->frame_bytes = video->row_bytes * video->height;
+    }
+
+    if (strcmp(filename, "-") == 0) {
+        video->fp = stdout;
+    } else {
+        video->fp = fopen(filename, "wb");
+        video->owns_fp = TRUE;
+    }
+    if (video->fp == NULL) {
+        g_free(video);
+        return NULL;
+    }
+    video->seekable = fstat(fileno(video->fp), &st) == 0 && S_ISREG(st.st_mode);
+
+    /* a pipe cannot be patched afterwards, so promise the count now */
+    if (container == VIDEO_AVI && !video->seekable) {
+        if (nframes == 0 || nframes > avi_max_frames(video))
+            goto error;
+        video->promised = nframes;
+    }
+
+    if (!video_write_header(video, video->promised))
+        goto error;
+
+    return video;
+
+error:
+    if (video->owns_fp)
+        fclose(video->fp);
+    g_free(video);
+    return NULL;
+}
+
+size_t video_writer_get_frame_bytes(video_writer_t *video)
+{
+    g_return_val_if_fail(video != NULL, 0);
+    return video->frame_bytes;
+}
+
+gboolean video_writer_encode(video_writer_t *video, dc1394video_frame_t *frame,
+                dc1394video_frame_t *scratch, uint8_t *out)
+{
+    const uint8_t *src, *row;
+    size_t stride, plane;
+    uint32_t x, y, w, h;
+    unsigned int bpp;
+    uint32_t low, high;
+    uint8_t *dst;
+
+    g_return_val_if_fail(video != NULL && out != NULL, FALSE);
+    g_return_val_if_fail(frame != NULL && frame->image != NULL, FALSE);
+
+    w = video->width;
+    h = video->height;
+    if (frame->size[0] != w || frame->size[1] != h)
+        return FALSE;
+
+    if (frame->color_coding == DC1394_COLOR_CODING_RAW8 || yuv_coding_supported(frame->color_coding)) {
+        if (scratch == NULL || !rgb8_to_scratch(frame, scratch))
+            return FALSE;
+        frame = scratch;
+    }
+
+    bpp = export_bytes_per_pixel(frame);
+    src = frame->image;
+    stride = frame->stride ? frame->stride : (size_t)w * bpp;
+    mono16_get_window(frame, &low, &high);
+    plane = (size_t)w * h;
+
+    for (y = 0; y < h; y++) {
+        row = src + (y * stride);
+
+        /* AVI stores rows bottom up */
+        if (video->container == VIDEO_AVI) {
+            dst = out + ((h - 1 - y) * video->row_bytes);
+            memset(dst + (w * (video->gray ? 1 : 3)), 0, video->row_bytes - (w * (video->gray ? 1 : 3)));
+        } else {
+            dst = out + (y * video->row_bytes);
+        }
+
+        if (bpp == 1) {
+            memcpy(dst, row, w);
+        } else if (bpp == 2) {
+            mono16_window_level(row, frame->little_endian, dst, w, low, high);
+        } else if (video->container == VIDEO_AVI) {
+            for (x = 0; x < w; x++) {
+                dst[3 * x] = row[(3 * x) + 2];
+                dst[(3 * x) + 1] = row[(3 * x) + 1];
+                dst[(3 * x) + 2] = row[3 * x];
+            }
+        } else {
+            /* BT.601 studio range Y'CbCr, one plane each */
+            for (x = 0; x < w; x++) {
+                int r = row[3 * x], g = row[(3 * x) + 1], b = row[(3 * x) + 2];
+                dst[x] =             16 + (((66 * r) + (129 * g) + (25 * b) + 128) >> 8);
+                dst[x + plane] =     128 + (((-38 * r) - (74 * g) + (112 * b) + 128) >> 8);
+                dst[x + 2 * plane] = 128 + (((112 * r) - (94 * g) - (18 * b) + 128) >> 8);
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+gboolean video_writer_write(video_writer_t *video, const uint8_t *encoded)
+{
+    uint8_t chunk[8];
+
+    g_return_val_if_fail(video != NULL && encoded != NULL, FALSE);
+
+    if (video->failed)
+        return FALSE;
+
+    if (video->container == VIDEO_Y4M) {
+        video->failed = fputs("FRAME\n", video->fp) < 0 ||
+                        fwrite(encoded, video->frame_bytes, 1, video->fp) != 1;
+    } else if (video->count >= (video->promised ? video->promised : avi_max_frames(video))) {
+        video->failed = TRUE;
+    } else {
+        memcpy(chunk, "00db", 4);
+        put_le32(chunk + 4, video->frame_bytes);
+        video->failed = fwrite(chunk, sizeof(chunk), 1, video->fp) != 1 ||
+                        fwrite(encoded, video->frame_bytes, 1, video->fp) != 1;
+    }
+
+    if (video->failed)
+        return FALSE;
+    video->count++;
+    return TRUE;
+}
+
+static gboolean
+avi_finish(video_writer_t *video)
+{
+    uint8_t entry[16];
+    uint8_t *black;
+    uint64_t i;
+    gboolean ok = TRUE;
+
+    /* a pipe gets exactly the frames its header promised */
+    if (video->promised && video->count < video->promised) {
+        black = g_malloc0(video->frame_bytes);
+        while (ok && video->count < video->promised)
+            ok = video_writer_write(video, black);
+        g_free(black);
+    }
+
+    memcpy(entry, "idx1", 4);
+    put_le32(entry + 4, video->count * 16);
+    ok = ok && fwrite(entry, 8, 1, video->fp) == 1;
+
+    /* every chunk is the same size, so the index is implied by the count */
+    memcpy(entry, "00db", 4);
+    put_le32(entry + 4, AVIIF_KEYFRAME);
+    put_le32(entry + 12, video->frame_bytes);
+    for (i = 0; ok && i < video->count; i++) {
+        put_le32(entry + 8, 4 + (i * (8 + video->frame_bytes)));
+        ok = fwrite(entry, sizeof(entry), 1, video->fp) == 1;
+    }
+
+    if (ok && !video->promised)
+        ok = fseeko(video->fp, 0, SEEK_SET) == 0 && video_write_header(video, video->count);
+
+    return ok;
+}
+
+gboolean video_writer_close(video_writer_t *video)
+{
+    gboolean ok;
+
+    g_return_val_if_fail(video != NULL, FALSE);
+
+    ok = !video->failed;
+    if (ok && video->container == VIDEO_AVI)
+        ok = avi_finish(video);
+
+    if (video->owns_fp)
+        ok = (fclose(video->fp) == 0) && ok;
+    else
+        ok = (fflush(video->fp) == 0) && ok;
+
+    g_free(video);
+    return ok;
+}
@@ -0,0 +1,136 @@
+/*
+ * Export of frames as PGM/PPM images and NumPy arrays
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _EXPORT_H_
+#define _EXPORT_H_
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Bytes per pixel of the frame formats that can be exported as is (MONO8,
+ * RAW8, MONO16, RAW16 and RGB8), or 0 for anything else
+ */
+unsigned int export_bytes_per_pixel(const dc1394video_frame_t *frame);
+
+/**
+ * Writes a MONO8/MONO16 frame as a binary PGM, dropping any row padding.
+ * RAW8/RAW16 frames are written the same way, as the Bayer mosaic. 16 bit
+ * samples are stored big endian as PGM requires, with the maximum value
+ * given by the data depth.
+ */
+gboolean export_frame_pgm(dc1394video_frame_t *frame, const char *filename);
+
+/**
+ * Writes an RGB8 frame as a binary PPM, or a RAW8 or YUV frame after
+ * debayering or converting it into scratch (whose image is reused, and
+ * grown as needed; free it with free()).
+ */
+gboolean export_frame_ppm(dc1394video_frame_t *frame, dc1394video_frame_t *scratch, const char *filename);
+
+/**
+ * A NumPy .npy file of equally shaped items appended one at a time. The
+ * number of items goes in the header when the file is closed, and the data
+ * starts on a 64 byte boundary so the file can be memory mapped with
+ * numpy.load(filename, mmap_mode='r').
+ */
+typedef struct __npy_writer npy_writer_t;
+
+/**
+ * Starts an array of items of the given dtype (e.g. "|u1", "<u8") and
+ * shape (ndim may be 0 for scalars)
+ */
+npy_writer_t *npy_writer_open(const char *filename, const char *dtype, const uint32_t *shape, unsigned int ndim);
+
+/**
+ * Starts an array of frames shaped like format; (height, width) for one
+ * byte per pixel, (height, width, 3) for RGB8. 16 bit samples are stored
+ * in their byte order from the camera.
+ */
+npy_writer_t *npy_writer_open_frames(const char *filename, const dc1394video_frame_t *format);
+
+gboolean npy_writer_append(npy_writer_t *npy, const void *item);
+
+/**
+ * Appends the image of frame, dropping any row padding
+ */
+gboolean npy_writer_append_frame(npy_writer_t *npy, dc1394video_frame_t *frame);
+
+uint64_t npy_writer_get_count(npy_writer_t *npy);
+
+/**
+ * Writes the final header and closes the file. Returns FALSE if any write
+ * failed.
+ */
+gboolean npy_writer_close(npy_writer_t *npy);
+
+typedef enum {
+    VIDEO_Y4M,      /* YUV4MPEG2; gray frames as Cmono, color as C444 */
+    VIDEO_AVI       /* uncompressed DIB; 8 bit gray or 24 bit BGR */
+} video_container_t;
+
+/**
+ * An uncompressed video file, written strictly in order so it can also go
+ * to a pipe. Frames are encoded into the container's layout separately
+ * (by any number of threads) with video_writer_encode(), then appended
+ * with video_writer_write().
+ */
+typedef struct __video_writer video_writer_t;
+
+/**
+ * Opens filename ("-" for stdout) for frames shaped like format; MONO8,
+ * MONO16 (tone mapped to 8 bits, see mono16_get_window()), RGB8, RAW8
+ * (debayered) or YUV (converted to RGB). AVI headers hold the number of
+ * frames, so when writing AVI to a pipe nframes must be given up front,
+ * and the stream is padded with black frames if fewer are written. Files
+ * are patched with the real count on close.
+ */
+video_writer_t *video_writer_open(const char *filename, video_container_t container,
+                const dc1394video_frame_t *format, double fps, uint64_t nframes);
+
+/**
+ * Bytes of encoded frame that video_writer_encode() writes
+ */
+size_t video_writer_get_frame_bytes(video_writer_t *video);
+
+/**
+ * Converts frame into the container's layout in out. scratch holds the
+ * RGB8 image of RAW8 and YUV frames (its image is reused, free it with
+ * free()). Safe to call from several threads at once.
+ */
+gboolean video_writer_encode(video_writer_t *video, dc1394video_frame_t *frame,
+                dc1394video_frame_t *scratch, uint8_t *out);
+
+gboolean video_writer_write(video_writer_t *video, const uint8_t *encoded);
+
+/**
+ * Finishes the stream and closes the file (stdout is only flushed).
+ * Returns FALSE if any write failed.
+ */
+gboolean video_writer_close(video_writer_t *video);
+
+G_END_DECLS
+
+#endif
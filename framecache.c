@@ -0,0 +1,301 @@
+/*
+ * Read-ahead cache of display ready frames for playback
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "framecache.h"
+#include "gtkutils.h"
+#include "latency.h"
+
+#define NO_FRAME        G_MAXUINT64
+#define MIN_ENTRIES     3
+
+static latency_t *read_latency = NULL;
+
+typedef struct __cache_entry
+{
+    uint64_t            n;              /* frame number, NO_FRAME if free */
+    uint64_t            used;           /* cache clock when last returned or decoded */
+    show_mode_t         show;
+    dc1394video_frame_t frame;
+} cache_entry_t;
+
+struct __frame_cache
+{
+    recording_t         *rec;
+    show_mode_t         show;
+    cache_entry_t       *entries;
+    unsigned int        nentries;
+    unsigned int        ahead;          /* frames to decode ahead of position */
+    uint64_t            clock;
+
+    GThread             *thread;
+    GMutex              *lock;
+    GCond               *cond;          /* a frame was requested or decoded */
+    gboolean            quit;
+
+    uint64_t            position;       /* last requested frame */
+    int                 direction;
+    cache_entry_t       *current;       /* last returned, never evicted */
+    uint64_t            wanted;         /* requested but not cached, or NO_FRAME */
+    gboolean            wanted_failed;
+    uint64_t            end;            /* do not read ahead past this frame */
+    uint64_t            failed;         /* last frame that could not be read */
+};
+
+static cache_entry_t *
+cache_lookup(frame_cache_t *cache, uint64_t n)
+{
+    unsigned int i;
+
+    for (i = 0; i < cache->nentries; i++) {
+        if (cache->entries[i].n == n)
+            return &(cache->entries[i]);
+    }
+    return NULL;
+}
+
+static gboolean
+cache_in_window(frame_cache_t *cache, uint64_t n)
+{
+    if (cache->direction > 0)
+        return n > cache->position && n - cache->position <= cache->ahead;
+    return n < cache->position && cache->position - n <= cache->ahead;
+}
+
+/* The next frame the thread should decode, or NO_FRAME if there is
+ * nothing to do */
+static uint64_t
+cache_next_frame(frame_cache_t *cache)
+{
+    unsigned int i;
+    uint64_t n;
+
+    if (cache->wanted != NO_FRAME)
+        return cache->wanted;
+
+    for (i = 1; i <= cache->ahead; i++) {
+        if (cache->direction > 0) {
+            n = cache->position + i;
+            if (n >= cache->end)
+                break;
+        } else {
+            if (cache->position < i)
+                break;
+            n = cache->position - i;
+        }
+        if (n == cache->failed)
+            break;
+        if (!cache_lookup(cache, n))
+            return n;
+    }
+    return NO_FRAME;
+}
+
+/* Frees the least recently used entry that is neither being displayed nor
+ * part of the read ahead window */
+static cache_entry_t *
+cache_evict(frame_cache_t *cache)
+{
+    cache_entry_t *entry, *lru = NULL;
+    unsigned int i;
+
+    for (i = 0; i < cache->nentries; i++) {
+        entry = &(cache->entries[i]);
+        if (entry->n == NO_FRAME) {
+            lru = entry;
+            break;
+        }
+        if (entry == cache->current || cache_in_window(cache, entry->n))
+            continue;
+        if (lru == NULL || entry->used < lru->used)
+            lru = entry;
+    }
+
+    if (lru)
+        lru->n = NO_FRAME;
+    return lru;
+}
+
+static gpointer
+cache_thread(gpointer data)
+{
+    frame_cache_t *cache = (frame_cache_t *)data;
+    dc1394video_frame_t view = { 0 };
+    cache_entry_t *entry;
+    uint64_t n, t;
+    gboolean ok;
+
+    g_mutex_lock(cache->lock);
+    while (!cache->quit) {
+        n = cache_next_frame(cache);
+        entry = n != NO_FRAME ? cache_evict(cache) : NULL;
+        if (entry == NULL) {
+            g_cond_wait(cache->cond, cache->lock);
+            continue;
+        }
+        g_mutex_unlock(cache->lock);
+
+        /* the entry is out of the table, so it can be filled unlocked */
+        t = latency_now();
+        ok = recording_seek_frame(cache->rec, n) &&
+             recording_read_frame_view(cache->rec, &view) > 0;
+        latency_record_since(read_latency, t);
+        if (ok)
+            ok = render_frame_to_display(&view, &(entry->frame), cache->show, &(entry->show)) == DC1394_SUCCESS;
+
+        g_mutex_lock(cache->lock);
+        if (ok) {
+            entry->n = n;
+            entry->used = ++cache->clock;
+        } else {
+            cache->failed = n;
+            if (n > cache->position && n < cache->end)
+                cache->end = n;
+        }
+        if (n == cache->wanted) {
+            cache->wanted = NO_FRAME;
+            cache->wanted_failed = !ok;
+        }
+        g_cond_broadcast(cache->cond);
+    }
+    g_mutex_unlock(cache->lock);
+
+    return NULL;
+}
+
+frame_cache_t *frame_cache_new(recording_t *rec, show_mode_t show, uint64_t max_bytes)
+{
+    frame_cache_t *cache;
+    const dc1394video_frame_t *format;
+    uint64_t entry_bytes;
+    unsigned int i;
+
+    g_return_val_if_fail(rec != NULL, NULL);
+
+    if (!read_latency)
+        read_latency = latency_get("cache.read");
+
+    /* every entry can hold an RGB8 frame */
+    format = recording_get_format(rec);
+    entry_bytes = (uint64_t)format->size[0] * format->size[1] * 3;
+    g_return_val_if_fail(entry_bytes > 0, NULL);
+
+    cache = g_new0(frame_cache_t, 1);
+    cache->rec = rec;
+    cache->show = show;
+    cache->nentries = MAX(MIN_ENTRIES, MIN(max_bytes / entry_bytes, G_MAXUINT));
+    cache->ahead = MAX(1, cache->nentries / 2);
+    cache->entries = g_new0(cache_entry_t, cache->nentries);
+    for (i = 0; i < cache->nentries; i++) {
+        cache->entries[i].n = NO_FRAME;
+        cache->entries[i].frame.image = (unsigned char *)malloc(entry_bytes);
+        cache->entries[i].frame.allocated_image_bytes = entry_bytes;
+        if (cache->entries[i].frame.image == NULL) {
+            cache->nentries = i;
+            frame_cache_free(cache);
+            return NULL;
+        }
+    }
+
+    cache->direction = 1;
+    cache->wanted = NO_FRAME;
+    cache->failed = NO_FRAME;
+    cache->end = recording_get_n_frames(rec);
+    if (cache->end == 0)
+        cache->end = NO_FRAME;
+
+    cache->lock = g_mutex_new();
+    cache->cond = g_cond_new();
+    cache->thread = g_thread_create(cache_thread, cache, TRUE, NULL);
+    if (cache->thread == NULL) {
+        frame_cache_free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void frame_cache_free(frame_cache_t *cache)
+{
+    unsigned int i;
+
+    if (cache == NULL)
+        return;
+
+    if (cache->thread) {
+        g_mutex_lock(cache->lock);
+        cache->quit = TRUE;
+        g_cond_broadcast(cache->cond);
+        g_mutex_unlock(cache->lock);
+        g_thread_join(cache->thread);
+    }
+    if (cache->lock)
+        g_mutex_free(cache->lock);
+    if (cache->cond)
+        g_cond_free(cache->cond);
+
+    for (i = 0; i < cache->nentries; i++)
+        free(cache->entries[i].frame.image);
+    g_free(cache->entries);
+    g_free(cache);
+}
+
+const dc1394video_frame_t *frame_cache_get(frame_cache_t *cache, uint64_t n, int direction, show_mode_t *show)
+{
+    cache_entry_t *entry;
+
+    g_return_val_if_fail(cache != NULL, NULL);
+
+    g_mutex_lock(cache->lock);
+
+    cache->position = n;
+    cache->direction = direction < 0 ? -1 : 1;
+
+    entry = cache_lookup(cache, n);
+    if (entry == NULL) {
+        cache->wanted = n;
+        cache->wanted_failed = FALSE;
+        g_cond_broadcast(cache->cond);
+        while ((entry = cache_lookup(cache, n)) == NULL && !cache->wanted_failed)
+            g_cond_wait(cache->cond, cache->lock);
+    }
+
+    if (entry) {
+        entry->used = ++cache->clock;
+        cache->current = entry;
+        if (show)
+            *show = entry->show;
+    }
+
+    /* read ahead from the new position */
+    g_cond_broadcast(cache->cond);
+    g_mutex_unlock(cache->lock);
+
+    return entry ? &(entry->frame) : NULL;
+}
+
+unsigned int frame_cache_get_capacity(frame_cache_t *cache)
+{
+    g_return_val_if_fail(cache != NULL, 0);
+    return cache->nentries;
+}
@@ -0,0 +1,68 @@
+/*
+ * Read-ahead cache of display ready frames for playback
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _FRAME_CACHE_H_
+#define _FRAME_CACHE_H_
+
+#include <inttypes.h>
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+#include "utils.h"
+
+G_BEGIN_DECLS
+
+/**
+ * A bounded cache of frames already converted for display (see
+ * render_frame_to_display()), filled by a background thread that decodes
+ * ahead of the last requested frame in the direction of playback. Up to
+ * half of the cache is kept for the frames behind, so scrubbing back and
+ * forth does not re-read or re-debayer them. The least recently used frame
+ * is evicted first.
+ *
+ * Once the cache is created the recording is only read by its thread.
+ */
+typedef struct __frame_cache frame_cache_t;
+
+/**
+ * Starts the decode thread, with room for max_bytes of display frames (at
+ * least three)
+ */
+frame_cache_t *frame_cache_new(recording_t *rec, show_mode_t show, uint64_t max_bytes);
+
+void frame_cache_free(frame_cache_t *cache);
+
+/**
+ * Returns display frame n, waiting for it to be decoded if it is not
+ * cached, or NULL if it cannot be read. Decoding then continues ahead in
+ * direction (1 forwards, -1 backwards). The frame stays valid until the
+ * next call; render it with render_frame_to_widget(frame, widget, *show).
+ */
+const dc1394video_frame_t *frame_cache_get(frame_cache_t *cache, uint64_t n, int direction, show_mode_t *show);
+
+/**
+ * Number of frames the cache can hold
+ */
+unsigned int frame_cache_get_capacity(frame_cache_t *cache);
+
+G_END_DECLS
+
+#endif
@@ -20,8 +20,199 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "gtkutils.h"
+#include "latency.h"
+#include "convert.h"
+#include "demosaic.h"
+#include "mono16.h"
+
+/* idle buffers kept by the default pool; enough for a few export threads */
+#define DEFAULT_POOL_IDLE   16
+
+/* precedes every pooled buffer, padded to keep the image aligned */
+typedef union __pool_buffer
+{
+    struct {
+        frame_pool_t            *pool;
+        size_t                  nbytes;
+        union __pool_buffer     *next;
+    } hdr;
+    long double                 align;
+    unsigned char               pad[32];
+} pool_buffer_t;
+
+struct __frame_pool
+{
+    GMutex              *lock;
+    guint               max_idle;
+    guint               nidle;
+    guint               refs;           /* the owner's plus one per buffer out */
+    size_t              nbytes;         /* size of the idle buffers */
+    pool_buffer_t       *idle;
+};
+
+static latency_t *debayer_latency = NULL;
+static latency_t *draw_latency = NULL;
+
+G_LOCK_DEFINE_STATIC(default_pool);
+static frame_pool_t *default_pool = NULL;
+
+frame_pool_t *frame_pool_new(guint max_idle)
+{
+    frame_pool_t *pool;
+
+    pool = g_new0(frame_pool_t, 1);
+    pool->lock = g_mutex_new();
+    pool->max_idle = max_idle;
+    pool->refs = 1;
+    return pool;
+}
+
+frame_pool_t *frame_pool_get_default(void)
+{
+    G_LOCK(default_pool);
+    if (default_pool == NULL)
+        default_pool = frame_pool_new(DEFAULT_POOL_IDLE);
+    G_UNLOCK(default_pool);
+    return default_pool;
+}
+
+static void
+pool_drop_idle(frame_pool_t *pool)
+{
+    pool_buffer_t *b;
+
+    while ((b = pool->idle)) {
+        pool->idle = b->hdr.next;
+        free(b);
+    }
+    pool->nidle = 0;
+}
+
+/* called with the lock held, which it releases */
+static void
+pool_unref_unlock(frame_pool_t *pool)
+{
+    if (--pool->refs) {
+        g_mutex_unlock(pool->lock);
+        return;
+    }
+
+    pool_drop_idle(pool);
+    g_mutex_unlock(pool->lock);
+    g_mutex_free(pool->lock);
+    g_free(pool);
+}
+
+void frame_pool_unref(frame_pool_t *pool)
+{
+    g_return_if_fail(pool != NULL);
+
+    g_mutex_lock(pool->lock);
+    pool_unref_unlock(pool);
+}
+
+unsigned char *frame_pool_alloc(frame_pool_t *pool, size_t nbytes)
+{
+    pool_buffer_t *b;
+
+    g_return_val_if_fail(pool != NULL, NULL);
+
+    g_mutex_lock(pool->lock);
+    if (nbytes != pool->nbytes) {
+        pool_drop_idle(pool);
+        pool->nbytes = nbytes;
+    }
+
+    b = pool->idle;
+    if (b) {
+        pool->idle = b->hdr.next;
+        pool->nidle--;
+    } else {
+        b = (pool_buffer_t *)malloc(sizeof(pool_buffer_t) + nbytes);
+        if (b == NULL) {
+            g_mutex_unlock(pool->lock);
+            return NULL;
+        }
+        b->hdr.pool = pool;
+        b->hdr.nbytes = nbytes;
+    }
+    pool->refs++;
+    g_mutex_unlock(pool->lock);
+
+    return (unsigned char *)(b + 1);
+}
+
+void frame_pool_release(unsigned char *buf)
+{
+    pool_buffer_t *b;
+    frame_pool_t *pool;
+
+    if (buf == NULL)
+        return;
+
+    b = ((pool_buffer_t *)buf) - 1;
+    pool = b->hdr.pool;
+
+    /* buffers of an old geometry, or beyond max_idle, are not kept */
+    g_mutex_lock(pool->lock);
+    if (b->hdr.nbytes == pool->nbytes && pool->nidle < pool->max_idle && pool->refs > 1) {
+        b->hdr.next = pool->idle;
+        pool->idle = b;
+        pool->nidle++;
+    } else {
+        free(b);
+    }
+    pool_unref_unlock(pool);
+}
+
+static void
+pixbuf_release(guchar *pixels, gpointer data)
+{
+    frame_pool_release(pixels);
+}
+
+GdkPixbuf *frame_pool_new_pixbuf(unsigned char *buf, int width, int height)
+{
+    g_return_val_if_fail(buf != NULL, NULL);
+
+    return gdk_pixbuf_new_from_data(
+                buf,
+                GDK_COLORSPACE_RGB,
+                FALSE,              /* has alpha */
+                8,                  /* bpp */
+                width,
+                height,
+                width * 3,          /* rowstride */
+                pixbuf_release,
+                NULL);
+}
+
+/* Tone maps a 16 bit gray frame into dest as 8 bit gray rows, then
+ * expands them in place, from the end, to RGB8 */
+static dc1394error_t
+gray16_to_rgb8(const dc1394video_frame_t *frame, dc1394video_frame_t *dest)
+{
+    dc1394error_t err;
+    size_t i, n;
+
+    n = (size_t)frame->size[0] * frame->size[1];
+    err = mono16_frame_to_gray8(frame, dest->image, frame->size[0]);
+    if (err != DC1394_SUCCESS)
+        return err;
+
+    for (i = n; i-- > 0; )
+        dest->image[(3 * i) + 2] = dest->image[(3 * i) + 1] = dest->image[3 * i] = dest->image[i];
+
+    dest->size[0] = frame->size[0];
+    dest->size[1] = frame->size[1];
+    dest->color_coding = DC1394_COLOR_CODING_RGB8;
+    dest->stride = frame->size[0] * 3;
+    dest->image_bytes = dest->total_bytes = n * 3;
+    return DC1394_SUCCESS;
+}
 
 dc1394error_t 
 render_frame_to_widget(dc1394video_frame_t *frame, GtkWidget *widget, show_mode_t show)
@@ -30,9 +221,16 @@ render_frame_to_widget(dc1394video_frame_t *frame, GtkWidget *widget, show_mode_
         //debayer raw data into rgb
         dc1394error_t err;
         dc1394video_frame_t dest;
+        uint64_t t;
+
+        if (!draw_latency) {
+            debayer_latency = latency_get("gtk.debayer");
+            draw_latency = latency_get("gtk.draw");
+        }
 
         switch (show) {
             case GRAY:
+                t = latency_now();
                 gdk_draw_gray_image(
                         widget->window,
                         widget->style->fg_gc[GTK_STATE_NORMAL],
@@ -41,14 +239,63 @@ render_frame_to_widget(dc1394video_frame_t *frame, GtkWidget *widget, show_mode_
                         GDK_RGB_DITHER_NONE, 
                         frame->image, 
                         frame->stride);
+                latency_record_since(draw_latency, t);
+                break;
+            case GRAY16:
+                dest.image = frame_pool_alloc(frame_pool_get_default(), frame->size[0]*frame->size[1]);
+                if (dest.image == NULL)
+                    return DC1394_MEMORY_ALLOCATION_FAILURE;
+
+                t = latency_now();
+                err=mono16_frame_to_gray8(frame, dest.image, frame->size[0]);
+                if (err != DC1394_SUCCESS)
+                    frame_pool_release(dest.image);
+                DC1394_ERR_RTN(err,"Could not convert frames");
+                latency_record_since(debayer_latency, t);
+
+                t = latency_now();
+                gdk_draw_gray_image(
+                        widget->window,
+                        widget->style->fg_gc[GTK_STATE_NORMAL],
+                        0, 0, 
+                        frame->size[0], frame->size[1], 
+                        GDK_RGB_DITHER_NONE, 
+                        dest.image, 
+                        frame->size[0]);
+                latency_record_since(draw_latency, t);
+
+                frame_pool_release(dest.image);
                 break;
             case COLOR:
-                dest.image = (unsigned char *)malloc(frame->size[0]*frame->size[1]*3*sizeof(unsigned char));
+                if (frame->color_coding == DC1394_COLOR_CODING_RGB8) {
+                    /* already display ready, e.g. from render_frame_to_display() */
+                    t = latency_now();
+                    gdk_draw_rgb_image(
+                            widget->window,
+                            widget->style->fg_gc[GTK_STATE_NORMAL],
+                            0, 0, 
+                            frame->size[0], frame->size[1], 
+                            GDK_RGB_DITHER_NONE, 
+                            frame->image, 
+                            frame->stride ? frame->stride : frame->size[0] * 3);
+                    latency_record_since(draw_latency, t);
+                    break;
+                }
+
+                dest.image = frame_pool_alloc(frame_pool_get_default(), frame->size[0]*frame->size[1]*3);
+                dest.allocated_image_bytes = frame->size[0]*frame->size[1]*3;
                 dest.color_coding = DC1394_COLOR_CODING_RGB8;
+                if (dest.image == NULL)
+                    return DC1394_MEMORY_ALLOCATION_FAILURE;
 
-                err=dc1394_convert_frames(frame, &dest); 
+                t = latency_now();
+                err=convert_to_rgb8(frame, &dest); 
+                if (err != DC1394_SUCCESS)
+                    frame_pool_release(dest.image);
                 DC1394_ERR_RTN(err,"Could not convert frames");
+                latency_record_since(debayer_latency, t);
 
+                t = latency_now();
                 gdk_draw_rgb_image(
                         widget->window,
                         widget->style->fg_gc[GTK_STATE_NORMAL],
@@ -57,16 +304,25 @@ render_frame_to_widget(dc1394video_frame_t *frame, GtkWidget *widget, show_mode_
                         GDK_RGB_DITHER_NONE, 
                         dest.image, 
                         frame->size[0] * 3);
+                latency_record_since(draw_latency, t);
 
-                free(dest.image);
+                frame_pool_release(dest.image);
                 break;
 
             case FORMAT7:
-                dest.image = (unsigned char *)malloc(frame->size[0]*frame->size[1]*3*sizeof(unsigned char));
+                dest.image = frame_pool_alloc(frame_pool_get_default(), frame->size[0]*frame->size[1]*3);
+                dest.allocated_image_bytes = frame->size[0]*frame->size[1]*3;
+                if (dest.image == NULL)
+                    return DC1394_MEMORY_ALLOCATION_FAILURE;
 
-                err=dc1394_debayer_frames(frame, &dest, DC1394_BAYER_METHOD_NEAREST); 
+                t = latency_now();
+                err=convert_debayer(frame, &dest, demosaic_get_method()); 
+                if (err != DC1394_SUCCESS)
+                    frame_pool_release(dest.image);
                 DC1394_ERR_RTN(err,"Could not debayer frames");
+                latency_record_since(debayer_latency, t);
 
+                t = latency_now();
                 gdk_draw_rgb_image(
                         widget->window,
                         widget->style->fg_gc[GTK_STATE_NORMAL],
@@ -75,46 +331,114 @@ render_frame_to_widget(dc1394video_frame_t *frame, GtkWidget *widget, show_mode_
                         GDK_RGB_DITHER_NONE, 
                         dest.image, 
                         frame->size[0] * 3);
+                latency_record_since(draw_latency, t);
 
-                free(dest.image);
+                frame_pool_release(dest.image);
                 break;
         }
     }
     return DC1394_SUCCESS;
 }
 
+dc1394error_t
+render_frame_to_display(dc1394video_frame_t *frame, dc1394video_frame_t *dest, show_mode_t show, show_mode_t *dest_show)
+{
+    dc1394error_t err;
+    uint64_t t;
+    uint32_t y, stride;
+
+    g_return_val_if_fail(frame != NULL && frame->image != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+    g_return_val_if_fail(dest != NULL && dest->image != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+    g_return_val_if_fail(dest->allocated_image_bytes >= frame->size[0]*frame->size[1]*3, DC1394_INVALID_ARGUMENT_VALUE);
+
+    if (!debayer_latency)
+        debayer_latency = latency_get("gtk.debayer");
+
+    t = latency_now();
+    switch (show) {
+        case GRAY:
+            /* drawn as is, just drop any row padding */
+            stride = frame->stride ? frame->stride : frame->size[0];
+            for (y = 0; y < frame->size[1]; y++)
+                memcpy(dest->image + (y * frame->size[0]), frame->image + (y * stride), frame->size[0]);
+            dest->size[0] = frame->size[0];
+            dest->size[1] = frame->size[1];
+            dest->color_coding = DC1394_COLOR_CODING_MONO8;
+            dest->stride = frame->size[0];
+            dest->image_bytes = dest->total_bytes = frame->size[0] * frame->size[1];
+            *dest_show = GRAY;
+            break;
+        case GRAY16:
+            /* tone mapped through the window, then drawn as GRAY */
+            err=mono16_frame_to_gray8(frame, dest->image, frame->size[0]);
+            DC1394_ERR_RTN(err,"Could not convert frames");
+            dest->size[0] = frame->size[0];
+            dest->size[1] = frame->size[1];
+            dest->color_coding = DC1394_COLOR_CODING_MONO8;
+            dest->stride = frame->size[0];
+            dest->image_bytes = dest->total_bytes = frame->size[0] * frame->size[1];
+            *dest_show = GRAY;
+            break;
+        case COLOR:
+            dest->color_coding = DC1394_COLOR_CODING_RGB8;
+            err=convert_to_rgb8(frame, dest); 
+            DC1394_ERR_RTN(err,"Could not convert frames");
+            *dest_show = COLOR;
+            break;
+        case FORMAT7:
+            dest->color_coding = DC1394_COLOR_CODING_RGB8;
+            err=convert_debayer(frame, dest, demosaic_get_method()); 
+            DC1394_ERR_RTN(err,"Could not debayer frames");
+            *dest_show = COLOR;
+            break;
+    }
+    latency_record_since(debayer_latency, t);
+
+    dest->timestamp = frame->timestamp;
+    dest->id = frame->id;
+    return DC1394_SUCCESS;
+}
+
 dc1394error_t
 render_frame_to_pixbuf(dc1394video_frame_t *frame, GdkPixbuf **pbdest, show_mode_t show)
 {
     if (frame && frame->image && pbdest) {
         dc1394error_t err;
         dc1394video_frame_t dest;
+        uint64_t t;
 
-        dest.image = (unsigned char *)malloc(frame->size[0]*frame->size[1]*3*sizeof(unsigned char));
+        if (!debayer_latency)
+            debayer_latency = latency_get("gtk.debayer");
+
+        dest.image = frame_pool_alloc(frame_pool_get_default(), frame->size[0]*frame->size[1]*3);
+        dest.allocated_image_bytes = frame->size[0]*frame->size[1]*3;
         dest.color_coding = DC1394_COLOR_CODING_RGB8;
+        if (dest.image == NULL)
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
 
+        t = latency_now();
         switch (show) {
             case GRAY:
             case COLOR:
-                err=dc1394_convert_frames(frame, &dest); 
-                DC1394_ERR_RTN(err,"Could not convert frames");
+                err=convert_to_rgb8(frame, &dest); 
+                break;
+            case GRAY16:
+                err=gray16_to_rgb8(frame, &dest);
                 break;
             case FORMAT7:
-                err=dc1394_debayer_frames(frame, &dest, DC1394_BAYER_METHOD_NEAREST); 
-                DC1394_ERR_RTN(err,"Could not debayer frames");
+                err=convert_debayer(frame, &dest, demosaic_get_method()); 
+                break;
+            default:
+                err=DC1394_INVALID_ARGUMENT_VALUE;
                 break;
         }
+        if (err != DC1394_SUCCESS)
+            frame_pool_release(dest.image);
+        DC1394_ERR_RTN(err,"Could not convert frames");
+        latency_record_since(debayer_latency, t);
 
-        *pbdest = gdk_pixbuf_new_from_data(
-                    dest.image,
-                    GDK_COLORSPACE_RGB,
-                    FALSE,              /* has alpha */
-                    8,                  /* bpp */
-                    dest.size[0],       /* width */
-                    dest.size[1],       /* height */
-                    dest.size[0] * 3,   /* rowstride */
-                    NULL,
-                    NULL);
+        /* the pixbuf gives the buffer back to the pool when finalized */
+        *pbdest = frame_pool_new_pixbuf(dest.image, dest.size[0], dest.size[1]);
     }
     return DC1394_SUCCESS;
 }
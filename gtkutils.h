@@ -29,9 +29,62 @@
 
 G_BEGIN_DECLS
 
+/**
+ * Recycles the image buffers that frames are converted into, so drawing or
+ * exporting a stream of frames of the same geometry allocates nothing once
+ * warmed up. A pool keeps buffers of one size; asking for another size
+ * (the geometry changed) drops the idle ones. Safe to use from several
+ * threads.
+ */
+typedef struct __frame_pool frame_pool_t;
+
+/**
+ * Creates a pool that keeps up to max_idle returned buffers for reuse
+ */
+frame_pool_t *frame_pool_new(guint max_idle);
+
+/**
+ * The pool used by the render_frame_to_* functions; never freed
+ */
+frame_pool_t *frame_pool_get_default(void);
+
+/**
+ * Releases the caller's reference. The pool is freed once every buffer it
+ * handed out has also been released.
+ */
+void frame_pool_unref(frame_pool_t *pool);
+
+/**
+ * Returns a buffer of at least nbytes, reused if one is idle
+ */
+unsigned char *frame_pool_alloc(frame_pool_t *pool, size_t nbytes);
+
+/**
+ * Returns buf, from frame_pool_alloc(), to the pool it came from
+ */
+void frame_pool_release(unsigned char *buf);
+
+/**
+ * Wraps an RGB8 buffer from frame_pool_alloc() in a pixbuf that releases it
+ * back to its pool when the pixbuf is finalized
+ */
+GdkPixbuf *frame_pool_new_pixbuf(unsigned char *buf, int width, int height);
+
 dc1394error_t
 render_frame_to_widget(dc1394video_frame_t *frame, GtkWidget *widget, show_mode_t show);
 
+/**
+ * Converts frame into dest, whose image must already hold at least
+ * size[0]*size[1]*3 bytes, so that render_frame_to_widget(dest, widget,
+ * *dest_show) only has to draw it. Gray frames stay gray, everything else
+ * is converted or debayered to RGB8.
+ */
+dc1394error_t
+render_frame_to_display(dc1394video_frame_t *frame, dc1394video_frame_t *dest, show_mode_t show, show_mode_t *dest_show);
+
+/**
+ * Converts frame to RGB8 in a pooled pixbuf (free with g_object_unref())
+ */
 dc1394error_t
 render_frame_to_pixbuf(dc1394video_frame_t *frame, GdkPixbuf **pbdest, show_mode_t show);
 
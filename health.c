@@ -0,0 +1,221 @@
+/*
+ * Capture health accounting; dropped frames, backlog and jitter
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "health.h"
+
+/* jitter histogram, 10us resolution up to 100ms */
+#define JITTER_BIN_US   10
+#define JITTER_BINS     10000
+
+typedef struct __health_stats
+{
+    uint64_t    frames;
+    uint64_t    dropped;
+    uint64_t    errors;
+    uint64_t    lost;
+    uint32_t    max_behind;
+    uint64_t    first_timestamp;
+    uint64_t    last_timestamp;
+    uint64_t    jitter_max;
+    uint64_t    njitter;
+    uint32_t    jitter[JITTER_BINS];
+} health_stats_t;
+
+struct __capture_health
+{
+    double          interval_us;
+    uint64_t        last_timestamp;
+    health_stats_t  run;
+    health_stats_t  window;
+};
+
+capture_health_t *capture_health_new(double framerate)
+{
+    capture_health_t *health;
+
+    g_return_val_if_fail(framerate > 0, NULL);
+
+    health = g_new0(capture_health_t, 1);
+    health->interval_us = 1e6 / framerate;
+    return health;
+}
+
+void capture_health_free(capture_health_t *health)
+{
+    g_free(health);
+}
+
+static void
+stats_add_frame(health_stats_t *stats, const dc1394video_frame_t *frame, gboolean stored,
+                uint64_t dropped, int64_t jitter)
+{
+    if (stats->frames == 0)
+        stats->first_timestamp = frame->timestamp;
+    stats->last_timestamp = frame->timestamp;
+    stats->frames++;
+    stats->dropped += dropped;
+    if (!stored)
+        stats->lost++;
+    stats->max_behind = MAX(stats->max_behind, frame->frames_behind);
+
+    if (jitter >= 0) {
+        stats->jitter[MIN(jitter / JITTER_BIN_US, JITTER_BINS - 1)]++;
+        stats->jitter_max = MAX(stats->jitter_max, (uint64_t)jitter);
+        stats->njitter++;
+    }
+}
+
+void capture_health_add_frame(capture_health_t *health, const dc1394video_frame_t *frame, gboolean stored)
+{
+    uint64_t dropped = 0;
+    int64_t jitter = -1;
+    double gap, n;
+
+    g_return_if_fail(health != NULL);
+    g_return_if_fail(frame != NULL);
+
+    /* a gap of n frame intervals means n-1 frames never arrived. Jitter is
+     * the distance from the nearest whole number of intervals, so dropped
+     * frames are not also counted as jitter */
+    if (health->last_timestamp && frame->timestamp > health->last_timestamp) {
+        gap = (double)(frame->timestamp - health->last_timestamp);
+        n = MAX(1.0, floor(gap / health->interval_us + 0.5));
+        dropped = (uint64_t)n - 1;
+        jitter = (int64_t)fabs(gap - (n * health->interval_us));
+    }
+    health->last_timestamp = frame->timestamp;
+
+    stats_add_frame(&(health->run), frame, stored, dropped, jitter);
+    stats_add_frame(&(health->window), frame, stored, dropped, jitter);
+}
+
+void capture_health_add_error(capture_health_t *health)
+{
+    g_return_if_fail(health != NULL);
+
+    health->run.errors++;
+    health->window.errors++;
+}
+
+static uint64_t
+stats_jitter_percentile(health_stats_t *stats, double p)
+{
+    uint64_t target, seen;
+    int i;
+
+    if (stats->njitter == 0)
+        return 0;
+
+    target = (uint64_t)ceil(p * stats->njitter);
+    seen = 0;
+    for (i = 0; i < JITTER_BINS; i++) {
+        seen += stats->jitter[i];
+        if (seen >= target)
+            return MIN((uint64_t)(i + 1) * JITTER_BIN_US, stats->jitter_max);
+    }
+    return stats->jitter_max;
+}
+
+static void
+stats_foreach(capture_health_t *health, health_stats_t *stats,
+              void (*func)(const char *key, const char *value, gpointer data), gpointer data)
+{
+    char value[32];
+    double seconds, expected;
+
+    seconds = (stats->last_timestamp - stats->first_timestamp) / 1e6;
+    expected = stats->frames + stats->dropped;
+
+#define EMIT(_key, _fmt, _value)                            \
+    do {                                                    \
+        g_snprintf(value, sizeof(value), _fmt, _value);     \
+        func(_key, value, data);                            \
+    } while (0)
+
+    EMIT("frames",              "%" PRIu64, stats->frames);
+    EMIT("dropped",             "%" PRIu64, stats->dropped);
+    EMIT("dropped_pct",         "%.3f", expected > 0 ? 100.0 * stats->dropped / expected : 0.0);
+    EMIT("lost",                "%" PRIu64, stats->lost);
+    EMIT("dequeue_errors",      "%" PRIu64, stats->errors);
+    EMIT("max_frames_behind",   "%u", stats->max_behind);
+    EMIT("seconds",             "%.3f", seconds);
+    EMIT("fps",                 "%.3f", seconds > 0 ? (stats->frames - 1) / seconds : 0.0);
+    EMIT("interval_us",         "%.1f", health->interval_us);
+    EMIT("jitter_p50_us",       "%" PRIu64, stats_jitter_percentile(stats, 0.50));
+    EMIT("jitter_p90_us",       "%" PRIu64, stats_jitter_percentile(stats, 0.90));
+    EMIT("jitter_p99_us",       "%" PRIu64, stats_jitter_percentile(stats, 0.99));
+    EMIT("jitter_p999_us",      "%" PRIu64, stats_jitter_percentile(stats, 0.999));
+    EMIT("jitter_max_us",       "%" PRIu64, stats->jitter_max);
+
+#undef EMIT
+}
+
+static void
+append_pair(const char *key, const char *value, gpointer data)
+{
+    GString *str = (GString *)data;
+
+    if (str->len)
+        g_string_append_c(str, ' ');
+    g_string_append_printf(str, "%s=%s", key, value);
+}
+
+static void
+store_pair(const char *key, const char *value, gpointer data)
+{
+    gchar *name = g_strdup_printf("capture.%s", key);
+    recording_set_metadata((recording_t *)data, name, value);
+    g_free(name);
+}
+
+gchar *capture_health_summary(capture_health_t *health)
+{
+    GString *str;
+
+    g_return_val_if_fail(health != NULL, NULL);
+
+    str = g_string_new(NULL);
+    stats_foreach(health, &(health->run), append_pair, str);
+    return g_string_free(str, FALSE);
+}
+
+gchar *capture_health_window(capture_health_t *health)
+{
+    GString *str;
+
+    g_return_val_if_fail(health != NULL, NULL);
+
+    str = g_string_new(NULL);
+    stats_foreach(health, &(health->window), append_pair, str);
+    memset(&(health->window), 0, sizeof(health->window));
+    return g_string_free(str, FALSE);
+}
+
+void capture_health_store(capture_health_t *health, recording_t *rec)
+{
+    g_return_if_fail(health != NULL);
+    g_return_if_fail(rec != NULL);
+
+    stats_foreach(health, &(health->run), store_pair, rec);
+}
@@ -0,0 +1,75 @@
+/*
+ * Capture health accounting; dropped frames, backlog and jitter
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _HEALTH_H_
+#define _HEALTH_H_
+
+#include <inttypes.h>
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+#include "utils.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Statistics about a capture, kept both for the whole run and for a rolling
+ * window that restarts every time it is reported. Frames the camera never
+ * delivered are inferred from gaps in the frame timestamps, measured in
+ * multiples of the configured frame interval.
+ */
+typedef struct __capture_health capture_health_t;
+
+capture_health_t *capture_health_new(double framerate);
+
+void capture_health_free(capture_health_t *health);
+
+/**
+ * Accounts a successfully dequeued frame. stored is FALSE if the frame was
+ * captured but then lost, e.g. because the frame ring was full.
+ */
+void capture_health_add_frame(capture_health_t *health, const dc1394video_frame_t *frame, gboolean stored);
+
+/**
+ * Accounts a failed dc1394_capture_dequeue()
+ */
+void capture_health_add_error(capture_health_t *health);
+
+/**
+ * Returns the statistics for the whole run as one line of space separated
+ * key=value pairs (free with g_free)
+ */
+gchar *capture_health_summary(capture_health_t *health);
+
+/**
+ * As capture_health_summary() but for the frames since the previous call,
+ * then starts a new window
+ */
+gchar *capture_health_window(capture_health_t *health);
+
+/**
+ * Stores the whole run statistics as "capture.<key>" recording metadata
+ */
+void capture_health_store(capture_health_t *health, recording_t *rec);
+
+G_END_DECLS
+
+#endif
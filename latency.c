@@ -0,0 +1,207 @@
+/*
+ * Per stage latency histograms
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "latency.h"
+
+/* values below 2^SUB_BITS get a bucket each, above that every power of two
+ * is split into 2^(SUB_BITS-1) buckets */
+#define SUB_BITS        5
+#define SUB_HALF        (1 << (SUB_BITS - 1))
+#define NBUCKETS        ((64 - SUB_BITS + 2) * SUB_HALF)
+
+struct __latency
+{
+    char            *name;
+    volatile gint   buckets[NBUCKETS];
+    latency_t       *next;
+};
+
+static volatile gint enabled = 0;
+static volatile sig_atomic_t dump_requested = 0;
+
+G_LOCK_DEFINE_STATIC(registry);
+static latency_t *registry = NULL;
+
+static inline int
+msb64(uint64_t v)
+{
+    int n = 0;
+    while (v >>= 1)
+        n++;
+    return n;
+}
+
+static inline int
+value_to_bucket(uint64_t v)
+{
+    int shift;
+
+    if (v < (1 << SUB_BITS))
+        return (int)v;
+
+    shift = msb64(v) - (SUB_BITS - 1);
+    return ((shift + 1) * SUB_HALF) + (int)((v >> shift) & (SUB_HALF - 1));
+}
+
+/* smallest value falling in bucket i */
+static uint64_t
+bucket_to_value(int i)
+{
+    int shift;
+
+    if (i < (1 << SUB_BITS))
+        return i;
+
+    shift = (i / SUB_HALF) - 1;
+    return (uint64_t)(SUB_HALF + (i % SUB_HALF)) << shift;
+}
+
+void latency_set_enabled(gboolean enable)
+{
+    g_atomic_int_set(&enabled, enable ? 1 : 0);
+}
+
+latency_t *latency_get(const char *name)
+{
+    latency_t *l;
+
+    g_return_val_if_fail(name != NULL, NULL);
+
+    G_LOCK(registry);
+    for (l = registry; l; l = l->next) {
+        if (strcmp(l->name, name) == 0)
+            break;
+    }
+    if (l == NULL) {
+        l = g_new0(latency_t, 1);
+        l->name = g_strdup(name);
+        l->next = registry;
+        registry = l;
+    }
+    G_UNLOCK(registry);
+
+    return l;
+}
+
+uint64_t latency_now(void)
+{
+    struct timespec ts;
+
+    if (!g_atomic_int_get(&enabled))
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+void latency_record(latency_t *latency, uint64_t ns)
+{
+    if (latency && g_atomic_int_get(&enabled))
+        g_atomic_int_add(&(latency->buckets[value_to_bucket(ns)]), 1);
+}
+
+void latency_record_since(latency_t *latency, uint64_t start)
+{
+    uint64_t now;
+
+    if (start == 0)
+        return;
+
+    now = latency_now();
+    if (now >= start)
+        latency_record(latency, now - start);
+}
+
+static void
+dump_one(latency_t *l, FILE *fp)
+{
+    static const double pct[] = { 0.50, 0.90, 0.99, 0.999 };
+    static const char *pct_names[] = { "p50", "p90", "p99", "p999" };
+    guint32 counts[NBUCKETS];
+    uint64_t total, seen, target;
+    double sum;
+    int i, j, top;
+
+    /* snapshot, other threads may still be recording */
+    total = 0;
+    sum = 0;
+    top = 0;
+    for (i = 0; i < NBUCKETS; i++) {
+        counts[i] = (guint32)g_atomic_int_get(&(l->buckets[i]));
+        if (counts[i]) {
+            /* bucket midpoint */
+            sum += counts[i] * (bucket_to_value(i) + bucket_to_value(i + 1)) / 2.0;
+            total += counts[i];
+            top = i;
+        }
+    }
+    if (total == 0)
+        return;
+
+    fprintf(fp, "latency: stage=%s count=%" PRIu64 " mean_us=%.1f", l->name, total, sum / total / 1000.0);
+
+    for (j = 0, i = 0, seen = 0; j < G_N_ELEMENTS(pct); j++) {
+        target = (uint64_t)(pct[j] * total);
+        if (target == 0)
+            target = 1;
+        while (i < NBUCKETS && seen + counts[i] < target)
+            seen += counts[i++];
+        fprintf(fp, " %s_us=%.1f", pct_names[j], bucket_to_value(i + 1) / 1000.0);
+    }
+
+    fprintf(fp, " max_us=%.1f\n", bucket_to_value(top + 1) / 1000.0);
+}
+
+void latency_dump(FILE *fp)
+{
+    latency_t *l;
+
+    G_LOCK(registry);
+    for (l = registry; l; l = l->next)
+        dump_one(l, fp);
+    G_UNLOCK(registry);
+    fflush(fp);
+}
+
+static void
+dump_signal_handler(int signum)
+{
+    dump_requested = 1;
+}
+
+void latency_dump_on_signal(int signum)
+{
+    signal(signum, dump_signal_handler);
+}
+
+gboolean latency_dump_if_requested(FILE *fp)
+{
+    if (!dump_requested)
+        return FALSE;
+
+    dump_requested = 0;
+    latency_dump(fp);
+    return TRUE;
+}
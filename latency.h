@@ -0,0 +1,85 @@
+/*
+ * Per stage latency histograms
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * A histogram of how long one stage of a pipeline takes. Buckets are
+ * log-linear (16 per power of two, so values are kept to within about 6%)
+ * from 1ns to many minutes, and are updated with atomic increments so any
+ * number of threads can record into the same histogram without locking.
+ *
+ * Timing is off until latency_set_enabled(TRUE); until then latency_now()
+ * returns 0 and recording costs one branch.
+ */
+typedef struct __latency latency_t;
+
+void latency_set_enabled(gboolean enabled);
+
+/**
+ * Returns the histogram called name, creating it on first use. The result
+ * lives until the program exits, so callers can keep it in a static.
+ */
+latency_t *latency_get(const char *name);
+
+/**
+ * Monotonic time in nanoseconds, or 0 if timing is disabled
+ */
+uint64_t latency_now(void);
+
+/**
+ * Records the time since start, a value returned by latency_now()
+ */
+void latency_record_since(latency_t *latency, uint64_t start);
+
+void latency_record(latency_t *latency, uint64_t ns);
+
+/**
+ * Writes one line of key=value pairs (count, mean and percentiles in
+ * microseconds) per histogram that has samples
+ */
+void latency_dump(FILE *fp);
+
+/**
+ * Requests a latency_dump() whenever signum is received. Dumping from the
+ * signal handler itself is not safe, so the program's main loop must call
+ * latency_dump_if_requested().
+ */
+void latency_dump_on_signal(int signum);
+
+gboolean latency_dump_if_requested(FILE *fp);
+
+/**
+ * GOption entry to enable latency timing
+ */
+#define GOPTION_ENTRY_LATENCY(_enabled)                                                              \
+      { "latency", 'L', 0, G_OPTION_ARG_NONE, _enabled, "Time each stage and print latency histograms on exit or SIGUSR1", NULL }
+
+G_END_DECLS
+
+#endif
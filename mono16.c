@@ -0,0 +1,445 @@
+/*
+ * 16 bit sample handling: byte order, window/level to 8 bit and 12 bit
+ * packing, with SIMD kernels chosen at runtime
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mono16.h"
+#include "demosaic.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MONO16_X86 1
+#include <immintrin.h>
+#define TARGET(_isa) __attribute__((target(_isa)))
+#endif
+
+#define HOST_LITTLE_ENDIAN  (G_BYTE_ORDER == G_LITTLE_ENDIAN)
+
+/*
+ * The window is applied in integers so that every kernel gives the same
+ * result: with d = clamp(v - low, 0, high - low), shifted left as far as
+ * 16 bits allow, out = (d * mul) >> 16 where mul rounds up so that high
+ * maps to exactly 255.
+ */
+typedef struct __window
+{
+    uint16_t    low;
+    uint16_t    range;
+    int         shift;
+    uint16_t    mul;
+} window_t;
+
+typedef struct __kernels
+{
+    void (*swap)(const uint8_t *src, uint8_t *dst, size_t n);
+    void (*window)(const uint8_t *src, gboolean swap, uint8_t *dst, size_t n, const window_t *w);
+} kernels_t;
+
+/* set once at startup, before any frames are converted */
+static uint32_t window_low = 0;
+static uint32_t window_high = 0;
+
+static void
+window_init(window_t *w, uint32_t low, uint32_t high)
+{
+    uint32_t top;
+
+    low = MIN(low, 65534);
+    high = CLAMP(high, low + 1, 65535);
+
+    w->low = low;
+    w->range = high - low;
+    for (w->shift = 0; ((uint32_t)w->range << (w->shift + 1)) <= 65535; w->shift++)
+        ;
+    top = (uint32_t)w->range << w->shift;
+    w->mul = ((255u << 16) + top - 1) / top;
+}
+
+static inline uint8_t
+window_sample(uint16_t v, const window_t *w)
+{
+    uint32_t d = v > w->low ? v - w->low : 0;
+
+    d = MIN(d, w->range);
+    return (uint8_t)(((d << w->shift) * w->mul) >> 16);
+}
+
+static inline uint16_t
+load16(const uint8_t *p, gboolean little_endian)
+{
+    return little_endian ? p[0] | (p[1] << 8) : (p[0] << 8) | p[1];
+}
+
+static inline void
+store16(uint8_t *p, uint16_t v, gboolean little_endian)
+{
+    p[little_endian ? 0 : 1] = v & 0xff;
+    p[little_endian ? 1 : 0] = v >> 8;
+}
+
+/*
+ * Scalar kernels
+ */
+static void
+swap_scalar(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    size_t i;
+    uint8_t t;
+
+    for (i = 0; i < n; i++) {
+        t = src[2 * i];
+        dst[2 * i] = src[(2 * i) + 1];
+        dst[(2 * i) + 1] = t;
+    }
+}
+
+static void
+window_scalar(const uint8_t *src, gboolean swap, uint8_t *dst, size_t n, const window_t *w)
+{
+    gboolean le = swap ? !HOST_LITTLE_ENDIAN : HOST_LITTLE_ENDIAN;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = window_sample(load16(src + (2 * i), le), w);
+}
+
+static const kernels_t kernels_scalar = { swap_scalar, window_scalar };
+
+#ifdef MONO16_X86
+
+/*
+ * SSE2 kernels, 16 samples at a time
+ */
+#define LD128(_p)       _mm_loadu_si128((const __m128i *)(_p))
+#define ST128(_p, _v)   _mm_storeu_si128((__m128i *)(_p), _v)
+
+static inline TARGET("sse2") __m128i
+swap_sse2(__m128i v)
+{
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static TARGET("sse2") void
+swap_kernel_sse2(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        ST128(dst + (2 * i), swap_sse2(LD128(src + (2 * i))));
+    swap_scalar(src + (2 * i), dst + (2 * i), n - i);
+}
+
+static inline TARGET("sse2") __m128i
+window8_sse2(__m128i v, __m128i low, __m128i range, __m128i shift, __m128i mul)
+{
+    __m128i d = _mm_subs_epu16(v, low);
+
+    /* min(d, range) without SSE4.1 */
+    d = _mm_sub_epi16(d, _mm_subs_epu16(d, range));
+    return _mm_mulhi_epu16(_mm_sll_epi16(d, shift), mul);
+}
+
+static TARGET("sse2") void
+window_sse2(const uint8_t *src, gboolean swap, uint8_t *dst, size_t n, const window_t *w)
+{
+    const __m128i low = _mm_set1_epi16(w->low);
+    const __m128i range = _mm_set1_epi16(w->range);
+    const __m128i shift = _mm_cvtsi32_si128(w->shift);
+    const __m128i mul = _mm_set1_epi16(w->mul);
+    __m128i a, b;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        a = LD128(src + (2 * i));
+        b = LD128(src + (2 * i) + 16);
+        if (swap) {
+            a = swap_sse2(a);
+            b = swap_sse2(b);
+        }
+        ST128(dst + i, _mm_packus_epi16(window8_sse2(a, low, range, shift, mul),
+                                        window8_sse2(b, low, range, shift, mul)));
+    }
+    window_scalar(src + (2 * i), swap, dst + i, n - i, w);
+}
+
+/*
+ * AVX2 kernels, 32 samples at a time
+ */
+#define LD256(_p)       _mm256_loadu_si256((const __m256i *)(_p))
+#define ST256(_p, _v)   _mm256_storeu_si256((__m256i *)(_p), _v)
+
+static inline TARGET("avx2") __m256i
+swap_avx2(__m256i v)
+{
+    const __m256i order = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                           1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    return _mm256_shuffle_epi8(v, order);
+}
+
+static TARGET("avx2") void
+swap_kernel_avx2(const uint8_t *src, uint8_t *dst, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+        ST256(dst + (2 * i), swap_avx2(LD256(src + (2 * i))));
+    swap_kernel_sse2(src + (2 * i), dst + (2 * i), n - i);
+}
+
+static inline TARGET("avx2") __m256i
+window8_avx2(__m256i v, __m256i low, __m256i range, __m128i shift, __m256i mul)
+{
+    __m256i d = _mm256_min_epu16(_mm256_subs_epu16(v, low), range);
+
+    return _mm256_mulhi_epu16(_mm256_sll_epi16(d, shift), mul);
+}
+
+static TARGET("avx2") void
+window_avx2(const uint8_t *src, gboolean swap, uint8_t *dst, size_t n, const window_t *w)
+{
+    const __m256i low = _mm256_set1_epi16(w->low);
+    const __m256i range = _mm256_set1_epi16(w->range);
+    const __m128i shift = _mm_cvtsi32_si128(w->shift);
+    const __m256i mul = _mm256_set1_epi16(w->mul);
+    __m256i a, b;
+    size_t i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        a = LD256(src + (2 * i));
+        b = LD256(src + (2 * i) + 32);
+        if (swap) {
+            a = swap_avx2(a);
+            b = swap_avx2(b);
+        }
+        /* packus works within 128 bit lanes, so put the quarters back in order */
+        ST256(dst + i, _mm256_permute4x64_epi64(
+                        _mm256_packus_epi16(window8_avx2(a, low, range, shift, mul),
+                                            window8_avx2(b, low, range, shift, mul)), 0xd8));
+    }
+    window_sse2(src + (2 * i), swap, dst + i, n - i, w);
+}
+
+static const kernels_t kernels_sse2 = { swap_kernel_sse2, window_sse2 };
+static const kernels_t kernels_avx2 = { swap_kernel_avx2, window_avx2 };
+
+#endif
+
+/* the SIMD level is the one demosaic_set_impl() chose */
+static const kernels_t *
+get_kernels(void)
+{
+    switch (demosaic_get_impl()) {
+#ifdef MONO16_X86
+        case DEMOSAIC_IMPL_SSE2:
+            return &kernels_sse2;
+        case DEMOSAIC_IMPL_AVX2:
+            return &kernels_avx2;
+#endif
+        default:
+            return &kernels_scalar;
+    }
+}
+
+gboolean mono16_needs_swap(const dc1394video_frame_t *frame)
+{
+    return (frame->little_endian ? TRUE : FALSE) != HOST_LITTLE_ENDIAN;
+}
+
+void mono16_swap(const uint8_t *src, uint8_t *dst, size_t nsamples)
+{
+    g_return_if_fail(src != NULL && dst != NULL);
+
+    get_kernels()->swap(src, dst, nsamples);
+}
+
+void mono16_frame_to_host(const dc1394video_frame_t *frame, uint8_t *dst, size_t dst_stride)
+{
+    size_t row_bytes, stride;
+    gboolean swap;
+    uint32_t y;
+
+    g_return_if_fail(frame != NULL && frame->image != NULL && dst != NULL);
+
+    row_bytes = (size_t)frame->size[0] * 2;
+    stride = frame->stride ? frame->stride : row_bytes;
+    swap = mono16_needs_swap(frame);
+
+    for (y = 0; y < frame->size[1]; y++) {
+        if (swap)
+            mono16_swap(frame->image + (y * stride), dst + (y * dst_stride), frame->size[0]);
+        else
+            memcpy(dst + (y * dst_stride), frame->image + (y * stride), row_bytes);
+    }
+}
+
+void mono16_set_window(uint32_t low, uint32_t high)
+{
+    window_low = low;
+    window_high = high;
+}
+
+uint32_t mono16_max_value(const dc1394video_frame_t *frame)
+{
+    uint16_t bits = 0;
+    size_t stride;
+    uint32_t x, y;
+
+    g_return_val_if_fail(frame != NULL && frame->image != NULL, 65535);
+
+    if (frame->data_depth <= 8 || frame->data_depth >= 16)
+        return 65535;
+
+    /* samples in the high bits, as mono16_pack12_shift() allows, would be
+     * above the depth's maximum */
+    stride = frame->stride ? frame->stride : (size_t)frame->size[0] * 2;
+    for (y = 0; y < frame->size[1]; y++) {
+        const uint8_t *row = frame->image + (y * stride);
+
+        for (x = 0; x < frame->size[0]; x++)
+            bits |= load16(row + (2 * x), frame->little_endian);
+        if (bits >> frame->data_depth)
+            return 65535;
+    }
+
+    return (1u << frame->data_depth) - 1;
+}
+
+void mono16_get_window(const dc1394video_frame_t *frame, uint32_t *low, uint32_t *high)
+{
+    if (window_high) {
+        *low = window_low;
+        *high = window_high;
+        return;
+    }
+
+    *low = 0;
+    *high = frame ? mono16_max_value(frame) : 65535;
+}
+
+gboolean mono16_set_window_from_string(const char *window)
+{
+    unsigned int low, high;
+    char end;
+
+    g_return_val_if_fail(window != NULL, FALSE);
+
+    if (sscanf(window, "%u,%u%c", &low, &high, &end) != 2 || low >= high || high > 65535)
+        return FALSE;
+
+    mono16_set_window(low, high);
+    return TRUE;
+}
+
+void mono16_window_level(const uint8_t *src, gboolean little_endian, uint8_t *dst, size_t nsamples,
+                uint32_t low, uint32_t high)
+{
+    window_t w;
+
+    g_return_if_fail(src != NULL && dst != NULL);
+
+    window_init(&w, low, high);
+    get_kernels()->window(src, (little_endian ? TRUE : FALSE) != HOST_LITTLE_ENDIAN, dst, nsamples, &w);
+}
+
+dc1394error_t mono16_frame_to_gray8(const dc1394video_frame_t *frame, uint8_t *dst, size_t dst_stride)
+{
+    const kernels_t *k;
+    window_t w;
+    uint32_t low, high, y;
+    size_t stride;
+    gboolean swap;
+
+    g_return_val_if_fail(frame != NULL && frame->image != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+    g_return_val_if_fail(dst != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+
+    mono16_get_window(frame, &low, &high);
+    window_init(&w, low, high);
+    k = get_kernels();
+
+    stride = frame->stride ? frame->stride : (size_t)frame->size[0] * 2;
+    swap = mono16_needs_swap(frame);
+    for (y = 0; y < frame->size[1]; y++)
+        k->window(frame->image + (y * stride), swap, dst + (y * dst_stride), frame->size[0], &w);
+
+    return DC1394_SUCCESS;
+}
+
+int mono16_pack12_shift(const dc1394video_frame_t *frame)
+{
+    uint16_t low_bits = 0, high_bits = 0, v;
+    size_t stride;
+    uint32_t x, y;
+
+    g_return_val_if_fail(frame != NULL && frame->image != NULL, -1);
+
+    stride = frame->stride ? frame->stride : (size_t)frame->size[0] * 2;
+    for (y = 0; y < frame->size[1]; y++) {
+        const uint8_t *row = frame->image + (y * stride);
+
+        for (x = 0; x < frame->size[0]; x++) {
+            v = load16(row + (2 * x), frame->little_endian);
+            low_bits |= v & 0x000f;
+            high_bits |= v & 0xf000;
+        }
+        if (low_bits && high_bits)
+            return -1;
+    }
+
+    return high_bits ? 4 : 0;
+}
+
+size_t mono16_pack12_bytes(size_t nsamples)
+{
+    return ((nsamples * 3) + 1) / 2;
+}
+
+void mono16_pack12(const uint8_t *src, gboolean little_endian, int shift, uint8_t *dst, size_t nsamples)
+{
+    uint32_t a, b;
+    size_t i;
+
+    for (i = 0; i + 2 <= nsamples; i += 2, src += 4, dst += 3) {
+        a = (load16(src, little_endian) >> shift) & 0xfff;
+        b = (load16(src + 2, little_endian) >> shift) & 0xfff;
+        dst[0] = a & 0xff;
+        dst[1] = (a >> 8) | ((b & 0xf) << 4);
+        dst[2] = b >> 4;
+    }
+    if (i < nsamples) {
+        a = (load16(src, little_endian) >> shift) & 0xfff;
+        dst[0] = a & 0xff;
+        dst[1] = a >> 8;
+    }
+}
+
+void mono16_unpack12(const uint8_t *src, gboolean little_endian, int shift, uint8_t *dst, size_t nsamples)
+{
+    size_t i;
+
+    for (i = 0; i + 2 <= nsamples; i += 2, src += 3, dst += 4) {
+        store16(dst, (src[0] | ((src[1] & 0xf) << 8)) << shift, little_endian);
+        store16(dst + 2, ((src[1] >> 4) | (src[2] << 4)) << shift, little_endian);
+    }
+    if (i < nsamples)
+        store16(dst, (src[0] | ((src[1] & 0xf) << 8)) << shift, little_endian);
+}
@@ -0,0 +1,129 @@
+/*
+ * 16 bit sample handling: byte order, window/level to 8 bit and 12 bit
+ * packing, with SIMD kernels chosen at runtime
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _MONO16_H_
+#define _MONO16_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+G_BEGIN_DECLS
+
+/**
+ * MONO16 and RAW16 frames hold one sample per pixel in two bytes, big
+ * endian as the camera sends them unless frame->little_endian is set. The
+ * low data_depth bits are significant, as libdc1394 assumes, though some
+ * cameras put them in the high bits instead (see mono16_max_value()).
+ */
+
+/**
+ * TRUE if the samples of frame are not in this CPU's byte order
+ */
+gboolean mono16_needs_swap(const dc1394video_frame_t *frame);
+
+/**
+ * Swaps the bytes of nsamples 16 bit samples. src and dst may be the same.
+ */
+void mono16_swap(const uint8_t *src, uint8_t *dst, size_t nsamples);
+
+/**
+ * Copies the samples of frame into dst, rows dst_stride bytes apart, in
+ * this CPU's byte order
+ */
+void mono16_frame_to_host(const dc1394video_frame_t *frame, uint8_t *dst, size_t dst_stride);
+
+/**
+ * The range of samples shown as black to white when 16 bit frames are
+ * displayed or converted to 8 bit. high 0 (the default) means the full
+ * range of each frame's data_depth, with low 0.
+ */
+void mono16_set_window(uint32_t low, uint32_t high);
+
+/**
+ * The largest value the samples of frame can hold: (1 << data_depth) - 1
+ * if every sample fits under it, otherwise (the samples are in the high
+ * bits, or data_depth is unset) 65535
+ */
+uint32_t mono16_max_value(const dc1394video_frame_t *frame);
+
+/**
+ * The window for frame, resolving the default to 0 to mono16_max_value()
+ */
+void mono16_get_window(const dc1394video_frame_t *frame, uint32_t *low, uint32_t *high);
+
+/**
+ * Parses "LOW,HIGH" into the window; FALSE unless 0 <= LOW < HIGH <= 65535
+ */
+gboolean mono16_set_window_from_string(const char *window);
+
+/**
+ * Maps nsamples 16 bit samples, little or big endian, linearly onto 0-255;
+ * low and below become 0, high and above 255
+ */
+void mono16_window_level(const uint8_t *src, gboolean little_endian, uint8_t *dst, size_t nsamples,
+                uint32_t low, uint32_t high);
+
+/**
+ * Tone maps frame through its window (see mono16_get_window()) into 8 bit
+ * gray rows dst_stride bytes apart
+ */
+dc1394error_t mono16_frame_to_gray8(const dc1394video_frame_t *frame, uint8_t *dst, size_t dst_stride);
+
+/**
+ * GOption entry to choose the window of 16 bit frames
+ */
+#define GOPTION_ENTRY_WINDOW(_window)                                                           \
+      { "window", 'W', 0, G_OPTION_ARG_STRING, _window, "Range of 16 bit samples shown black to white (default the data depth)", "LOW,HIGH" }
+
+/**
+ * 12 bit packing stores two samples in three bytes, the first in the low 12
+ * bits of the little endian 24 bit group; an odd last sample takes two
+ * bytes. shift is 0 for samples in the low 12 bits of each 16 bit word and
+ * 4 for samples in the high 12 bits.
+ */
+
+/**
+ * Returns the shift (0 or 4) that packs the samples of frame without loss,
+ * or -1 if they need more than 12 bits
+ */
+int mono16_pack12_shift(const dc1394video_frame_t *frame);
+
+/**
+ * Bytes needed to pack nsamples
+ */
+size_t mono16_pack12_bytes(size_t nsamples);
+
+/**
+ * Packs nsamples little or big endian 16 bit samples
+ */
+void mono16_pack12(const uint8_t *src, gboolean little_endian, int shift, uint8_t *dst, size_t nsamples);
+
+/**
+ * Unpacks nsamples into little or big endian 16 bit samples
+ */
+void mono16_unpack12(const uint8_t *src, gboolean little_endian, int shift, uint8_t *dst, size_t nsamples);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * Capture and convert dc1394 frames to cv::Mat on a background thread
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <poll.h>
+
+#include "opencvgrabber.h"
+#include "convert.h"
+#include "demosaic.h"
+#include "latency.h"
+#include "mono16.h"
+
+/* how often the capture thread checks whether it should quit */
+#define POLL_MS     100
+
+static latency_t *grab_latency = NULL;
+
+/* Format7 8 bit frames are Bayer mosaics, as on the Firefly MV */
+static bool
+frame_is_bayer(const dc1394video_frame_t *frame)
+{
+    if (frame->color_coding == DC1394_COLOR_CODING_RAW8)
+        return true;
+    return frame->color_coding == DC1394_COLOR_CODING_MONO8 &&
+           frame->video_mode >= DC1394_VIDEO_MODE_FORMAT7_MIN &&
+           frame->video_mode <= DC1394_VIDEO_MODE_FORMAT7_MAX;
+}
+
+cv::Mat dc1394_frame_get_mat(dc1394video_frame_t *frame)
+{
+    g_return_val_if_fail(frame != NULL && frame->image != NULL, cv::Mat());
+
+    int width = frame->size[0];
+    int height = frame->size[1];
+
+    if (frame_is_bayer(frame)) {
+        cv::Mat bgr(height, width, CV_8UC3);
+
+        if (convert_debayer_to_bgr(frame, bgr.data, bgr.step, demosaic_get_method()) != DC1394_SUCCESS)
+            return cv::Mat();
+        return bgr;
+    }
+
+    switch (frame->color_coding) {
+        case DC1394_COLOR_CODING_MONO8:
+            return cv::Mat(height, width, CV_8UC1, frame->image,
+                           frame->stride ? frame->stride : width).clone();
+        case DC1394_COLOR_CODING_MONO16: {
+            cv::Mat gray(height, width, CV_16UC1);
+
+            mono16_frame_to_host(frame, gray.data, gray.step);
+            return gray;
+        }
+        default:
+            break;
+    }
+
+    /* YUV and RGB */
+    cv::Mat bgr(height, width, CV_8UC3);
+
+    if (convert_to_bgr8(frame, bgr.data, bgr.step) != DC1394_SUCCESS)
+        return cv::Mat();
+    return bgr;
+}
+
+FrameGrabber::FrameGrabber(dc1394camera_t *camera, size_t capacity)
+    : camera(camera), capacity(MAX(capacity, (size_t)1)), thread(NULL),
+      quit(FALSE), running(FALSE), ncaptured(0), ndropped(0)
+{
+    lock = g_mutex_new();
+    cond = g_cond_new();
+
+    if (!grab_latency)
+        grab_latency = latency_get("opencv.grab");
+}
+
+FrameGrabber::~FrameGrabber()
+{
+    stop();
+    dc1394_capture_stop(camera);
+    dc1394_camera_free(camera);
+
+    g_mutex_free(lock);
+    g_cond_free(cond);
+}
+
+bool FrameGrabber::start()
+{
+    dc1394error_t err;
+
+    if (thread)
+        return true;
+
+    err = dc1394_video_set_transmission(camera, DC1394_ON);
+    DC1394_WRN(err, "Could not start camera iso transmission");
+    if (err != DC1394_SUCCESS)
+        return false;
+
+    quit = FALSE;
+    running = TRUE;
+    thread = g_thread_create(thread_func, this, TRUE, NULL);
+    if (thread == NULL) {
+        running = FALSE;
+        dc1394_video_set_transmission(camera, DC1394_OFF);
+        return false;
+    }
+    return true;
+}
+
+void FrameGrabber::stop()
+{
+    if (thread == NULL)
+        return;
+
+    g_mutex_lock(lock);
+    quit = TRUE;
+    g_mutex_unlock(lock);
+    g_thread_join(thread);
+    thread = NULL;
+
+    dc1394_video_set_transmission(camera, DC1394_OFF);
+}
+
+bool FrameGrabber::next(cv::Mat &frame, int timeout_ms, uint64_t *timestamp)
+{
+    GTimeVal until;
+
+    g_get_current_time(&until);
+    g_time_val_add(&until, (glong)timeout_ms * 1000);
+
+    g_mutex_lock(lock);
+    while (queue.empty() && running) {
+        if (timeout_ms < 0)
+            g_cond_wait(cond, lock);
+        else if (!g_cond_timed_wait(cond, lock, &until))
+            break;
+    }
+
+    if (queue.empty()) {
+        g_mutex_unlock(lock);
+        return false;
+    }
+
+    frame = queue.front().image;
+    if (timestamp)
+        *timestamp = queue.front().timestamp;
+    queue.pop_front();
+    g_mutex_unlock(lock);
+    return true;
+}
+
+uint64_t FrameGrabber::captured()
+{
+    uint64_t n;
+
+    g_mutex_lock(lock);
+    n = ncaptured;
+    g_mutex_unlock(lock);
+    return n;
+}
+
+uint64_t FrameGrabber::dropped()
+{
+    uint64_t n;
+
+    g_mutex_lock(lock);
+    n = ndropped;
+    g_mutex_unlock(lock);
+    return n;
+}
+
+gpointer FrameGrabber::thread_func(gpointer data)
+{
+    ((FrameGrabber *)data)->run();
+    return NULL;
+}
+
+/* Waits on the capture file descriptor rather than in dc1394, so that
+ * stop() is noticed within POLL_MS even if the camera stops sending */
+void FrameGrabber::run()
+{
+    dc1394video_frame_t *frame;
+    dc1394error_t err;
+    struct pollfd pfd;
+    Entry entry;
+    uint64_t t;
+    gboolean done;
+
+    pfd.fd = dc1394_capture_get_fileno(camera);
+    pfd.events = POLLIN;
+
+    for (;;) {
+        g_mutex_lock(lock);
+        done = quit;
+        g_mutex_unlock(lock);
+        if (done)
+            break;
+
+        if (poll(&pfd, 1, POLL_MS) <= 0)
+            continue;
+
+        frame = NULL;
+        err = dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_POLL, &frame);
+        DC1394_WRN(err, "Could not capture a frame");
+        if (err != DC1394_SUCCESS || frame == NULL)
+            continue;
+
+        /* convert before handing the DMA buffer back */
+        t = latency_now();
+        entry.image = dc1394_frame_get_mat(frame);
+        entry.timestamp = frame->timestamp;
+        latency_record_since(grab_latency, t);
+
+        err = dc1394_capture_enqueue(camera, frame);
+        DC1394_WRN(err, "releasing buffer");
+
+        g_mutex_lock(lock);
+        if (entry.image.empty()) {
+            ndropped++;
+        } else {
+            if (queue.size() >= capacity) {
+                queue.pop_front();
+                ndropped++;
+            }
+            queue.push_back(entry);
+            ncaptured++;
+            g_cond_broadcast(cond);
+        }
+        g_mutex_unlock(lock);
+
+        entry.image.release();
+    }
+
+    g_mutex_lock(lock);
+    running = FALSE;
+    g_cond_broadcast(cond);
+    g_mutex_unlock(lock);
+}
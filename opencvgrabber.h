@@ -0,0 +1,112 @@
+/*
+ * Capture and convert dc1394 frames to cv::Mat on a background thread
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _OPENCV_GRABBER_H_
+#define _OPENCV_GRABBER_H_
+
+#include <deque>
+
+#include <cv.h>
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+/**
+ * Converts frame into a new cv::Mat that owns its pixels: MONO8 and
+ * MONO16 frames stay single channel (MONO16 in this CPU's byte order),
+ * Bayer (demosaiced with demosaic_get_method()), YUV and RGB frames
+ * become 8 bit BGR. Returns an empty Mat if the frame cannot be
+ * converted.
+ */
+cv::Mat dc1394_frame_get_mat(dc1394video_frame_t *frame);
+
+/**
+ * Captures from a camera on its own thread, converts each frame with
+ * dc1394_frame_get_mat() as soon as it is dequeued, and hands the frames
+ * out through a bounded queue. When the queue is full the oldest frame is
+ * dropped, so the capture never waits on the consumer; a capacity of 1
+ * is a latest frame slot. The Mats are reference counted, so a frame
+ * stays valid for as long as the consumer holds it.
+ *
+ * The grabber owns the camera, which must already be set up for capture
+ * (e.g. with setup_gray_capture()). start() turns on transmission, the
+ * destructor stops it and frees the camera. Call g_thread_init() first.
+ */
+class FrameGrabber
+{
+public:
+    FrameGrabber(dc1394camera_t *camera, size_t capacity = 1);
+    ~FrameGrabber();
+
+    /**
+     * Starts transmission and the capture thread. Returns false if either
+     * could not be started.
+     */
+    bool start();
+
+    /**
+     * Stops the capture thread and transmission; frames already queued can
+     * still be taken
+     */
+    void stop();
+
+    /**
+     * Takes the oldest queued frame, waiting up to timeout_ms for one
+     * (forever if negative). Returns false on timeout, or once stopped
+     * with nothing queued.
+     */
+    bool next(cv::Mat &frame, int timeout_ms = -1, uint64_t *timestamp = NULL);
+
+    /**
+     * Frames converted, and frames dropped because the queue was full or
+     * they could not be converted
+     */
+    uint64_t captured();
+    uint64_t dropped();
+
+private:
+    struct Entry
+    {
+        cv::Mat         image;
+        uint64_t        timestamp;      /* of the frame, in microseconds */
+    };
+
+    static gpointer thread_func(gpointer data);
+    void run();
+
+    /* not copyable */
+    FrameGrabber(const FrameGrabber &);
+    FrameGrabber &operator=(const FrameGrabber &);
+
+    dc1394camera_t      *camera;
+    size_t              capacity;
+    std::deque<Entry>   queue;          /* guarded by lock */
+
+    GThread             *thread;
+    GMutex              *lock;
+    GCond               *cond;          /* a frame was queued, or the thread quit */
+    gboolean            quit;
+    gboolean            running;
+
+    uint64_t            ncaptured;
+    uint64_t            ndropped;
+};
+
+#endif
@@ -1,16 +1,40 @@
+
 #include "opencvutils.h"
+#include "latency.h"
+#include "convert.h"
+#include "demosaic.h"
+#include "mono16.h"
+#include "yuv.h"
+
+static latency_t *convert_latency;
 
 IplImage *dc1394_frame_get_iplimage(dc1394video_frame_t *frame)
 {
     g_return_val_if_fail(frame != NULL, NULL);
     g_return_val_if_fail(frame->padding_bytes == 0, NULL);
 
+    if (!convert_latency)
+        convert_latency = latency_get("opencv.convert");
+
+    uint64_t t = latency_now();
     IplImage *img;
-    unsigned char *imdata;
-    dc1394video_mode_t video_mode = frame->video_mode;
+    dc1394error_t err;
     CvSize size = cvSize(frame->size[0], frame->size[1]);
 
-    if (video_mode == DC1394_VIDEO_MODE_640x480_MONO8) {
+    /* Format7 8 bit frames are Bayer mosaics, as on the Firefly MV */
+    if (frame->color_coding == DC1394_COLOR_CODING_RAW8 ||
+        (frame->color_coding == DC1394_COLOR_CODING_MONO8 &&
+         frame->video_mode >= DC1394_VIDEO_MODE_FORMAT7_MIN &&
+         frame->video_mode <= DC1394_VIDEO_MODE_FORMAT7_MAX)) {
+
+        /* debayer straight into the image's (padded) BGR rows */
+        img = cvCreateImage(size, IPL_DEPTH_8U, 3);
+        err=convert_debayer_to_bgr(frame, (uint8_t *)img->imageData, img->widthStep,
+                                   demosaic_get_method());
+        if (err != DC1394_SUCCESS)
+            dc1394_log_error("Could not convert/debayer frames");
+
+    } else if (frame->color_coding == DC1394_COLOR_CODING_MONO8) {
 
         g_return_val_if_fail(
             (size.width * size.height * 1 * sizeof(unsigned char)) == frame->image_bytes,
@@ -24,48 +48,29 @@ IplImage *dc1394_frame_get_iplimage(dc1394video_frame_t *frame)
 
         cvReleaseImageHeader(&tmp);
 
-    } else if (video_mode == DC1394_VIDEO_MODE_640x480_MONO16) {
+    } else if (frame->color_coding == DC1394_COLOR_CODING_MONO16) {
 
         g_return_val_if_fail(
             (size.width * size.height * 2 * sizeof(unsigned char)) == frame->image_bytes,
             NULL);
 
-        IplImage *tmp = cvCreateImageHeader(size, IPL_DEPTH_16U, 1);
-        cvSetData(tmp, frame->image, size.width*2);
-
-        img = cvCreateImage(size, IPL_DEPTH_16U, tmp->nChannels);
-        cvCopy(tmp, img, 0);
-
-        cvReleaseImageHeader(&tmp);
-
-    } else if ((video_mode == DC1394_VIDEO_MODE_FORMAT7_0) ||
-               (video_mode == DC1394_VIDEO_MODE_FORMAT7_1)) {
-            dc1394error_t err;
-            dc1394video_frame_t dest;
-            IplImage *tmp;
-
-            img = cvCreateImageHeader(size, IPL_DEPTH_8U, 3);
-
-            /* debayer frame into RGB8 */
-            imdata = (unsigned char *)malloc(frame->size[0]*frame->size[1]*3*sizeof(unsigned char));
-            dest.image = imdata;
-            dest.color_coding = DC1394_COLOR_CODING_RGB8;
-            err=dc1394_debayer_frames(frame, &dest, DC1394_BAYER_METHOD_NEAREST); 
-            if (err != DC1394_SUCCESS)
-                dc1394_log_error("Could not convert/debayer frames");
+        /* OpenCV expects the samples in this CPU's byte order */
+        img = cvCreateImage(size, IPL_DEPTH_16U, 1);
+        mono16_frame_to_host(frame, (uint8_t *)img->imageData, img->widthStep);
 
-            /* convert from RGB to BGR */
-            tmp = cvCreateImageHeader(cvSize(frame->size[0], frame->size[1]), IPL_DEPTH_8U, 3);
-            cvSetData(tmp, imdata, frame->size[0]*3);
+    } else if (yuv_coding_supported(frame->color_coding) ||
+               frame->color_coding == DC1394_COLOR_CODING_RGB8) {
 
-            cvCvtColor(tmp, img, CV_RGB2BGR);
+        img = cvCreateImage(size, IPL_DEPTH_8U, 3);
+        err=convert_to_bgr8(frame, (uint8_t *)img->imageData, img->widthStep);
+        if (err != DC1394_SUCCESS)
+            dc1394_log_error("Could not convert frames");
 
-            free(imdata);
-            cvReleaseImageHeader(&tmp);
     } else {
         g_assert_not_reached();
     }
 
+    latency_record_since(convert_latency, t);
     return img;
 }
 
@@ -85,3 +90,70 @@ IplImage *dc1394_capture_get_iplimage(dc1394camera_t *camera)
 
     return img;
 }
+
+IplImage *dc1394_frame_borrow_iplimage(dc1394video_frame_t *frame)
+{
+    IplImage *img;
+    int depth, bytes;
+
+    g_return_val_if_fail(frame != NULL && frame->image != NULL, NULL);
+
+    switch (frame->color_coding) {
+        case DC1394_COLOR_CODING_MONO8:
+            depth = IPL_DEPTH_8U;
+            bytes = 1;
+            break;
+        case DC1394_COLOR_CODING_MONO16:
+            depth = IPL_DEPTH_16U;
+            bytes = 2;
+            break;
+        default:
+            return NULL;
+    }
+
+    /* the frame may be a read only DMA buffer, and libdc1394 only sets
+     * little_endian at capture setup, so samples that are not in this
+     * CPU's byte order cannot be swapped in place */
+    if (bytes == 2 && mono16_needs_swap(frame))
+        return NULL;
+
+    img = cvCreateImageHeader(cvSize(frame->size[0], frame->size[1]), depth, 1);
+    cvSetData(img, frame->image, frame->stride ? frame->stride : frame->size[0] * bytes);
+    return img;
+}
+
+IplImage *dc1394_capture_borrow_iplimage(dc1394camera_t *camera, dc1394video_frame_t **frame)
+{
+    dc1394error_t err;
+    IplImage *img;
+
+    g_return_val_if_fail(frame != NULL, NULL);
+
+    *frame = NULL;
+    err = dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_WAIT, frame);
+    DC1394_WRN(err,"Could not capture a frame");
+    if (err != DC1394_SUCCESS || *frame == NULL)
+        return NULL;
+
+    img = dc1394_frame_borrow_iplimage(*frame);
+    if (img == NULL) {
+        err = dc1394_capture_enqueue(camera, *frame);
+        DC1394_WRN(err,"releasing buffer");
+        *frame = NULL;
+    }
+
+    return img;
+}
+
+void dc1394_capture_release_iplimage(dc1394camera_t *camera, dc1394video_frame_t *frame, IplImage **img)
+{
+    dc1394error_t err;
+
+    if (img && *img)
+        cvReleaseImageHeader(img);
+
+    if (frame) {
+        err = dc1394_capture_enqueue(camera, frame);
+        DC1394_WRN(err,"releasing buffer");
+    }
+}
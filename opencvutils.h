@@ -30,9 +30,45 @@
 
 G_BEGIN_DECLS
 
+/**
+ * Copies (converting if needed) frame into a new image that the caller
+ * owns and frees with cvReleaseImage()
+ */
 IplImage *dc1394_frame_get_iplimage(dc1394video_frame_t *frame);
+
+/**
+ * Dequeues the next frame and returns a copy of it, re-enqueueing the
+ * frame straight away
+ */
 IplImage *dc1394_capture_get_iplimage(dc1394camera_t *camera);
 
+/**
+ * Returns an image header pointing at the pixels of frame, without
+ * allocating or copying them, or NULL if OpenCV cannot use them as they
+ * are; only MONO8 frames, and MONO16 frames already in this CPU's byte
+ * order, can be borrowed. IIDC MONO16 is big endian, so on x86 use
+ * dc1394_frame_get_iplimage(), which swaps into a copy. The frame is
+ * never written to. Free the header with cvReleaseImageHeader() before
+ * the frame's buffer is reused.
+ */
+IplImage *dc1394_frame_borrow_iplimage(dc1394video_frame_t *frame);
+
+/**
+ * Dequeues the next frame and returns a header pointing into the DMA ring
+ * buffer it was captured in, so per frame work runs with no copy. *frame
+ * is set to the dequeued frame, which stays out of the ring until
+ * dc1394_capture_release_iplimage(); hold fewer borrowed images than the
+ * capture has buffers. Frames that cannot be borrowed are re-enqueued
+ * and NULL is returned.
+ */
+IplImage *dc1394_capture_borrow_iplimage(dc1394camera_t *camera, dc1394video_frame_t **frame);
+
+/**
+ * Frees a header from dc1394_capture_borrow_iplimage() and re-enqueues
+ * its frame. *img is set to NULL.
+ */
+void dc1394_capture_release_iplimage(dc1394camera_t *camera, dc1394video_frame_t *frame, IplImage **img);
+
 G_END_DECLS
 
 #endif
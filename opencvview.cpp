@@ -0,0 +1,132 @@
+/*
+ * Use Gtk+ to show live video from the dc1394 camera
+ *
+ * Written by John Stowers <john.stowers@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <signal.h>
+
+#include <cv.h>
+#include <highgui.h>
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+#include "camera.h"
+#include "utils.h"
+#include "opencvgrabber.h"
+#include "latency.h"
+#include "demosaic.h"
+
+int main(int argc, char *argv[])
+{
+    dc1394_t        *d;
+    dc1394camera_t  *camera;
+    FrameGrabber    *grabber;
+    cv::Mat         frame;
+    dc1394error_t   err;
+    int             queue = 1;
+    guint64         guid = 0x00b09d0100818d56LL;
+    gboolean        latency = FALSE;
+    char            *bayer_method = NULL;
+    char            *video_mode_name = NULL;
+    dc1394video_mode_t video_mode = DC1394_VIDEO_MODE_640x480_MONO8;
+    show_mode_t     show = GRAY;
+    uint32_t        width, height;
+    dc1394bayer_method_t method = DC1394_BAYER_METHOD_NEAREST;
+    GOptionContext  *context;
+    GError          *error = NULL;
+
+    GOptionEntry entries[] =
+    {
+      { "queue", 'q', 0, G_OPTION_ARG_INT, &queue, "Frames captured ahead of the display, dropping the oldest (1 shows the latest)", "1" },
+      GOPTION_ENTRY_VIDEO_MODE(&video_mode_name),
+      GOPTION_ENTRY_BAYER_METHOD(&bayer_method),
+      GOPTION_ENTRY_LATENCY(&latency),
+      { NULL }
+    };
+
+    context = g_option_context_new("- OpenCV Camera Viewer");
+    g_option_context_add_main_entries (context, entries, NULL);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        printf( "Error: %s\n%s", error->message, g_option_context_get_help(context, TRUE, NULL));
+        exit(1);
+    }
+    if (bayer_method && !demosaic_method_from_string(bayer_method, &method))
+        app_exit(1, context, "Error: Unknown Bayer method");
+    demosaic_set_method(method);
+    if (video_mode_name && !video_mode_from_string(video_mode_name, &video_mode))
+        app_exit(1, context, "Error: Unknown video mode");
+
+    // frames are converted on a shared pool of threads
+    if (!g_thread_supported())
+        g_thread_init(NULL);
+
+    latency_set_enabled(latency);
+    if (latency)
+        latency_dump_on_signal(SIGUSR1);
+
+    d = dc1394_new ();
+    if (!d)
+        g_critical("Could not create dc1394 context");
+
+    camera = dc1394_camera_new (d, guid);
+    if (!camera)
+        g_critical("Could not create dc1394 camera");
+
+    // setup
+    err = setup_video_mode_capture(camera, video_mode, &show, &width, &height);
+    DC1394_ERR_CLN_RTN(err, cleanup_and_exit(camera), "Could not setup camera");
+
+    // capture and convert on the grabber's thread, which owns the camera
+    grabber = new FrameGrabber(camera, MAX(queue, 1));
+    if (!grabber->start()) {
+        delete grabber;
+        dc1394_free (d);
+        return 1;
+    }
+
+    cv::namedWindow("Input", CV_WINDOW_AUTOSIZE);
+
+    // show each frame as it arrives; the wait only services the window
+    while (1) {
+        if (grabber->next(frame, 100))
+            cv::imshow("Input", frame);
+        if (cv::waitKey(1) >= 0)
+            break;
+        latency_dump_if_requested(stderr);
+    }
+
+    grabber->stop();
+    printf("%" PRIu64 " frames captured, %" PRIu64 " dropped\n", grabber->captured(), grabber->dropped());
+
+    if (latency)
+        latency_dump(stderr);
+
+    cv::destroyWindow("Input");
+
+    // stop transmission and close camera
+    delete grabber;
+    dc1394_free (d);
+
+    return 0;
+}
@@ -31,6 +31,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <signal.h>
 
 #include <glib.h>
 #include <gtk/gtk.h>
@@ -39,30 +40,59 @@
 #include "camera.h"
 #include "utils.h"
 #include "gtkutils.h"
+#include "framecache.h"
+#include "latency.h"
+#include "demosaic.h"
+#include "mono16.h"
+#include "yuv.h"
+
+#define CACHE_MB    256
+
+/* pacing for recordings without an index, which have no timestamps to
+ * look ahead at */
+#define DEFAULT_INTERVAL_US     (1000000 / 60)
+
+static latency_t *read_latency;
 
 typedef struct __playback
 {
     char                *filename;
-    FILE                *fp;
+    recording_t         *rec;
+    frame_cache_t       *cache;
     uint64_t            frame_number;
-    dc1394video_frame_t frame;
-    long                total_frame_size;
+    const dc1394video_frame_t *frame;   /* display ready, owned by the cache */
+    show_mode_t         frame_show;
     show_mode_t         show;
     GtkWidget           *canvas;
+
+    /* playing in real time, paced by the recorded timestamps */
+    double              speed;
+    uint64_t            n_frames;       /* 0 if there is no index */
+    GTimer              *clock;         /* wall time since play was pressed */
+    uint64_t            start_frame;
+    uint64_t            start_timestamp;
+    uint64_t            last_timestamp;
+    uint64_t            nshown;
+    uint64_t            ndropped;
+    GtkWidget           *play_button;
 } playback_t;
 
+/* frames are read and debayered ahead of time in the given direction by
+ * the cache thread, so normally this only finds the frame to draw */
 static int 
-renderframe(int i, playback_t *play) 
+renderframe(int i, playback_t *play, int direction) 
 {
+    const dc1394video_frame_t *frame;
+    uint64_t t;
+
     if( i < 0 )
         return 0;
 
-    if (fseek(play->fp, i * play->total_frame_size, SEEK_SET) == 0) {
-        if (play->frame.image) {
-            free(play->frame.image);
-            play->frame.image = NULL;
-        }
-        read_frame( &(play->frame), play->fp );
+    t = latency_now();
+    frame = frame_cache_get(play->cache, i, direction, &(play->frame_show));
+    if (frame) {
+        latency_record_since(read_latency, t);
+        play->frame = frame;
         return 1;
     } else {
         return 0;
@@ -76,12 +106,12 @@ canvas_button_press( GtkWidget *widget, GdkEventButton *event, gpointer data )
 
     if( event->button == 1 ) {
         play->frame_number++;
-        if( !renderframe(play->frame_number, play) ) 
+        if( !renderframe(play->frame_number, play, 1) ) 
             play->frame_number--;
     } else if ( event->button == 3 ) {
         if( play->frame_number > 0 ) 
             play->frame_number--;
-        renderframe( play->frame_number, play );
+        renderframe( play->frame_number, play, -1 );
     }
     
     g_print("frame: %lld\n", play->frame_number);
@@ -96,7 +126,8 @@ expose_event_callback (GtkWidget *widget, GdkEventExpose *event, gpointer data)
 {
     playback_t *play = (playback_t *)data;
 
-    render_frame_to_widget(&(play->frame), widget, play->show);
+    if (play->frame)
+        render_frame_to_widget((dc1394video_frame_t *)play->frame, widget, play->frame_show);
 
     return TRUE;
 }
@@ -108,20 +139,94 @@ delete_event( GtkWidget *widget, GdkEvent *event, gpointer data )
     return TRUE;
 }
 
+/* where playback should be now, in recording time */
+static uint64_t
+playback_position(playback_t *play)
+{
+    return play->start_timestamp + (uint64_t)(g_timer_elapsed(play->clock, NULL) * 1e6 * play->speed);
+}
+
+static void
+playback_finished(playback_t *play)
+{
+    double elapsed = g_timer_elapsed(play->clock, NULL);
+    double recorded = (play->last_timestamp - play->start_timestamp) / 1e6;
+    uint64_t nframes = play->frame_number - play->start_frame;
+
+    if (elapsed > 0 && recorded > 0)
+        g_print("played %" PRIu64 " frames in %.2fs: %.2f fps shown, %.2f fps requested (%.2fx), %" PRIu64 " dropped\n",
+                nframes, elapsed,
+                play->nshown / elapsed,
+                nframes / recorded * play->speed,
+                play->speed,
+                play->ndropped);
+
+    gtk_widget_set_sensitive(play->play_button, TRUE);
+}
+
+static gboolean playback_tick(gpointer data);
+
+/* runs playback_tick() when the recording time reaches timestamp */
+static void
+playback_schedule(playback_t *play, uint64_t timestamp)
+{
+    uint64_t now = playback_position(play);
+    double delay_us = timestamp > now ? (timestamp - now) / play->speed : 0;
+
+    g_timeout_add((guint)((delay_us + 999) / 1000), playback_tick, play);
+}
+
 static gboolean 
-next_frame(gpointer data)
+playback_tick(gpointer data)
 {
     playback_t *play = (playback_t *)data;
     GtkWidget *widget = play->canvas;
+    uint64_t n, now, next;
+
+    /* show the newest frame that is due, dropping any the display was too
+     * slow to show in time */
+    n = play->frame_number + 1;
+    if (play->n_frames) {
+        now = playback_position(play);
+        while (n + 1 < play->n_frames && recording_get_frame_timestamp(play->rec, n + 1) <= now)
+            n++;
+    }
 
-    play->frame_number++;
-    if( !renderframe(play->frame_number, play) ) {
-        play->frame_number--;
+    if( !renderframe(n, play, 1) ) {
+        playback_finished(play);
         return FALSE;
     }
 
+    play->ndropped += n - play->frame_number - 1;
+    play->nshown++;
+    play->frame_number = n;
+
     gtk_widget_queue_draw_area( widget, 0, 0, 
             widget->allocation.width, widget->allocation.height);
+
+    /* and wait for the one after */
+    if (play->n_frames) {
+        if (n + 1 >= play->n_frames) {
+            play->last_timestamp = play->frame->timestamp;
+            playback_finished(play);
+            return FALSE;
+        }
+        next = recording_get_frame_timestamp(play->rec, n + 1);
+    } else if (play->frame->timestamp > play->last_timestamp && play->nshown > 1) {
+        next = play->frame->timestamp + (play->frame->timestamp - play->last_timestamp);
+    } else {
+        next = play->frame->timestamp + DEFAULT_INTERVAL_US;
+    }
+    play->last_timestamp = play->frame->timestamp;
+
+    playback_schedule(play, next);
+    return FALSE;
+}
+
+static gboolean
+check_latency_dump(gpointer data)
+{
+    latency_dump_if_requested(stderr);
     return TRUE;
 }
 
@@ -130,9 +235,23 @@ on_play_clicked_event (GtkWidget *widget, gpointer data)
 {
     playback_t *play = (playback_t *)data;
 
+    if (play->frame == NULL)
+        return FALSE;
+
     gtk_widget_set_sensitive(widget, FALSE);
-    /*FIXME:    Get framerate from frame structure */
-    g_timeout_add(1000/60, next_frame, data);
+    recording_set_access(play->rec, RECORDING_ACCESS_SEQUENTIAL);
+
+    play->start_frame = play->frame_number;
+    play->start_timestamp = play->frame->timestamp;
+    play->last_timestamp = play->frame->timestamp;
+    play->nshown = 0;
+    play->ndropped = 0;
+    g_timer_start(play->clock);
+
+    if (play->n_frames)
+        playback_schedule(play, recording_get_frame_timestamp(play->rec, play->frame_number + 1));
+    else
+        playback_schedule(play, play->start_timestamp + DEFAULT_INTERVAL_US);
 
     return FALSE;
 }
@@ -144,6 +263,15 @@ int main( int argc, char *argv[])
     GtkWidget *vbox;
 
     playback_t play = { 0 };
+    const dc1394video_frame_t *format;
+    int cache_mb = CACHE_MB;
+    double speed = 1.0;
+    gint64 start_frame = -1;
+    double start_time = -1;
+    gboolean latency = FALSE;
+    char *bayer_method = NULL;
+    char *window16 = NULL;
+    dc1394bayer_method_t method = DC1394_BAYER_METHOD_NEAREST;
 
     /* Option parsing */
     GError *error = NULL;
@@ -151,13 +279,19 @@ int main( int argc, char *argv[])
     GOptionEntry entries[] =
     {
       { "input-filename", 'i', 0, G_OPTION_ARG_FILENAME, &(play.filename), "Input filename", "FILE" },
+      GOPTION_ENTRY_SEEK_ARGUMENTS(&start_frame, &start_time),
+      { "speed", 'x', 0, G_OPTION_ARG_DOUBLE, &speed, "Playback speed relative to real time", "1.0" },
+      { "cache-mb", 'c', 0, G_OPTION_ARG_INT, &cache_mb, "MB of memory for frames decoded ahead of playback", "256" },
+      GOPTION_ENTRY_BAYER_METHOD(&bayer_method),
+      GOPTION_ENTRY_WINDOW(&window16),
+      GOPTION_ENTRY_LATENCY(&latency),
       { NULL }
     };
 
     context = g_option_context_new("- Firefly MV Camera Playback");
     g_option_context_set_summary(context, 
             "Replays successive frames previously recorded\n"
-            "using dc1394-record");
+            "using dc1394-record, at the rate they were captured");
     g_option_context_add_main_entries (context, entries, NULL);
 
     if (!g_option_context_parse (context, &argc, &argv, &error)) {
@@ -171,31 +305,43 @@ int main( int argc, char *argv[])
                 g_option_context_get_help(context, TRUE, NULL));
         exit(2);
     }
-
-    if (play.filename[0] == '-') {
-        play.fp = stdin;
-    } else {
-        play.fp = fopen(play.filename, "rb");
+    if (bayer_method && !demosaic_method_from_string(bayer_method, &method))
+        app_exit(2, context, "Error: Unknown Bayer method");
+    demosaic_set_method(method);
+    if (window16 && !mono16_set_window_from_string(window16))
+        app_exit(2, context, "Error: Invalid window");
+
+    if (speed <= 0) {
+        printf("Error: speed must be greater than zero\n");
+        exit(2);
     }
+    play.speed = speed;
 
-    if( play.fp == NULL ) { 
-        perror("opening file");
+    // also picks up any further segments, FILE.001, FILE.002...
+    play.rec = recording_open(play.filename);
+    if (play.rec == NULL) {
+        printf("Error: could not read recording %s\n", play.filename);
         exit(1);
     }
 
-    // read the first frame
-    play.total_frame_size = read_frame(&play.frame, play.fp);
-    if (play.frame.color_coding == DC1394_COLOR_CODING_MONO8)
+    // geometry and color coding from the file header
+    format = recording_get_format(play.rec);
+    if (format->color_coding == DC1394_COLOR_CODING_MONO8)
         play.show = GRAY;
-    else if (play.frame.color_coding == DC1394_COLOR_CODING_RGB8)
+    else if (format->color_coding == DC1394_COLOR_CODING_MONO16)
+        play.show = GRAY16;
+    else if (format->color_coding == DC1394_COLOR_CODING_RGB8 || yuv_coding_supported(format->color_coding))
         play.show = COLOR;
-    else if (play.frame.color_coding == DC1394_COLOR_CODING_RAW8)
+    else if (format->color_coding == DC1394_COLOR_CODING_RAW8)
         play.show = FORMAT7;
     else {
         perror("invalid color coding");
         exit(1);
     }
 
+    if (!g_thread_supported())
+        g_thread_init(NULL);
+
     gtk_init( &argc, &argv );
     gdk_rgb_init();
 
@@ -215,7 +361,7 @@ int main( int argc, char *argv[])
 
     // canvas (DrawingArea)
     play.canvas = gtk_drawing_area_new();
-    gtk_widget_set_size_request(play.canvas, play.frame.size[0], play.frame.size[1]);
+    gtk_widget_set_size_request(play.canvas, format->size[0], format->size[1]);
     g_signal_connect (G_OBJECT (play.canvas), "expose_event",  
             G_CALLBACK (expose_event_callback), &play);
 
@@ -238,6 +384,7 @@ int main( int argc, char *argv[])
 
     // play button 
     button = gtk_button_new_with_label( "Play" );
+    play.play_button = button;
     g_signal_connect (G_OBJECT (button), "clicked",
                       G_CALLBACK (on_play_clicked_event), (gpointer) &play);
     gtk_box_pack_start(GTK_BOX(vbox), button, FALSE, TRUE, 0);
@@ -245,13 +392,40 @@ int main( int argc, char *argv[])
     // display everything
     gtk_widget_show_all( window );
 
+    // stepping through frames by hand until play is pressed
+    recording_set_access(play.rec, RECORDING_ACCESS_RANDOM);
+
     // render the first frame
-    renderframe(0, &play);
-    
+    if (!recording_seek_from_command_line(play.rec, start_frame, start_time, &play.frame_number))
+        play.frame_number = 0;
+
+    latency_set_enabled(latency);
+    read_latency = latency_get("play.read");
+
+    // from here on the recording is only read by the cache thread
+    play.cache = frame_cache_new(play.rec, play.show, (uint64_t)MAX(cache_mb, 0) * 1024 * 1024);
+    if (play.cache == NULL) {
+        printf("Error: could not allocate the frame cache\n");
+        exit(1);
+    }
+    renderframe(play.frame_number, &play, 1);
+
+    play.n_frames = recording_get_n_frames(play.rec);
+    play.clock = g_timer_new();
+    if (latency) {
+        latency_dump_on_signal(SIGUSR1);
+        g_timeout_add(250, check_latency_dump, NULL);
+    }
+
     // go
     gtk_main();
 
-    fclose(play.fp);
+    if (latency)
+        latency_dump(stderr);
+
+    g_timer_destroy(play.clock);
+    frame_cache_free(play.cache);
+    recording_close(play.rec);
 
     return 0;
 }
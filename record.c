@@ -19,9 +19,14 @@
  *
  * Description:
  *    Writes successive image frames into a single binary file for the
- *    specified duration at the given framerate. Use dc1394-play to replay
+ *    specified duration at the given framerate, or until interrupted.
+ *    Long recordings can be split into segments of a fixed size or length,
+ *    named FILE, FILE.001, FILE.002... Use dc1394-play to replay
  *    this binary file later.
  *
+ *    With --latency, SIGUSR1 prints the per stage latency histograms
+ *    (SIGUSR2 in pre-trigger mode, where SIGUSR1 is the trigger).
+ *
  */
 
 #include <stdio.h>
@@ -30,6 +35,10 @@
 #include <string.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 #include <sys/time.h>
 
 #include <glib.h>
@@ -37,23 +46,364 @@
 
 #include "camera.h"
 #include "utils.h"
+#include "ringbuffer.h"
+#include "codec.h"
+#include "storage.h"
+#include "health.h"
+#include "latency.h"
+
+#define RING_DEPTH      120     /* 2s at 60fps */
+#define WRITER_IDLE_US  2000
+#define HEALTH_INTERVAL 10      /* seconds between rolling health reports */
+#define PROGRESS_MS     250     /* console progress update interval */
+
+typedef struct __encode_job
+{
+    dc1394video_frame_t *frame;
+    uint8_t             *buf;
+    size_t              capacity;
+    size_t              nbytes;     /* 0 = store uncompressed */
+    double              encode_ms;
+    struct __writer     *writer;
+} encode_job_t;
+
+typedef struct __writer
+{
+    recording_t     *rec;
+    frame_ring_t    *ring;
+    volatile gint   done;
+    unsigned long   nwritten;
+
+    /* segmentation, 0 limits = one file */
+    const char      *filename;
+    storage_t       *out;
+    storage_backend_t backend;
+    unsigned int    segment;
+    uint64_t        segment_bytes;
+    uint64_t        segment_us;
+    uint64_t        segment_start;
+    uint64_t        prealloc_bytes;
+    unsigned long   nlost;
+
+    /* pre-trigger mode; while armed only the newest pre_frames are kept */
+    volatile gint   armed;
+    unsigned int    pre_frames;
+    unsigned long   ndiscarded;
+
+    /* compression, NULL pool = off */
+    GThreadPool     *pool;
+    encode_job_t    *jobs;
+    int             njobs;
+    int             pending;
+    GMutex          *lock;
+    GCond           *cond;
+    uint64_t        raw_bytes;
+    uint64_t        stored_bytes;
+    double          encode_ms_total;
+    double          encode_ms_max;
+} writer_t;
+
+/* per stage timers, see latency.h */
+static latency_t *dequeue_latency;
+static latency_t *copy_latency;
+static latency_t *write_latency;
+static latency_t *compress_latency;
+
+static double
+now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec * 1000.0) + (tv.tv_usec / 1000.0);
+}
+
+static storage_t *
+segment_create(const char *name, storage_backend_t backend, uint64_t prealloc_bytes)
+{
+    storage_t *out;
+
+    out = storage_open(name, backend);
+    if (out && !storage_preallocate(out, prealloc_bytes)) {
+        storage_close(out);
+        unlink(name);
+        return NULL;
+    }
+    return out;
+}
+
+/* Flushes the segment and trims any unused preallocated space */
+static void
+segment_finish(storage_t *out)
+{
+    if (!storage_close(out))
+        perror("Could not finish writing segment");
+}
+
+static gboolean
+writer_rotate_segment(writer_t *writer, dc1394video_frame_t *frame)
+{
+    gchar *name;
+
+    recording_close(writer->rec);
+    segment_finish(writer->out);
+    writer->rec = NULL;
+
+    name = recording_segment_filename(writer->filename, ++writer->segment);
+    writer->out = segment_create(name, writer->backend, writer->prealloc_bytes);
+    if (writer->out) {
+        writer->rec = recording_open_write_storage(writer->out, frame);
+    } else {
+        perror(name);
+    }
+    g_free(name);
+
+    return writer->rec != NULL;
+}
+
+/* Writes one frame, first starting a new segment if this frame would take
+ * the current one over its size or time limit */
+static void
+writer_store(writer_t *writer, dc1394video_frame_t *frame, const uint8_t *payload, uint32_t nbytes)
+{
+    uint64_t size, t;
+
+    if (writer->rec == NULL) {
+        writer->nlost++;
+        return;
+    }
+
+    size = recording_get_size(writer->rec);
+    if (recording_get_n_frames(writer->rec) > 0 &&
+        ((writer->segment_bytes && size + RECORDING_FRAME_BYTES + nbytes > writer->segment_bytes) ||
+         (writer->segment_us && frame->timestamp - writer->segment_start >= writer->segment_us))) {
+        if (!writer_rotate_segment(writer, frame)) {
+            writer->nlost++;
+            return;
+        }
+    }
+
+    // a segment's time limit runs from its first stored frame, not from
+    // the warm-up frame or, with --pre-trigger, from when recording was armed
+    if (recording_get_n_frames(writer->rec) == 0)
+        writer->segment_start = frame->timestamp;
+
+    t = latency_now();
+    if (payload)
+        recording_write_encoded_frame(writer->rec, frame, codec_for_frame(frame), payload, nbytes);
+    else
+        recording_write_frame(writer->rec, frame);
+    latency_record_since(write_latency, t);
+}
+
+static void
+encode_func(gpointer data, gpointer user_data)
+{
+    encode_job_t *job = (encode_job_t *)data;
+    writer_t *writer = job->writer;
+    double start = now_ms();
+    uint64_t t = latency_now();
+
+    job->nbytes = codec_encode_frame(job->frame, job->buf, job->capacity);
+    job->encode_ms = now_ms() - start;
+    latency_record_since(compress_latency, t);
+
+    g_mutex_lock(writer->lock);
+    if (--writer->pending == 0)
+        g_cond_signal(writer->cond);
+    g_mutex_unlock(writer->lock);
+}
+
+/* Compresses up to njobs queued frames in parallel, then writes them in
+ * order. Returns the number of frames written. */
+static int
+write_compressed_batch(writer_t *writer)
+{
+    dc1394video_frame_t *frame;
+    encode_job_t *job;
+    int i, n;
+
+    n = 0;
+    while (n < writer->njobs && (frame = frame_ring_peek_nth(writer->ring, n)) != NULL)
+        writer->jobs[n++].frame = frame;
+
+    if (n == 0)
+        return 0;
+
+    writer->pending = n;
+    for (i = 0; i < n; i++)
+        g_thread_pool_push(writer->pool, &(writer->jobs[i]), NULL);
+
+    g_mutex_lock(writer->lock);
+    while (writer->pending > 0)
+        g_cond_wait(writer->cond, writer->lock);
+    g_mutex_unlock(writer->lock);
+
+    for (i = 0; i < n; i++) {
+        uint64_t raw;
+
+        job = &(writer->jobs[i]);
+        raw = job->frame->image_bytes ? job->frame->image_bytes : job->frame->total_bytes;
+        if (job->nbytes)
+            writer_store(writer, job->frame, job->buf, job->nbytes);
+        else
+            writer_store(writer, job->frame, NULL, raw);
+
+        writer->raw_bytes += raw;
+        writer->stored_bytes += job->nbytes ? job->nbytes : raw;
+        writer->encode_ms_total += job->encode_ms;
+        writer->encode_ms_max = MAX(writer->encode_ms_max, job->encode_ms);
+
+        frame_ring_release(writer->ring);
+    }
+
+    return n;
+}
+
+static void
+writer_setup_compression(writer_t *writer, int nthreads, uint64_t frame_bytes)
+{
+    int i;
+
+    writer->njobs = nthreads * 2;
+    writer->jobs = g_new0(encode_job_t, writer->njobs);
+    for (i = 0; i < writer->njobs; i++) {
+        writer->jobs[i].writer = writer;
+        writer->jobs[i].capacity = frame_bytes;
+        writer->jobs[i].buf = g_malloc(frame_bytes);
+    }
+
+    writer->lock = g_mutex_new();
+    writer->cond = g_cond_new();
+    writer->pool = g_thread_pool_new(encode_func, NULL, nthreads, TRUE, NULL);
+}
+
+static void
+writer_free_compression(writer_t *writer)
+{
+    int i;
+
+    if (!writer->pool)
+        return;
+
+    g_thread_pool_free(writer->pool, FALSE, TRUE);
+    for (i = 0; i < writer->njobs; i++)
+        g_free(writer->jobs[i].buf);
+    g_free(writer->jobs);
+    g_mutex_free(writer->lock);
+    g_cond_free(writer->cond);
+}
+
+static gpointer
+writer_thread(gpointer data)
+{
+    writer_t *writer = (writer_t *)data;
+    dc1394video_frame_t *frame;
+    gint done;
+    int n;
+
+    while (1) {
+        /* sample done before looking at the ring so that a frame pushed
+         * just before the producer finished is never missed */
+        done = g_atomic_int_get(&writer->done);
+
+        if (g_atomic_int_get(&writer->armed)) {
+            while (frame_ring_get_fill(writer->ring) > writer->pre_frames) {
+                frame_ring_release(writer->ring);
+                writer->ndiscarded++;
+            }
+            if (done)
+                break;
+            g_usleep(WRITER_IDLE_US);
+            continue;
+        }
+
+        if (writer->pool) {
+            n = write_compressed_batch(writer);
+        } else if ((frame = frame_ring_peek(writer->ring)) != NULL) {
+            writer_store(writer, frame, NULL,
+                    frame->image_bytes ? frame->image_bytes : frame->total_bytes);
+            frame_ring_release(writer->ring);
+            n = 1;
+        } else {
+            n = 0;
+        }
+
+        writer->nwritten += n;
+        if (n == 0) {
+            if (done)
+                break;
+            g_usleep(WRITER_IDLE_US);
+        }
+    }
+
+    return NULL;
+}
+
+static volatile sig_atomic_t trigger_signalled = 0;
+static volatile sig_atomic_t stop_signalled = 0;
+
+static void
+stop_signal_handler(int sig)
+{
+    stop_signalled = 1;
+}
+
+static void
+trigger_signal_handler(int sig)
+{
+    trigger_signalled = 1;
+}
+
+/* Returns TRUE once SIGUSR1 has been received or a byte can be read from
+ * fd (stdin or a FIFO). fd is polled rather than made non-blocking, which
+ * would leave a terminal on stdin non-blocking for the shell after exit */
+static gboolean
+trigger_check(int fd)
+{
+    struct pollfd pfd;
+    char c;
+
+    if (trigger_signalled)
+        return TRUE;
+    if (fd < 0)
+        return FALSE;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN) && read(fd, &c, 1) > 0)
+        return TRUE;
+    return FALSE;
+}
 
 int main(int argc, char **argv)
 {
-    FILE *fp = NULL;
+    storage_t *out = NULL;
     unsigned char use_stdout = 0;
     uint32_t width, height;
     dc1394_t * d;
     dc1394camera_t *camera;
     dc1394error_t err;
     dc1394video_frame_t *frame;
+    writer_t writer;
+    GThread *writer_tid;
+    gboolean triggered, latency;
+    gboolean stored;
+    uint64_t t;
+    int trigger_fd = -1;
+    capture_health_t *health;
+    gchar *report;
 
     /* Options */
     show_mode_t show;
     char *format;
     char *filename;
-    double framerate;
-    int exposure, brightness, duration, i;
+    char *trigger;
+    char *backend;
+    char *video_mode_name;
+    dc1394video_mode_t video_mode;
+    double framerate, pre_seconds, segment_seconds, health_interval;
+    int exposure, brightness, duration, depth, compress, pre_mb, segment_mb, i;
     guint64 guid;
 
     /* Option parsing */
@@ -62,8 +412,19 @@ int main(int argc, char **argv)
     GOptionEntry entries[] =
     {
       GOPTION_ENTRY_FORMAT(&format),
+      GOPTION_ENTRY_VIDEO_MODE(&video_mode_name),
       { "output-filename", 'o', 0, G_OPTION_ARG_FILENAME, &filename, "Output filename", "FILE" },
-      { "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds to record", NULL },
+      { "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds to record (0 = until interrupted)", NULL },
+      { "segment-mb", 's', 0, G_OPTION_ARG_INT, &segment_mb, "Start a new file (FILE.001, FILE.002...) every N MB", "N" },
+      { "segment-seconds", 'S', 0, G_OPTION_ARG_DOUBLE, &segment_seconds, "Start a new file every N seconds", "N" },
+      { "backend", 'w', 0, G_OPTION_ARG_STRING, &backend, "How frames are written to disk: " STORAGE_BACKEND_NAMES, "stdio" },
+      { "ring-depth", 'r', 0, G_OPTION_ARG_INT, &depth, "Frames buffered between capture and disk", "120" },
+      { "compress", 'z', 0, G_OPTION_ARG_INT, &compress, "Losslessly compress MONO8/RAW8 frames, or pack 12 bit MONO16 frames, using N threads", "N" },
+      { "pre-trigger", 'p', 0, G_OPTION_ARG_DOUBLE, &pre_seconds, "Wait for a trigger, keeping this many seconds from before it. Duration is then the time recorded after it", "5.0" },
+      { "pre-trigger-mb", 'm', 0, G_OPTION_ARG_INT, &pre_mb, "Limit the pre-trigger buffer to this many MB", "256" },
+      { "health-interval", 'H', 0, G_OPTION_ARG_DOUBLE, &health_interval, "Seconds between capture health reports on stderr (0 = only at the end)", "10" },
+      GOPTION_ENTRY_LATENCY(&latency),
+      { "trigger", 'T', 0, G_OPTION_ARG_FILENAME, &trigger, "Also trigger on a byte from this FIFO, or - for stdin (SIGUSR1 always triggers)", "FIFO" },
       GOPTION_ENTRY_CAMERA_SETUP_ARGUMENTS(&guid, &framerate, &exposure, &brightness),
       { NULL }
     };
@@ -83,6 +444,17 @@ int main(int argc, char **argv)
     exposure = -1;
     brightness = -1;
     duration = 0;
+    depth = RING_DEPTH;
+    compress = 0;
+    pre_seconds = 0;
+    pre_mb = 0;
+    trigger = NULL;
+    health_interval = HEALTH_INTERVAL;
+    latency = FALSE;
+    segment_mb = 0;
+    segment_seconds = 0;
+    backend = NULL;
+    video_mode_name = NULL;
 
     if (!g_option_context_parse (context, &argc, &argv, &error)) {
         printf( "Error: %s\n%s", 
@@ -92,20 +464,39 @@ int main(int argc, char **argv)
     }
     if (filename == NULL)
         app_exit(2, context, "Error: You must supply a filename");
-    if (duration <= 0)
-        app_exit(3, context, "Error: You must supply a duration");
+    if (duration < 0)
+        app_exit(3, context, "Error: Duration must not be negative");
+    if (depth <= 0)
+        app_exit(3, context, "Error: Ring depth must be positive");
+    if (compress < 0)
+        app_exit(3, context, "Error: Compression threads must not be negative");
+    if (pre_seconds < 0 || pre_mb < 0)
+        app_exit(3, context, "Error: Pre-trigger buffer must not be negative");
+    if (segment_seconds < 0 || segment_mb < 0)
+        app_exit(3, context, "Error: Segment limits must not be negative");
 
     if (format && format[0])
         show = format[0];
+    if (video_mode_name && !video_mode_from_string(video_mode_name, &video_mode))
+        app_exit(3, context, "Error: Unknown video mode");
+
+    writer.backend = STORAGE_STDIO;
+    if (backend && !storage_backend_from_string(backend, &writer.backend))
+        app_exit(3, context, "Error: Unknown storage backend");
+
+    writer.segment_bytes = (uint64_t)segment_mb << 20;
+    writer.segment_us = segment_seconds * 1e6;
 
     if (filename[0] == '-') {
+        if (writer.segment_bytes || writer.segment_us)
+            app_exit(3, context, "Error: Cannot split a recording written to stdout");
         use_stdout = 1;
-        fp = stdout;
+        out = storage_new_from_fp(stdout);
     } else {
-        fp = fopen( filename, "wb+");
+        out = storage_open(filename, writer.backend);
     }
 
-    if( fp == NULL ) {
+    if( out == NULL ) {
         app_exit(4, NULL, "Error creating output file");
     }
 
@@ -117,30 +508,26 @@ int main(int argc, char **argv)
     if (!camera)
         app_exit(6, context, "Could not find or initialize camera");
 
+    // setup capture, in the mode for the format unless one was given
+    if (!video_mode_name)
+        video_mode = video_mode_for_show(camera, show);
+    err=setup_video_mode_capture(camera, video_mode, &show, &width, &height);
+    DC1394_ERR_CLN_RTN(err,cleanup_and_exit(camera),"Could not setup camera");
+
     if (!use_stdout) {
         printf( "Recording Details:\n"
                 "  Duration   = %d\n"
-                "  Format     = %c\n"
+                "  Video mode = %s\n"
                 "  Framerate  = %f\n"
                 "  Exposure   = %d\n"
-                "  Brightness = %d\n\n"
+                "  Brightness = %d\n"
+                "  Ring depth = %d\n"
+                "  Backend    = %s\n"
+                "  Compress   = %d threads\n\n"
                 "Recording:\n",
-                duration,show,framerate,exposure,brightness);
-    }
-
-    // setup capture
-    switch (show) {
-        case GRAY:
-        case COLOR:
-            dc1394_get_image_size_from_video_mode(camera, DC1394_VIDEO_MODE_640x480_MONO8, &width, &height);
-            err=setup_gray_capture(camera, DC1394_VIDEO_MODE_640x480_MONO8);
-            break;
-        case FORMAT7:
-            dc1394_get_image_size_from_video_mode(camera, DC1394_VIDEO_MODE_FORMAT7_0, &width, &height);
-            err=setup_color_capture(camera, DC1394_VIDEO_MODE_FORMAT7_0, DC1394_COLOR_CODING_RAW8);
-            break;
+                duration,video_mode_to_string(video_mode),framerate,exposure,brightness,depth,
+                storage_backend_to_string(storage_get_backend(out)),compress);
     }
-    DC1394_ERR_CLN_RTN(err,cleanup_and_exit(camera),"Could not setup camera");
 
     err=setup_from_command_line(camera, framerate, exposure, brightness);
     DC1394_ERR_CLN_RTN(err,cleanup_and_exit(camera),"Could not set camera from command line arguments");
@@ -157,49 +544,204 @@ int main(int argc, char **argv)
         dc1394_capture_enqueue(camera,frame);
     }
 
+    // frames are copied out of the DMA ring into our own, deeper ring and
+    // written to disk by another thread, so disk stalls do not hold
+    // capture buffers
+    if (!g_thread_supported())
+        g_thread_init(NULL);
+
+    // reserve disk space for each segment up front; a time limited segment
+    // is sized from the uncompressed frame rate
+    writer.prealloc_bytes = writer.segment_bytes;
+    if (writer.segment_us && !writer.segment_bytes)
+        writer.prealloc_bytes = segment_seconds * framerate * (frame->total_bytes + RECORDING_FRAME_BYTES);
+    if (!use_stdout && !storage_preallocate(out, writer.prealloc_bytes))
+        app_exit(4, NULL, "Error preallocating output file");
+
+    writer.filename = filename;
+    writer.out = out;
+    writer.segment = 0;
+    writer.segment_start = 0;
+    writer.nlost = 0;
+
+    writer.rec = recording_open_write_storage(out, frame);
+    if (!writer.rec)
+        app_exit(7, NULL, "Could not write recording header");
+
+    writer.done = 0;
+    writer.nwritten = 0;
+    writer.ndiscarded = 0;
+    writer.pre_frames = 0;
+    writer.armed = 0;
+
+    // in pre-trigger mode the ring also holds the frames from before the
+    // trigger, so it is allocated once here and never grows
+    triggered = TRUE;
+    if (pre_seconds > 0 || pre_mb > 0) {
+        writer.pre_frames = (pre_seconds > 0) ? (pre_seconds * framerate) : G_MAXUINT;
+        if (pre_mb > 0)
+            writer.pre_frames = MIN(writer.pre_frames, ((uint64_t)pre_mb << 20) / frame->total_bytes);
+        writer.pre_frames = MAX(writer.pre_frames, 1);
+        writer.armed = 1;
+        depth += writer.pre_frames;
+        triggered = FALSE;
+
+        signal(SIGUSR1, trigger_signal_handler);
+        if (trigger) {
+            trigger_fd = (trigger[0] == '-') ? STDIN_FILENO : open(trigger, O_RDONLY | O_NONBLOCK);
+            if (trigger_fd < 0)
+                app_exit(7, NULL, "Could not open trigger");
+        }
+
+        if (!use_stdout)
+            printf("Waiting for trigger, keeping %u frames\n", writer.pre_frames);
+    }
+
+    writer.ring = frame_ring_new(depth, frame->total_bytes);
+    if (!writer.ring)
+        app_exit(7, NULL, "Could not allocate frame ring");
+
+    writer.pool = NULL;
+    if (compress > 0) {
+        if (codec_supports_frame(frame))
+            writer_setup_compression(&writer, compress, frame->total_bytes);
+        else if (!use_stdout)
+            printf("Compression not supported for this format, recording uncompressed\n");
+    }
+
+    writer_tid = g_thread_create(writer_thread, &writer, TRUE, NULL);
+    if (!writer_tid)
+        app_exit(7, NULL, "Could not start writer thread");
+
+    // stop cleanly on ^C or kill so the index is still written
+    signal(SIGINT, stop_signal_handler);
+    signal(SIGTERM, stop_signal_handler);
+
+    // SIGUSR1 is already the trigger in pre-trigger mode
+    latency_set_enabled(latency);
+    dequeue_latency = latency_get("record.dequeue");
+    copy_latency = latency_get("record.copy");
+    write_latency = latency_get("record.write");
+    compress_latency = latency_get("record.compress");
+    if (latency)
+        latency_dump_on_signal(writer.pre_frames ? SIGUSR2 : SIGUSR1);
+
+    // dropped frames are inferred from gaps in the camera timestamps
+    health = capture_health_new(framerate);
+
     // compute actual framerate
-    struct timeval start, now;
+    struct timeval start, now, reported;
+    unsigned long printed = 0;
     gettimeofday( &start, NULL );
     now = start;
+    reported = start;
     int numframes = 0;
     unsigned long elapsed = (now.tv_usec / 1000 + now.tv_sec * 1000) - 
         (start.tv_usec / 1000 + start.tv_sec * 1000);
 
-    while(elapsed < duration * 1000)
+    while(!stop_signalled && (!triggered || duration == 0 || elapsed < duration * 1000))
     {
         // get a single frame
+        t = latency_now();
         err=dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_WAIT, &frame);
         DC1394_WRN(err,"Could not capture a frame");
+        latency_record_since(dequeue_latency, t);
+
+        if (err == DC1394_SUCCESS && frame) {
+            t = latency_now();
+            stored = frame_ring_push(writer.ring, frame);
+            latency_record_since(copy_latency, t);
+            capture_health_add_frame(health, frame, stored);
 
-        write_frame(frame, fp);
-        
-        err=dc1394_capture_enqueue(camera,frame);
-        DC1394_WRN(err,"releasing buffer");
+            err=dc1394_capture_enqueue(camera,frame);
+            DC1394_WRN(err,"releasing buffer");
+        } else {
+            capture_health_add_error(health);
+        }
 
         gettimeofday( &now, NULL );
+
+        if (health_interval > 0 && (now.tv_sec - reported.tv_sec) >= health_interval) {
+            report = capture_health_window(health);
+            fprintf(stderr, "%shealth: %s\n", use_stdout ? "" : "\n", report);
+            g_free(report);
+            reported = now;
+        }
+        latency_dump_if_requested(stderr);
+
+        // the post-trigger duration is measured from the trigger
+        if (!triggered && trigger_check(trigger_fd)) {
+            triggered = TRUE;
+            g_atomic_int_set(&writer.armed, 0);
+            start = now;
+            numframes = 0;
+            if (!use_stdout)
+                printf("\nTriggered\n");
+        }
+
         elapsed = (now.tv_usec / 1000 + now.tv_sec * 1000) - 
             (start.tv_usec / 1000 + start.tv_sec * 1000);
 
-        if (!use_stdout) {
-            printf("\r%d frames (%lu ms)", ++numframes, elapsed);
+        // the console is slow, only update it a few times a second
+        numframes++;
+        if (!use_stdout && (elapsed < printed || elapsed - printed >= PROGRESS_MS)) {
+            printf("\r%d frames (%lu ms)", numframes, elapsed);
             fflush(stdout);
+            printed = elapsed;
         }
     }
 
     elapsed = (now.tv_usec / 1000 + now.tv_sec * 1000) - 
         (start.tv_usec / 1000 + start.tv_sec * 1000);
 
+    // let the writer drain whatever is still queued
+    g_atomic_int_set(&writer.done, 1);
+    g_thread_join(writer_tid);
+
     if (!use_stdout) {
         printf("\n");
         printf("time elapsed: %lu ms - %4.1f fps\n", elapsed,
                 (float)numframes/elapsed * 1000);
+        printf("ring: depth %u, high water %u, overflowed %u, wrote %lu frames\n",
+                frame_ring_get_depth(writer.ring),
+                frame_ring_get_high_water(writer.ring),
+                frame_ring_get_overflows(writer.ring),
+                writer.nwritten);
+        if (writer.pre_frames)
+            printf("pre-trigger: kept %u frames, discarded %lu\n",
+                    writer.pre_frames, writer.ndiscarded);
+        if (writer.segment)
+            printf("segments: %u files\n", writer.segment + 1);
+        if (writer.nlost)
+            printf("lost %lu frames, could not create a new segment\n", writer.nlost);
+        if (writer.pool && writer.nwritten) {
+            printf("compression: ratio %.2f, encode %.2f ms/frame mean, %.2f ms max\n",
+                    (double)writer.raw_bytes / writer.stored_bytes,
+                    writer.encode_ms_total / writer.nwritten,
+                    writer.encode_ms_max);
+        }
     }
 
+    // machine readable summary, also kept in the recording
+    report = capture_health_summary(health);
+    fprintf(stderr, "capture: %s\n", report);
+    g_free(report);
+    if (writer.rec)
+        capture_health_store(health, writer.rec);
+    capture_health_free(health);
+
+    if (latency)
+        latency_dump(stderr);
+
+    writer_free_compression(&writer);
+    frame_ring_free(writer.ring);
+    recording_close(writer.rec);
+    if (writer.out)
+        segment_finish(writer.out);
 
     // close camera
     cleanup_and_exit(camera);
     dc1394_free (d);
 
-    fclose(fp);
 	return 0;
 }
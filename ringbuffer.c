@@ -0,0 +1,154 @@
+/*
+ * Lock-free frame ring for passing captured frames between threads
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ringbuffer.h"
+
+struct __frame_ring
+{
+    unsigned int        depth;
+    uint64_t            slot_bytes;
+    dc1394video_frame_t *slots;
+    unsigned char       *storage;
+
+    /* head and tail only ever increase; their difference is the fill level.
+     * head is written only by the producer, tail only by the consumer */
+    volatile gint       head;
+    volatile gint       tail;
+
+    /* written only by the producer */
+    volatile gint       high_water;
+    volatile gint       overflows;
+};
+
+frame_ring_t *frame_ring_new(unsigned int depth, uint64_t slot_bytes)
+{
+    unsigned int i;
+    frame_ring_t *ring;
+
+    g_return_val_if_fail(depth > 0, NULL);
+    g_return_val_if_fail(slot_bytes > 0, NULL);
+
+    ring = g_new0(frame_ring_t, 1);
+    ring->depth = depth;
+    ring->slot_bytes = slot_bytes;
+    ring->slots = g_new0(dc1394video_frame_t, depth);
+    ring->storage = g_malloc(depth * slot_bytes);
+
+    /* touch every page now so the first lap around the ring does not fault */
+    memset(ring->storage, 0, depth * slot_bytes);
+
+    for (i = 0; i < depth; i++) {
+        ring->slots[i].image = ring->storage + (i * slot_bytes);
+        ring->slots[i].allocated_image_bytes = slot_bytes;
+    }
+
+    return ring;
+}
+
+void frame_ring_free(frame_ring_t *ring)
+{
+    if (ring) {
+        g_free(ring->storage);
+        g_free(ring->slots);
+        g_free(ring);
+    }
+}
+
+gboolean frame_ring_push(frame_ring_t *ring, dc1394video_frame_t *frame)
+{
+    dc1394video_frame_t *slot;
+    unsigned char *image;
+    unsigned int head, tail, fill;
+
+    head = (unsigned int)g_atomic_int_get(&ring->head);
+    tail = (unsigned int)g_atomic_int_get(&ring->tail);
+
+    if ((head - tail) >= ring->depth || frame->total_bytes > ring->slot_bytes) {
+        g_atomic_int_set(&ring->overflows, g_atomic_int_get(&ring->overflows) + 1);
+        return FALSE;
+    }
+
+    slot = &(ring->slots[head % ring->depth]);
+    image = slot->image;
+
+    /* copy header, keeping the slot's own image storage */
+    *slot = *frame;
+    slot->image = image;
+    slot->allocated_image_bytes = ring->slot_bytes;
+    memcpy(slot->image, frame->image, frame->total_bytes);
+
+    /* publish the slot only after its contents are written */
+    g_atomic_int_set(&ring->head, (gint)(head + 1));
+
+    fill = head + 1 - tail;
+    if (fill > (unsigned int)g_atomic_int_get(&ring->high_water))
+        g_atomic_int_set(&ring->high_water, (gint)fill);
+
+    return TRUE;
+}
+
+dc1394video_frame_t *frame_ring_peek(frame_ring_t *ring)
+{
+    return frame_ring_peek_nth(ring, 0);
+}
+
+dc1394video_frame_t *frame_ring_peek_nth(frame_ring_t *ring, unsigned int n)
+{
+    unsigned int head, tail;
+
+    tail = (unsigned int)g_atomic_int_get(&ring->tail);
+    head = (unsigned int)g_atomic_int_get(&ring->head);
+
+    if ((head - tail) <= n)
+        return NULL;
+
+    return &(ring->slots[(tail + n) % ring->depth]);
+}
+
+void frame_ring_release(frame_ring_t *ring)
+{
+    unsigned int tail = (unsigned int)g_atomic_int_get(&ring->tail);
+    g_atomic_int_set(&ring->tail, (gint)(tail + 1));
+}
+
+unsigned int frame_ring_get_depth(frame_ring_t *ring)
+{
+    return ring->depth;
+}
+
+unsigned int frame_ring_get_fill(frame_ring_t *ring)
+{
+    return (unsigned int)g_atomic_int_get(&ring->head) -
+           (unsigned int)g_atomic_int_get(&ring->tail);
+}
+
+unsigned int frame_ring_get_high_water(frame_ring_t *ring)
+{
+    return (unsigned int)g_atomic_int_get(&ring->high_water);
+}
+
+unsigned int frame_ring_get_overflows(frame_ring_t *ring)
+{
+    return (unsigned int)g_atomic_int_get(&ring->overflows);
+}
@@ -0,0 +1,78 @@
+/*
+ * Lock-free frame ring for passing captured frames between threads
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _RINGBUFFER_H_
+#define _RINGBUFFER_H_
+
+#include <inttypes.h>
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+G_BEGIN_DECLS
+
+/**
+ * A fixed depth ring of preallocated frame slots. Exactly one thread may
+ * push (the producer) and exactly one thread may pop (the consumer); no
+ * locks are taken and no memory is allocated after frame_ring_new().
+ */
+typedef struct __frame_ring frame_ring_t;
+
+/**
+ * Allocates a ring of depth slots, each able to hold a frame image of up
+ * to slot_bytes bytes.
+ */
+frame_ring_t *frame_ring_new(unsigned int depth, uint64_t slot_bytes);
+
+void frame_ring_free(frame_ring_t *ring);
+
+/**
+ * Producer side. Copies the frame header and image into the next free slot.
+ * Returns FALSE (and counts an overflow) if the ring is full or the image
+ * does not fit in a slot.
+ */
+gboolean frame_ring_push(frame_ring_t *ring, dc1394video_frame_t *frame);
+
+/**
+ * Consumer side. Returns the oldest queued frame, or NULL if the ring is
+ * empty. The frame remains valid until frame_ring_release() is called.
+ */
+dc1394video_frame_t *frame_ring_peek(frame_ring_t *ring);
+
+void frame_ring_release(frame_ring_t *ring);
+
+/**
+ * Consumer side. Returns the n'th oldest queued frame (0 is the same as
+ * frame_ring_peek()), or NULL if fewer than n+1 frames are queued. Lets the
+ * consumer work on several frames before releasing them in order.
+ */
+dc1394video_frame_t *frame_ring_peek_nth(frame_ring_t *ring, unsigned int n);
+
+/**
+ * Ring statistics; safe to call from either thread
+ */
+unsigned int frame_ring_get_depth(frame_ring_t *ring);
+unsigned int frame_ring_get_fill(frame_ring_t *ring);
+unsigned int frame_ring_get_high_water(frame_ring_t *ring);
+unsigned int frame_ring_get_overflows(frame_ring_t *ring);
+
+G_END_DECLS
+
+#endif
@@ -40,17 +40,157 @@
 #include "camera.h"
 #include "utils.h"
 #include "gtkutils.h"
+#include "export.h"
+#include "demosaic.h"
+#include "mono16.h"
+#include "yuv.h"
 
-#define IMG_FORMAT  "png"
+typedef enum {
+    SAVE_PNG,       /* converted to RGB, one image per frame */
+    SAVE_PGM,       /* MONO8/MONO16 or the raw Bayer mosaic, as is */
+    SAVE_PPM,       /* RGB8 as is, RAW8 debayered */
+    SAVE_NPY,       /* the whole selection as one array, as is */
+    SAVE_Y4M,       /* one uncompressed video stream, in order */
+    SAVE_AVI
+} save_format_t;
+
+static const char *save_format_names[] = { "png", "pgm", "ppm", "npy", "y4m", "avi" };
+
+// used when neither the index nor the metadata give the capture rate
+#define DEFAULT_FPS 30.0
+
+typedef struct __export_job
+{
+    dc1394video_frame_t frame;
+    dc1394video_frame_t scratch;        /* RGB8 frame for ppm */
+    uint64_t            n;
+    uint8_t             *out;           /* encoded video frame */
+    gboolean            queued;
+    gboolean            done;
+    gboolean            ok;
+} export_job_t;
+
+typedef struct __exporter
+{
+    char                *dir;
+    save_format_t       format;
+    show_mode_t         show;
+    GAsyncQueue         *free_jobs;     /* jobs not queued on the pool */
+    volatile gint       nfailed;
+    video_writer_t      *video;
+    GMutex              *lock;          /* guards job->done for video */
+    GCond               *cond;
+} exporter_t;
+
+/* Runs on the pool threads; converts and encodes one frame, then hands
+ * the job back to the reader */
+static void
+export_func(gpointer data, gpointer user_data)
+{
+    export_job_t *job = (export_job_t *)data;
+    exporter_t *exporter = (exporter_t *)user_data;
+    char *fname;
+    GdkPixbuf *pb = NULL;
+    gboolean ok = FALSE;
+
+    // video frames are encoded in any order but must be written in order,
+    // so the reader collects the job itself
+    if (exporter->video) {
+        ok = video_writer_encode(exporter->video, &(job->frame), &(job->scratch), job->out);
+        g_mutex_lock(exporter->lock);
+        job->ok = ok;
+        job->done = TRUE;
+        g_cond_broadcast(exporter->cond);
+        g_mutex_unlock(exporter->lock);
+        return;
+    }
+
+    fname = g_strdup_printf("%s/%" PRIu64 ".%s", exporter->dir, job->n, save_format_names[exporter->format]);
+
+    switch (exporter->format) {
+        case SAVE_PNG:
+            render_frame_to_pixbuf(&(job->frame), &pb, exporter->show);
+            ok = pb && gdk_pixbuf_save (pb, fname, "png", NULL, NULL);
+            if (pb)
+                g_object_unref(pb);
+            break;
+        case SAVE_PGM:
+            ok = export_frame_pgm(&(job->frame), fname);
+            break;
+        case SAVE_PPM:
+            ok = export_frame_ppm(&(job->frame), &(job->scratch), fname);
+            break;
+        default:
+            break;
+    }
+
+    if (!ok)
+        g_atomic_int_inc(&(exporter->nfailed));
+    g_free(fname);
+
+    g_async_queue_push(exporter->free_jobs, job);
+}
+
+/* Waits for a queued video job and appends its frame to the stream */
+static void
+write_video_job(exporter_t *exporter, export_job_t *job)
+{
+    if (!job->queued)
+        return;
+
+    g_mutex_lock(exporter->lock);
+    while (!job->done)
+        g_cond_wait(exporter->cond, exporter->lock);
+    g_mutex_unlock(exporter->lock);
+
+    if (!job->ok || !video_writer_write(exporter->video, job->out))
+        g_atomic_int_inc(&(exporter->nfailed));
+    job->queued = FALSE;
+}
+
+/* Frames per second from the index, else as measured at capture */
+static double
+recording_frame_rate(recording_t *rec)
+{
+    uint64_t nframes, first, last;
+    gchar *fps;
+    double rate = 0;
+
+    nframes = recording_get_n_frames(rec);
+    if (nframes > 1) {
+        first = recording_get_frame_timestamp(rec, 0);
+        last = recording_get_frame_timestamp(rec, nframes - 1);
+        if (last > first)
+            rate = (nframes - 1) * 1e6 / (last - first);
+    }
+    if (rate <= 0 && (fps = recording_get_metadata(rec, "capture.fps"))) {
+        rate = atof(fps);
+        g_free(fps);
+    }
+    return rate > 0 ? rate : DEFAULT_FPS;
+}
 
 int main( int argc, char *argv[])
 {
-    char                *filename, *dir;
-    FILE                *fp;
-    int                 i;
+    char                *filename, *dir, *format_name, *bayer_method, *window16;
+    dc1394bayer_method_t method;
+    recording_t         *rec;
+    const dc1394video_frame_t *format;
+    int                 i, nthreads, njobs, every;
+    uint64_t            n, next, last, nframes, count;
+    gint64              start_frame, end_frame;
+    double              start_time;
     long                total_frame_size;
-    dc1394video_frame_t frame;
+    dc1394video_frame_t skip = { 0 };
+    dc1394video_frame_t view = { 0 };
     show_mode_t         show;
+    save_format_t       save;
+    npy_writer_t        *npy_frames, *npy_timestamps;
+    exporter_t          exporter;
+    export_job_t        *jobs, *job;
+    GThreadPool         *pool;
+    GTimer              *timer;
+    FILE                *msg;
 
     /* Option parsing */
     GError              *error = NULL;
@@ -58,19 +198,36 @@ int main( int argc, char *argv[])
     GOptionEntry        entries[] =
     {
       { "input-filename", 'i', 0, G_OPTION_ARG_FILENAME, &filename, "Input filename", "FILE" },
-      { "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &dir, "Output dir", "PATH" },
+      { "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &dir, "Output dir, or file for y4m and avi (- for stdout)", "PATH" },
+      { "format", 'F', 0, G_OPTION_ARG_STRING, &format_name, "Image format: png, pgm, ppm, npy for frames.npy and timestamps.npy, or y4m or avi video", "png" },
+      GOPTION_ENTRY_SEEK_ARGUMENTS(&start_frame, &start_time),
+      { "end-frame", 'e', 0, G_OPTION_ARG_INT64, &end_frame, "Last frame", "100" },
+      { "every", 'n', 0, G_OPTION_ARG_INT, &every, "Save every Nth frame", "N" },
+      { "threads", 'j', 0, G_OPTION_ARG_INT, &nthreads, "Threads converting and encoding frames (default one per CPU)", "N" },
+      GOPTION_ENTRY_BAYER_METHOD(&bayer_method),
+      GOPTION_ENTRY_WINDOW(&window16),
       { NULL }
     };
 
     context = g_option_context_new("- Firefly MV Camera Playback");
     g_option_context_set_summary(context, 
             "Saves successive frames previously recorded\n"
-            "using dc1394-record to individual " IMG_FORMAT " image files");
+            "using dc1394-record to individual image files, or\n"
+            "to one NumPy array that can be memory mapped, or\n"
+            "to one uncompressed video file or pipe");
     g_option_context_add_main_entries (context, entries, NULL);
 
-    fp = NULL;
     filename = NULL;
     dir = NULL;
+    format_name = NULL;
+    bayer_method = NULL;
+    window16 = NULL;
+    method = DC1394_BAYER_METHOD_NEAREST;
+    start_frame = -1;
+    start_time = -1;
+    end_frame = -1;
+    every = 1;
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
 
     if (!g_option_context_parse (context, &argc, &argv, &error)) {
         printf( "Error: %s\n%s", 
@@ -83,60 +240,232 @@ int main( int argc, char *argv[])
                 g_option_context_get_help(context, TRUE, NULL));
         exit(2);
     }
-
-    if (filename[0] == '-') {
-        fp = stdin;
-    } else {
-        fp = fopen(filename, "rb");
+    for (save = SAVE_PNG; save <= SAVE_AVI; save++) {
+        if (format_name == NULL || strcmp(format_name, save_format_names[save]) == 0)
+            break;
     }
+    if (save > SAVE_AVI) {
+        printf( "Error: unknown format %s\n%s", format_name,
+                g_option_context_get_help(context, TRUE, NULL));
+        exit(2);
+    }
+    if (bayer_method && !demosaic_method_from_string(bayer_method, &method))
+        app_exit(2, context, "Error: Unknown Bayer method");
+    demosaic_set_method(method);
+    if (window16 && !mono16_set_window_from_string(window16))
+        app_exit(2, context, "Error: Invalid window");
+    if (every < 1 || nthreads < 1) {
+        printf( "Error: every and threads must be at least 1\n%s", 
+                g_option_context_get_help(context, TRUE, NULL));
+        exit(2);
+    }
+
+    // keep stdout clean when the video goes there
+    msg = (save >= SAVE_Y4M && strcmp(dir, "-") == 0) ? stderr : stdout;
 
-    if( fp == NULL ) { 
-        perror("opening file");
+    // also picks up any further segments, FILE.001, FILE.002...
+    rec = recording_open(filename);
+    if (rec == NULL) {
+        fprintf(msg, "Error: could not read recording %s\n", filename);
         exit(1);
     }
 
-    // read the first frame
-    total_frame_size = read_frame( &frame, fp);
-    if (frame.color_coding == DC1394_COLOR_CODING_MONO8)
+    // geometry and color coding from the file header. Only png converts
+    // colors, the other formats store the samples as they were recorded
+    format = recording_get_format(rec);
+    show = GRAY;
+    if (format->color_coding == DC1394_COLOR_CODING_MONO8)
         show = GRAY;
-    else if (frame.color_coding == DC1394_COLOR_CODING_RGB8)
+    else if (format->color_coding == DC1394_COLOR_CODING_MONO16)
+        show = GRAY16;
+    else if (format->color_coding == DC1394_COLOR_CODING_RGB8 || yuv_coding_supported(format->color_coding))
         show = COLOR;
-    else if (frame.color_coding == DC1394_COLOR_CODING_RAW8)
+    else if (format->color_coding == DC1394_COLOR_CODING_RAW8)
         show = FORMAT7;
-    else {
+    else if (save == SAVE_PNG) {
         perror("invalid color coding");
         exit(1);
     }
 
+    if ((save == SAVE_PGM && export_bytes_per_pixel(format) != 1 && export_bytes_per_pixel(format) != 2) ||
+        (save == SAVE_PPM && format->color_coding != DC1394_COLOR_CODING_RGB8 && format->color_coding != DC1394_COLOR_CODING_RAW8 &&
+                             !yuv_coding_supported(format->color_coding)) ||
+        (save == SAVE_NPY && export_bytes_per_pixel(format) == 0) ||
+        (save >= SAVE_Y4M && format->color_coding != DC1394_COLOR_CODING_MONO8 &&
+                             format->color_coding != DC1394_COLOR_CODING_MONO16 &&
+                             format->color_coding != DC1394_COLOR_CODING_RGB8 &&
+                             format->color_coding != DC1394_COLOR_CODING_RAW8 &&
+                             !yuv_coding_supported(format->color_coding))) {
+        fprintf(msg, "Error: the color coding of this recording cannot be saved as %s\n", save_format_names[save]);
+        exit(1);
+    }
+
+    if (!g_thread_supported())
+        g_thread_init(NULL);
     g_type_init();
     gdk_rgb_init();
 
-    /* go back to start of file */
-    i = 0;
-    fseek(fp, 0, SEEK_SET);
-    while (!feof(fp)) 
-    {
+    if (!recording_seek_from_command_line(rec, start_frame, start_time, &n)) {
+        fprintf(msg, "Error: could not seek to the requested frame\n");
+        exit(1);
+    }
+    last = end_frame >= 0 ? (uint64_t)end_frame : G_MAXUINT64;
+    if (last < n) {
+        fprintf(msg, "Error: the end frame is before the start frame (%" PRIu64 ")\n", n);
+        exit(1);
+    }
+
+    // this thread reads frames, in order, into a fixed set of jobs which the
+    // pool threads convert and save in any order. Two jobs per thread keep
+    // them busy while the next frames are read.
+    exporter.dir = dir;
+    exporter.format = save;
+    exporter.show = show;
+    exporter.nfailed = 0;
+    exporter.free_jobs = g_async_queue_new();
+    exporter.video = NULL;
+    exporter.lock = g_mutex_new();
+    exporter.cond = g_cond_new();
+    njobs = nthreads * 2;
+    jobs = g_new0(export_job_t, njobs);
+    for (i = 0; i < njobs; i++)
+        g_async_queue_push(exporter.free_jobs, &(jobs[i]));
+    pool = g_thread_pool_new(export_func, &exporter, nthreads, TRUE, NULL);
+
+    // one array of frames and one of their timestamps, written in order
+    npy_frames = npy_timestamps = NULL;
+    if (save == SAVE_NPY) {
         char *fname;
-        GdkPixbuf *pb;
 
-        if (frame.image) {
-            free(frame.image);
-            frame.image = NULL;
+        fname = g_strdup_printf("%s/frames.npy", dir);
+        npy_frames = npy_writer_open_frames(fname, format);
+        g_free(fname);
+        fname = g_strdup_printf("%s/timestamps.npy", dir);
+        npy_timestamps = npy_writer_open(fname, "<u8", NULL, 0);
+        g_free(fname);
+
+        if (npy_frames == NULL || npy_timestamps == NULL) {
+            fprintf(msg, "Error: could not create the arrays in %s\n", dir);
+            exit(1);
         }
+    }
+
+    // one video stream; the rate is that of the capture, thinned by every.
+    // Its frame count is only known up front with the index, which a piped
+    // avi needs
+    if (save >= SAVE_Y4M) {
+        nframes = recording_get_n_frames(rec);
+        count = 0;
+        if (nframes && n < nframes)
+            count = ((MIN(last, nframes - 1) - n) / every) + 1;
 
-        read_frame(&frame, fp);
-        render_frame_to_pixbuf(&frame, &pb, show);
+        exporter.video = video_writer_open(dir, save == SAVE_Y4M ? VIDEO_Y4M : VIDEO_AVI, format,
+                                           recording_frame_rate(rec) / every, count);
+        if (exporter.video == NULL) {
+            fprintf(msg, "Error: could not write %s%s\n", dir,
+                    save == SAVE_AVI && count == 0 ? " (piping avi needs a recording with an index)" : "");
+            exit(1);
+        }
+        for (i = 0; i < njobs; i++)
+            jobs[i].out = g_malloc(video_writer_get_frame_bytes(exporter.video));
+    }
 
-        fname = g_strdup_printf("%s/%u.%s", dir, i, IMG_FORMAT);
-        gdk_pixbuf_save (pb, fname, IMG_FORMAT, NULL, NULL);
-        g_object_unref(pb);
-        free(fname);
+    recording_set_access(rec, every > 1 ? RECORDING_ACCESS_RANDOM : RECORDING_ACCESS_SEQUENTIAL);
 
+    timer = g_timer_new();
+    i = 0;
+    total_frame_size = 0;
+    for (next = n; n <= last; n += every)
+    {
+        // skip to the next frame to save; with the index this is a seek,
+        // otherwise (e.g. from a pipe) read past the frames in between
+        if (n != next && !recording_seek_frame(rec, n)) {
+            while (next < n && recording_read_frame_view(rec, &skip) > 0)
+                next++;
+            if (next < n)
+                break;
+        }
+
+        // arrays are appended to straight from the mapped file
+        if (npy_frames) {
+            uint8_t ts[8];
+            int b;
+
+            if (recording_read_frame_view(rec, &view) <= 0)
+                break;
+            next = n + 1;
+
+            for (b = 0; b < 8; b++)
+                ts[b] = view.timestamp >> (8 * b);
+            if (!npy_writer_append_frame(npy_frames, &view) ||
+                !npy_writer_append(npy_timestamps, ts)) {
+                g_atomic_int_inc(&(exporter.nfailed));
+                break;
+            }
+
+            total_frame_size = view.total_bytes;
+            i++;
+            continue;
+        }
+
+        // frames are copied into the job (from the mapped file, without a
+        // syscall) as the reader moves on before the job is done. Video
+        // jobs are used round robin, so the next one is also the oldest
+        // and is written out before it is reused
+        if (exporter.video) {
+            job = &(jobs[i % njobs]);
+            write_video_job(&exporter, job);
+        } else {
+            job = (export_job_t *)g_async_queue_pop(exporter.free_jobs);
+        }
+        if (recording_read_frame(rec, &(job->frame)) <= 0) {
+            if (!exporter.video)
+                g_async_queue_push(exporter.free_jobs, job);
+            break;
+        }
+        next = n + 1;
+
+        total_frame_size = job->frame.total_bytes;
+        job->n = n;
+        job->done = FALSE;
+        job->queued = TRUE;
+        g_thread_pool_push(pool, job, NULL);
         i++;
     }
-    printf("Wrote %d frames (%ld)\n", i, total_frame_size);
 
-    fclose(fp);
+    // write the remaining video frames, oldest first
+    if (exporter.video) {
+        int j;
+
+        for (j = 0; j < njobs; j++)
+            write_video_job(&exporter, &(jobs[(i + j) % njobs]));
+        if (!video_writer_close(exporter.video))
+            g_atomic_int_inc(&(exporter.nfailed));
+    }
+
+    // wait for the pool to finish
+    g_thread_pool_free(pool, FALSE, TRUE);
+    if (npy_frames && !npy_writer_close(npy_frames))
+        g_atomic_int_inc(&(exporter.nfailed));
+    if (npy_timestamps && !npy_writer_close(npy_timestamps))
+        g_atomic_int_inc(&(exporter.nfailed));
+    fprintf(msg, "Wrote %d frames (%ld) in %.1fs using %d threads\n",
+            i - g_atomic_int_get(&(exporter.nfailed)), total_frame_size,
+            g_timer_elapsed(timer, NULL), nthreads);
+    if (g_atomic_int_get(&(exporter.nfailed)))
+        fprintf(msg, "Error: could not save %d frames\n", g_atomic_int_get(&(exporter.nfailed)));
+
+    for (i = 0; i < njobs; i++) {
+        free(jobs[i].frame.image);
+        free(jobs[i].scratch.image);
+        g_free(jobs[i].out);
+    }
+    g_free(jobs);
+    g_async_queue_unref(exporter.free_jobs);
+    g_mutex_free(exporter.lock);
+    g_cond_free(exporter.cond);
+    g_timer_destroy(timer);
+    recording_close(rec);
 
-    return 0;
+    return exporter.nfailed ? 1 : 0;
 }
@@ -32,6 +32,7 @@
 #include "camera.h"
 #include "utils.h"
 #include "gtkutils.h"
+#include "mono16.h"
 
 static show_mode_t show;
 
@@ -56,6 +57,9 @@ int main(int argc, char *argv[])
     unsigned int width, height;
     GtkWidget *window, *canvas;
     char *format = NULL;
+    char *window16 = NULL;
+    char *video_mode_name = NULL;
+    dc1394video_mode_t video_mode;
 
     guint64 guid;
 
@@ -65,7 +69,9 @@ int main(int argc, char *argv[])
     GOptionEntry entries[] =
     {
       GOPTION_ENTRY_FORMAT(&format),
+      GOPTION_ENTRY_VIDEO_MODE(&video_mode_name),
       GOPTION_ENTRY_GUID(&guid),
+      GOPTION_ENTRY_WINDOW(&window16),
       { NULL }
     };
 
@@ -85,15 +91,20 @@ int main(int argc, char *argv[])
     }
     if (format && format[0])
         show = format[0];
+    if (window16 && !mono16_set_window_from_string(window16))
+        app_exit(1, context, "Error: Invalid window");
+    if (video_mode_name && !video_mode_from_string(video_mode_name, &video_mode))
+        app_exit(1, context, "Error: Unknown video mode");
 
     switch (show) {
         case GRAY:
+        case GRAY16:
         case COLOR:
         case FORMAT7:
             printf("Selected mode: %c\n", show);
             break;
         default:
-            printf("Invalid mode\nUsage:\n\t%s [g|c|7]\n",argv[0]);
+            printf("Invalid mode\nUsage:\n\t%s [g|G|c|7]\n",argv[0]);
             return 1;
     }
     
@@ -107,18 +118,10 @@ int main(int argc, char *argv[])
 
     gtk_init( &argc, &argv );
 
-    // setup capture
-    switch (show) {
-        case GRAY:
-        case COLOR:
-            dc1394_get_image_size_from_video_mode(camera, DC1394_VIDEO_MODE_640x480_MONO8, &width, &height);
-            err=setup_gray_capture(camera, DC1394_VIDEO_MODE_640x480_MONO8);
-            break;
-        case FORMAT7:
-            dc1394_get_image_size_from_video_mode(camera, DC1394_VIDEO_MODE_FORMAT7_0, &width, &height);
-            err=setup_color_capture(camera, DC1394_VIDEO_MODE_FORMAT7_0, DC1394_COLOR_CODING_RAW8);
-            break;
-    }
+    // setup capture, in the mode for the format unless one was given
+    if (!video_mode_name)
+        video_mode = video_mode_for_show(camera, show);
+    err=setup_video_mode_capture(camera, video_mode, &show, &width, &height);
     DC1394_ERR_CLN_RTN(err,cleanup_and_exit(camera),"Could not setup camera");
 
     // have the camera start sending us data
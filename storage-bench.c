@@ -0,0 +1,168 @@
+/*
+ * Compare the recording storage backends
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *    Writes the same synthetic recording through each storage backend
+ *    and reports throughput and the worst single frame write. No camera
+ *    is needed; point it at the disk (or tmpfs) you record to.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+#include "utils.h"
+#include "storage.h"
+
+static double
+now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec * 1000.0) + (tv.tv_usec / 1000.0);
+}
+
+static gboolean
+run_backend(storage_backend_t backend, const char *filename, dc1394video_frame_t *frame, int nframes)
+{
+    storage_t *out;
+    storage_backend_t used;
+    recording_t *rec;
+    double start, t, worst, elapsed;
+    int i;
+
+    out = storage_open(filename, backend);
+    if (out == NULL) {
+        perror(filename);
+        return FALSE;
+    }
+
+    used = storage_get_backend(out);
+    rec = recording_open_write_storage(out, frame);
+    if (rec == NULL) {
+        storage_close(out);
+        return FALSE;
+    }
+
+    worst = 0;
+    start = now_ms();
+    for (i = 0; i < nframes; i++) {
+        frame->timestamp = i;
+        frame->image[0] = (unsigned char)i;
+
+        t = now_ms();
+        if (recording_write_frame(rec, frame) < 0) {
+            printf("%-8s write failed at frame %d\n", storage_backend_to_string(backend), i);
+            break;
+        }
+        worst = MAX(worst, now_ms() - t);
+    }
+    recording_close(rec);
+    if (!storage_close(out))
+        printf("%-8s close failed\n", storage_backend_to_string(backend));
+    elapsed = now_ms() - start;
+
+    printf("%-8s (%s) %8.1f MB/s, %7.1f fps, worst frame %6.2f ms\n",
+            storage_backend_to_string(backend),
+            storage_backend_to_string(used),
+            ((double)nframes * frame->total_bytes / (1 << 20)) / (elapsed / 1000.0),
+            nframes / (elapsed / 1000.0),
+            worst);
+
+    unlink(filename);
+    return TRUE;
+}
+
+int main(int argc, char **argv)
+{
+    dc1394video_frame_t frame = { 0 };
+    storage_backend_t b;
+    char *filename;
+    char *backend;
+    int nframes, width, height, i;
+
+    /* Option parsing */
+    GError *error = NULL;
+    GOptionContext *context;
+    GOptionEntry entries[] =
+    {
+      { "output-filename", 'o', 0, G_OPTION_ARG_FILENAME, &filename, "Scratch file to write (deleted afterwards)", "FILE" },
+      { "backend", 'b', 0, G_OPTION_ARG_STRING, &backend, "Only test this backend: " STORAGE_BACKEND_NAMES, NULL },
+      { "frames", 'n', 0, G_OPTION_ARG_INT, &nframes, "Frames to write", "2000" },
+      { "width", 'W', 0, G_OPTION_ARG_INT, &width, "Frame width", "640" },
+      { "height", 'H', 0, G_OPTION_ARG_INT, &height, "Frame height", "480" },
+      { NULL }
+    };
+
+    context = g_option_context_new("- Storage Backend Benchmark");
+    g_option_context_set_summary(context,
+            "Writes a synthetic recording through each\n"
+            "storage backend used by dc1394-record");
+    g_option_context_add_main_entries (context, entries, NULL);
+
+    /* Defaults */
+    filename = NULL;
+    backend = NULL;
+    nframes = 2000;
+    width = 640;
+    height = 480;
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        printf( "Error: %s\n%s",
+                error->message,
+                g_option_context_get_help(context, TRUE, NULL));
+        exit(1);
+    }
+    if (filename == NULL)
+        app_exit(2, context, "Error: You must supply a filename");
+    if (nframes <= 0 || width <= 0 || height <= 0)
+        app_exit(3, context, "Error: Frames and geometry must be positive");
+    if (backend && !storage_backend_from_string(backend, &b))
+        app_exit(3, context, "Error: Unknown storage backend");
+
+    frame.size[0] = width;
+    frame.size[1] = height;
+    frame.stride = width;
+    frame.color_coding = DC1394_COLOR_CODING_MONO8;
+    frame.video_mode = DC1394_VIDEO_MODE_640x480_MONO8;
+    frame.data_depth = 8;
+    frame.image_bytes = frame.total_bytes = (uint64_t)width * height;
+    frame.image = g_malloc(frame.total_bytes);
+    for (i = 0; i < frame.total_bytes; i++)
+        frame.image[i] = (unsigned char)(i * 7);
+
+    printf("%d frames of %dx%d to %s\n", nframes, width, height, filename);
+
+    if (backend) {
+        run_backend(b, filename, &frame, nframes);
+    } else {
+        run_backend(STORAGE_STDIO, filename, &frame, nframes);
+        run_backend(STORAGE_DIRECT, filename, &frame, nframes);
+        run_backend(STORAGE_URING, filename, &frame, nframes);
+    }
+
+    g_free(frame.image);
+    return 0;
+}
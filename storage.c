@@ -0,0 +1,503 @@
+/*
+ * Storage backends for writing recordings to disk
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *    The direct backends copy writes into CHUNK_BYTES sized, page aligned
+ *    buffers and hand whole chunks to the kernel with O_DIRECT, so recorded
+ *    frames never pass through (and evict) the page cache. The io_uring
+ *    backend cycles through QUEUE_DEPTH such buffers, keeping the previous
+ *    chunks in flight while the next one is filled.
+ *
+ *    Streams that turn out to be pipes or sockets bypass stdio: small
+ *    writes are collected in a staging buffer and sent together with the
+ *    next large one in a single writev(), straight from the caller's
+ *    memory.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "storage.h"
+
+#define ALIGN_BYTES     4096
+#define CHUNK_BYTES     (4 << 20)
+#define QUEUE_DEPTH     4
+#define PIPE_STAGE_BYTES    (64 << 10)
+#define PIPE_BYTES          (1 << 20)
+#define MAX_IOV         8
+
+struct __storage
+{
+    storage_backend_t   backend;
+    gboolean            failed;
+    uint64_t            written;
+
+    /* stdio */
+    FILE                *fp;
+    gboolean            owns_fp;
+
+    /* pipes and sockets, written with writev on the stream's fd */
+    gboolean            is_pipe;
+    uint8_t             *stage;
+    size_t              staged;
+
+    /* direct and uring */
+    int                 fd;
+    uint64_t            flushed;        /* file offset of the current chunk */
+    uint8_t             *bufs[QUEUE_DEPTH];
+    int                 nbufs;
+    int                 cur;
+    size_t              fill;
+
+#ifdef HAVE_LIBURING
+    struct io_uring     ring;
+    gboolean            busy[QUEUE_DEPTH];
+    size_t              busy_bytes[QUEUE_DEPTH];
+    uint64_t            busy_offset[QUEUE_DEPTH];
+#endif
+};
+
+static const char *backend_names[] = { "stdio", "direct", "uring" };
+
+gboolean storage_backend_from_string(const char *name, storage_backend_t *backend)
+{
+    int i;
+
+    g_return_val_if_fail(name != NULL, FALSE);
+
+    for (i = 0; i < G_N_ELEMENTS(backend_names); i++) {
+        if (strcmp(name, backend_names[i]) == 0) {
+            *backend = (storage_backend_t)i;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+const char *storage_backend_to_string(storage_backend_t backend)
+{
+    if (backend < G_N_ELEMENTS(backend_names))
+        return backend_names[backend];
+    return "unknown";
+}
+
+static gboolean
+pwrite_all(int fd, const uint8_t *buf, size_t nbytes, uint64_t offset)
+{
+    ssize_t n;
+
+    while (nbytes > 0) {
+        n = pwrite(fd, buf, nbytes, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        buf += n;
+        nbytes -= n;
+        offset += n;
+    }
+    return TRUE;
+}
+
+static gboolean
+writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t n;
+
+    while (iovcnt > 0) {
+        n = writev(fd, iov, iovcnt);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+
+        /* skip what was written, a pipe can take part of a large write */
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean
+pipe_writev(storage_t *st, const struct iovec *iov, int iovcnt, size_t total)
+{
+    struct iovec vec[MAX_IOV + 1];
+    gboolean ok;
+    int i, n;
+
+    if (st->staged + total <= PIPE_STAGE_BYTES) {
+        for (i = 0; i < iovcnt; i++) {
+            memcpy(st->stage + st->staged, iov[i].iov_base, iov[i].iov_len);
+            st->staged += iov[i].iov_len;
+        }
+        return TRUE;
+    }
+
+    n = 0;
+    if (st->staged) {
+        vec[n].iov_base = st->stage;
+        vec[n].iov_len = st->staged;
+        n++;
+    }
+    for (i = 0; i < iovcnt; i++)
+        vec[n++] = iov[i];
+
+    ok = writev_all(fileno(st->fp), vec, n);
+    st->staged = 0;
+    return ok;
+}
+
+static gboolean
+pipe_flush(storage_t *st)
+{
+    struct iovec vec;
+
+    if (st->staged == 0)
+        return TRUE;
+
+    vec.iov_base = st->stage;
+    vec.iov_len = st->staged;
+    st->staged = 0;
+    return writev_all(fileno(st->fp), &vec, 1);
+}
+
+#ifdef HAVE_LIBURING
+/* Waits for one write to complete; a short write is finished synchronously */
+static gboolean
+uring_reap(storage_t *st)
+{
+    struct io_uring_cqe *cqe;
+    int slot, res;
+
+    if (io_uring_wait_cqe(&st->ring, &cqe) < 0)
+        return FALSE;
+
+    slot = (int)(intptr_t)io_uring_cqe_get_data(cqe);
+    res = cqe->res;
+    io_uring_cqe_seen(&st->ring, cqe);
+
+    st->busy[slot] = FALSE;
+    if (res < 0)
+        return FALSE;
+    if ((size_t)res < st->busy_bytes[slot])
+        return pwrite_all(st->fd, st->bufs[slot] + res,
+                st->busy_bytes[slot] - res, st->busy_offset[slot] + res);
+    return TRUE;
+}
+
+static gboolean
+uring_submit(storage_t *st, size_t nbytes)
+{
+    struct io_uring_sqe *sqe;
+    int slot = st->cur;
+
+    sqe = io_uring_get_sqe(&st->ring);
+    if (sqe == NULL)
+        return FALSE;
+
+    io_uring_prep_write(sqe, st->fd, st->bufs[slot], nbytes, st->flushed);
+    io_uring_sqe_set_data(sqe, (void *)(intptr_t)slot);
+    st->busy[slot] = TRUE;
+    st->busy_bytes[slot] = nbytes;
+    st->busy_offset[slot] = st->flushed;
+
+    if (io_uring_submit(&st->ring) < 0) {
+        st->busy[slot] = FALSE;
+        return FALSE;
+    }
+
+    /* move on to the next buffer, waiting for its previous write if
+     * the kernel has not finished with it yet */
+    st->cur = (st->cur + 1) % st->nbufs;
+    while (st->busy[st->cur]) {
+        if (!uring_reap(st))
+            return FALSE;
+    }
+    return TRUE;
+}
+#endif
+
+/* Hands the current chunk, padded to the alignment, to the kernel */
+static gboolean
+flush_chunk(storage_t *st)
+{
+    size_t nbytes;
+    gboolean ok;
+
+    if (st->fill == 0)
+        return TRUE;
+
+    nbytes = (st->fill + ALIGN_BYTES - 1) & ~((size_t)ALIGN_BYTES - 1);
+    memset(st->bufs[st->cur] + st->fill, 0, nbytes - st->fill);
+
+#ifdef HAVE_LIBURING
+    if (st->backend == STORAGE_URING)
+        ok = uring_submit(st, nbytes);
+    else
+#endif
+        ok = pwrite_all(st->fd, st->bufs[st->cur], nbytes, st->flushed);
+
+    st->flushed += nbytes;
+    st->fill = 0;
+    return ok;
+}
+
+storage_t *storage_new_from_fp(FILE *fp)
+{
+    storage_t *st;
+    struct stat sb;
+
+    g_return_val_if_fail(fp != NULL, NULL);
+
+    st = g_new0(storage_t, 1);
+    st->backend = STORAGE_STDIO;
+    st->fp = fp;
+    st->fd = -1;
+
+    if (fstat(fileno(fp), &sb) == 0 && (S_ISFIFO(sb.st_mode) || S_ISSOCK(sb.st_mode))) {
+        /* anything already buffered must go out first */
+        fflush(fp);
+        st->is_pipe = TRUE;
+        st->stage = g_malloc(PIPE_STAGE_BYTES);
+#ifdef F_SETPIPE_SZ
+        /* fewer, larger wakeups of the reader; not fatal if refused */
+        if (S_ISFIFO(sb.st_mode))
+            fcntl(fileno(fp), F_SETPIPE_SZ, PIPE_BYTES);
+#endif
+    }
+
+    return st;
+}
+
+storage_t *storage_open(const char *filename, storage_backend_t backend)
+{
+    storage_t *st;
+    FILE *fp;
+    int i, fd;
+
+    g_return_val_if_fail(filename != NULL, NULL);
+
+#ifndef HAVE_LIBURING
+    if (backend == STORAGE_URING)
+        backend = STORAGE_DIRECT;
+#endif
+
+    if (backend == STORAGE_STDIO) {
+        fp = fopen(filename, "wb+");
+        if (fp == NULL)
+            return NULL;
+        st = storage_new_from_fp(fp);
+        st->owns_fp = TRUE;
+        return st;
+    }
+
+    /* filesystems without O_DIRECT (e.g. older tmpfs) refuse the open;
+     * the chunked writes are kept, they just go via the page cache */
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL)
+        fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL;
+
+    st = g_new0(storage_t, 1);
+    st->backend = backend;
+    st->fd = fd;
+    st->nbufs = 1;
+
+#ifdef HAVE_LIBURING
+    if (backend == STORAGE_URING) {
+        if (io_uring_queue_init(QUEUE_DEPTH, &st->ring, 0) == 0)
+            st->nbufs = QUEUE_DEPTH;
+        else
+            st->backend = STORAGE_DIRECT;
+    }
+#endif
+
+    for (i = 0; i < st->nbufs; i++) {
+        if (posix_memalign((void **)&(st->bufs[i]), ALIGN_BYTES, CHUNK_BYTES) != 0) {
+            st->failed = TRUE;
+            storage_close(st);
+            unlink(filename);
+            return NULL;
+        }
+    }
+
+    return st;
+}
+
+gboolean storage_preallocate(storage_t *st, uint64_t bytes)
+{
+    int err;
+
+    g_return_val_if_fail(st != NULL, FALSE);
+
+    if (bytes == 0)
+        return TRUE;
+
+    /* posix_fallocate() falls back to writing every block when the
+     * filesystem cannot reserve them, which would stall the writer for as
+     * long as the whole segment takes to write. KEEP_SIZE leaves the file
+     * length at what has been written, so a crashed recording still ends
+     * in its last frame rather than in zeros. */
+    err = fallocate(st->fp ? fileno(st->fp) : st->fd, FALLOC_FL_KEEP_SIZE, 0, bytes);
+    if (err != 0 && errno != EOPNOTSUPP && errno != ENOSYS && errno != EINVAL && errno != ESPIPE)
+        return FALSE;
+    return TRUE;
+}
+
+static gboolean
+chunk_write(storage_t *st, const uint8_t *p, size_t nbytes)
+{
+    size_t n;
+
+    while (nbytes > 0) {
+        n = MIN(nbytes, CHUNK_BYTES - st->fill);
+        memcpy(st->bufs[st->cur] + st->fill, p, n);
+        st->fill += n;
+        p += n;
+        nbytes -= n;
+        if (st->fill == CHUNK_BYTES && !flush_chunk(st))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean storage_write(storage_t *st, const void *buf, size_t nbytes)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len = nbytes;
+    return storage_writev(st, &iov, 1);
+}
+
+gboolean storage_writev(storage_t *st, const struct iovec *iov, int iovcnt)
+{
+    size_t total;
+    gboolean ok;
+    int i;
+
+    g_return_val_if_fail(st != NULL, FALSE);
+    g_return_val_if_fail(iovcnt <= MAX_IOV, FALSE);
+
+    if (st->failed)
+        return FALSE;
+
+    total = 0;
+    for (i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    ok = TRUE;
+    if (st->is_pipe) {
+        ok = pipe_writev(st, iov, iovcnt, total);
+    } else if (st->fp) {
+        for (i = 0; ok && i < iovcnt; i++)
+            ok = fwrite(iov[i].iov_base, 1, iov[i].iov_len, st->fp) == iov[i].iov_len;
+    } else {
+        for (i = 0; ok && i < iovcnt; i++)
+            ok = chunk_write(st, iov[i].iov_base, iov[i].iov_len);
+    }
+
+    if (ok)
+        st->written += total;
+    else
+        st->failed = TRUE;
+    return ok;
+}
+
+gboolean storage_close(storage_t *st)
+{
+    gboolean ok;
+    int i;
+
+    if (st == NULL)
+        return FALSE;
+
+    if (st->is_pipe) {
+        if (!st->failed && !pipe_flush(st))
+            st->failed = TRUE;
+        g_free(st->stage);
+    } else if (st->fp) {
+        if (fflush(st->fp) != 0)
+            st->failed = TRUE;
+        if (st->owns_fp) {
+            /* release reserved blocks past the end that were not used */
+            if (ftruncate(fileno(st->fp), st->written) != 0)
+                st->failed = TRUE;
+            fclose(st->fp);
+        }
+    } else if (st->fd >= 0) {
+        if (!st->failed && !flush_chunk(st))
+            st->failed = TRUE;
+#ifdef HAVE_LIBURING
+        if (st->nbufs > 1) {
+            for (i = 0; i < st->nbufs; i++) {
+                while (st->busy[i]) {
+                    if (!uring_reap(st)) {
+                        st->failed = TRUE;
+                        st->busy[i] = FALSE;
+                    }
+                }
+            }
+            io_uring_queue_exit(&st->ring);
+        }
+#endif
+        /* the last chunk was padded to the alignment */
+        if (ftruncate(st->fd, st->written) != 0)
+            st->failed = TRUE;
+        close(st->fd);
+    }
+
+    for (i = 0; i < st->nbufs; i++)
+        free(st->bufs[i]);
+
+    ok = !st->failed;
+    g_free(st);
+    return ok;
+}
+
+storage_backend_t storage_get_backend(storage_t *st)
+{
+    return st->backend;
+}
+
+uint64_t storage_get_written(storage_t *st)
+{
+    return st->written;
+}
@@ -0,0 +1,100 @@
+/*
+ * Storage backends for writing recordings to disk
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    STORAGE_STDIO = 0,      /* buffered stdio, works everywhere */
+    STORAGE_DIRECT,         /* O_DIRECT, bypasses the page cache */
+    STORAGE_URING           /* O_DIRECT with several writes in flight via io_uring */
+} storage_backend_t;
+
+#define STORAGE_BACKEND_NAMES "stdio, direct, uring"
+
+/**
+ * An append-only output file. Direct backends collect writes into large
+ * aligned chunks; the file is trimmed to the bytes actually written when
+ * it is closed.
+ */
+typedef struct __storage storage_t;
+
+/**
+ * Parses a backend name (see STORAGE_BACKEND_NAMES). Returns FALSE if the
+ * name is not recognised.
+ */
+gboolean storage_backend_from_string(const char *name, storage_backend_t *backend);
+
+const char *storage_backend_to_string(storage_backend_t backend);
+
+/**
+ * Creates (truncating) filename using the given backend. If the backend is
+ * unavailable (io_uring not compiled in or not supported by the kernel,
+ * O_DIRECT not supported by the filesystem) the next simpler one is used;
+ * see storage_get_backend().
+ */
+storage_t *storage_open(const char *filename, storage_backend_t backend);
+
+/**
+ * Wraps an already open stream, such as stdout, using the stdio backend.
+ * If the stream is a pipe or socket stdio is bypassed and writes go out
+ * with writev() directly from the caller's buffers. storage_close()
+ * flushes but does not close the stream.
+ */
+storage_t *storage_new_from_fp(FILE *fp);
+
+/**
+ * Reserves bytes of disk for the file up front so it is not fragmented and
+ * running out of space shows up here rather than part way through a frame.
+ * The file length is not changed. Filesystems that cannot reserve space
+ * without writing it are skipped, which is not an error.
+ */
+gboolean storage_preallocate(storage_t *st, uint64_t bytes);
+
+gboolean storage_write(storage_t *st, const void *buf, size_t nbytes);
+
+/**
+ * Writes up to 8 buffers in order; on pipes they are sent in one system
+ * call, e.g. a frame header together with its image
+ */
+gboolean storage_writev(storage_t *st, const struct iovec *iov, int iovcnt);
+
+/**
+ * Writes out anything still buffered, trims the file to the bytes written
+ * and frees st. Returns FALSE if any write failed.
+ */
+gboolean storage_close(storage_t *st);
+
+storage_backend_t storage_get_backend(storage_t *st);
+
+uint64_t storage_get_written(storage_t *st);
+
+G_END_DECLS
+
+#endif
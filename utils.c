@@ -22,8 +22,14 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "utils.h"
+#include "codec.h"
 
 #ifndef CLAMP
 #define CLAMP(x, low, high)  (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
@@ -106,6 +112,154 @@ dc1394error_t setup_gray_capture(
     return DC1394_SUCCESS;
 }
 
+static const struct {
+    const char          *name;
+    dc1394video_mode_t  mode;
+} video_mode_names[] = {
+    { "160x120_yuv444",     DC1394_VIDEO_MODE_160x120_YUV444 },
+    { "320x240_yuv422",     DC1394_VIDEO_MODE_320x240_YUV422 },
+    { "640x480_yuv411",     DC1394_VIDEO_MODE_640x480_YUV411 },
+    { "640x480_yuv422",     DC1394_VIDEO_MODE_640x480_YUV422 },
+    { "640x480_rgb8",       DC1394_VIDEO_MODE_640x480_RGB8 },
+    { "640x480_mono8",      DC1394_VIDEO_MODE_640x480_MONO8 },
+    { "640x480_mono16",     DC1394_VIDEO_MODE_640x480_MONO16 },
+    { "800x600_yuv422",     DC1394_VIDEO_MODE_800x600_YUV422 },
+    { "800x600_rgb8",       DC1394_VIDEO_MODE_800x600_RGB8 },
+    { "800x600_mono8",      DC1394_VIDEO_MODE_800x600_MONO8 },
+    { "800x600_mono16",     DC1394_VIDEO_MODE_800x600_MONO16 },
+    { "1024x768_yuv422",    DC1394_VIDEO_MODE_1024x768_YUV422 },
+    { "1024x768_rgb8",      DC1394_VIDEO_MODE_1024x768_RGB8 },
+    { "1024x768_mono8",     DC1394_VIDEO_MODE_1024x768_MONO8 },
+    { "1024x768_mono16",    DC1394_VIDEO_MODE_1024x768_MONO16 },
+    { "1280x960_yuv422",    DC1394_VIDEO_MODE_1280x960_YUV422 },
+    { "1280x960_rgb8",      DC1394_VIDEO_MODE_1280x960_RGB8 },
+    { "1280x960_mono8",     DC1394_VIDEO_MODE_1280x960_MONO8 },
+    { "1280x960_mono16",    DC1394_VIDEO_MODE_1280x960_MONO16 },
+    { "1600x1200_yuv422",   DC1394_VIDEO_MODE_1600x1200_YUV422 },
+    { "1600x1200_rgb8",     DC1394_VIDEO_MODE_1600x1200_RGB8 },
+    { "1600x1200_mono8",    DC1394_VIDEO_MODE_1600x1200_MONO8 },
+    { "1600x1200_mono16",   DC1394_VIDEO_MODE_1600x1200_MONO16 },
+    { "format7_0",          DC1394_VIDEO_MODE_FORMAT7_0 },
+    { "format7_1",          DC1394_VIDEO_MODE_FORMAT7_1 },
+    { "format7_2",          DC1394_VIDEO_MODE_FORMAT7_2 },
+    { "format7_3",          DC1394_VIDEO_MODE_FORMAT7_3 },
+    { "format7_4",          DC1394_VIDEO_MODE_FORMAT7_4 },
+    { "format7_5",          DC1394_VIDEO_MODE_FORMAT7_5 },
+    { "format7_6",          DC1394_VIDEO_MODE_FORMAT7_6 },
+    { "format7_7",          DC1394_VIDEO_MODE_FORMAT7_7 }
+};
+
+gboolean video_mode_from_string(const char *name, dc1394video_mode_t *mode)
+{
+    int i;
+
+    g_return_val_if_fail(name != NULL && mode != NULL, FALSE);
+
+    for (i = 0; i < G_N_ELEMENTS(video_mode_names); i++) {
+        if (g_ascii_strcasecmp(name, video_mode_names[i].name) == 0) {
+            *mode = video_mode_names[i].mode;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+const char *video_mode_to_string(dc1394video_mode_t mode)
+{
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(video_mode_names); i++) {
+        if (video_mode_names[i].mode == mode)
+            return video_mode_names[i].name;
+    }
+    return "unknown";
+}
+
+dc1394video_mode_t video_mode_for_show(dc1394camera_t *camera, show_mode_t show)
+{
+    static const dc1394video_mode_t color_modes[] = {
+        DC1394_VIDEO_MODE_640x480_RGB8, DC1394_VIDEO_MODE_640x480_YUV422, DC1394_VIDEO_MODE_640x480_YUV411
+    };
+    dc1394video_modes_t modes;
+    uint32_t i, j;
+
+    switch (show) {
+        case GRAY16:
+            return DC1394_VIDEO_MODE_640x480_MONO16;
+        case FORMAT7:
+            return DC1394_VIDEO_MODE_FORMAT7_0;
+        case COLOR:
+            if (dc1394_video_get_supported_modes(camera, &modes) == DC1394_SUCCESS) {
+                for (i = 0; i < G_N_ELEMENTS(color_modes); i++) {
+                    for (j = 0; j < modes.num; j++) {
+                        if (modes.modes[j] == color_modes[i])
+                            return color_modes[i];
+                    }
+                }
+            }
+            return DC1394_VIDEO_MODE_640x480_MONO8;
+        default:
+            return DC1394_VIDEO_MODE_640x480_MONO8;
+    }
+}
+
+dc1394error_t setup_video_mode_capture(
+                dc1394camera_t *camera,
+                dc1394video_mode_t mode,
+                show_mode_t *show,
+                uint32_t *width,
+                uint32_t *height)
+{
+    dc1394video_modes_t modes;
+    dc1394color_coding_t coding;
+    dc1394error_t err;
+    uint32_t i;
+
+    err = dc1394_video_get_supported_modes(camera, &modes);
+    DC1394_ERR_RTN(err, "Could not get supported video modes");
+
+    for (i = 0; i < modes.num && modes.modes[i] != mode; i++)
+        ;
+    if (i == modes.num) {
+        fprintf(stderr, "Video mode %s is not supported, the camera has:", video_mode_to_string(mode));
+        for (i = 0; i < modes.num; i++)
+            fprintf(stderr, " %s", video_mode_to_string(modes.modes[i]));
+        fprintf(stderr, "\n");
+        return DC1394_INVALID_VIDEO_MODE;
+    }
+
+    err = dc1394_get_image_size_from_video_mode(camera, mode, width, height);
+    DC1394_ERR_RTN(err, "Could not get image size");
+
+    if (mode >= DC1394_VIDEO_MODE_FORMAT7_MIN && mode <= DC1394_VIDEO_MODE_FORMAT7_MAX) {
+        *show = FORMAT7;
+        return setup_color_capture(camera, mode, DC1394_COLOR_CODING_RAW8);
+    }
+
+    err = dc1394_get_color_coding_from_video_mode(camera, mode, &coding);
+    DC1394_ERR_RTN(err, "Could not get color coding");
+
+    switch (coding) {
+        case DC1394_COLOR_CODING_MONO8:
+            *show = GRAY;
+            break;
+        case DC1394_COLOR_CODING_MONO16:
+            *show = GRAY16;
+            break;
+        case DC1394_COLOR_CODING_YUV411:
+        case DC1394_COLOR_CODING_YUV422:
+        case DC1394_COLOR_CODING_YUV444:
+        case DC1394_COLOR_CODING_RGB8:
+            *show = COLOR;
+            break;
+        default:
+            return DC1394_INVALID_COLOR_CODING;
+    }
+
+    /* nothing in it is specific to gray modes */
+    return setup_gray_capture(camera, mode);
+}
+
 dc1394error_t setup_framerate(
                 dc1394camera_t *camera, 
                 float ff)
@@ -522,6 +676,933 @@ long read_frame_with_extras(dc1394video_frame_t *frame, FILE *fp, uint8_t *extra
     return sizeof(dc1394video_frame_t) + (sizeof(unsigned char) * frame->total_bytes) + nextra;
 }
 
+#define FRAME_SYNC          "DCFR"
+#define INDEX_SYNC          "DCIX"
+#define INDEX_MAGIC         "DC1394IX"
+#define INDEX_HEADER_BYTES  16
+#define INDEX_ENTRY_BYTES   16
+#define INDEX_FOOTER_BYTES  16
+
+#define FRAME_FLAG_CODEC_MASK   0xff
+
+typedef struct __index_entry
+{
+    uint64_t    offset;
+    uint64_t    timestamp;
+} index_entry_t;
+
+#define UNKNOWN_FRAME   G_MAXUINT64
+
+struct __recording
+{
+    FILE                *fp;
+    storage_t           *out;           /* writing only */
+    gboolean            owns_out;
+    gboolean            writing;
+    gboolean            legacy;
+    gboolean            have_pending;   /* legacy only: first header already consumed */
+    dc1394video_frame_t pending;
+    dc1394video_frame_t format;
+    uint64_t            frame_bytes;    /* payload bytes of a frame */
+    off_t               data_offset;    /* file offset of the first frame */
+    off_t               data_end;       /* file offset of the index, 0 if unknown */
+    off_t               pos;            /* current file offset */
+    uint32_t            next_id;
+    uint64_t            next_frame;     /* reading: the frame at pos */
+    GString             *metadata;      /* key=value lines stored with the index */
+    GArray              *index;         /* index_entry_t per frame, NULL if unavailable */
+    uint8_t             *scratch;       /* compressed payload being decoded */
+    size_t              scratch_bytes;
+    unsigned char       *view;          /* image returned by recording_read_frame_view() */
+    uint64_t            view_bytes;     /* when it is not in the mapping */
+
+    /* regular files are read through a read only mapping of the whole
+     * file rather than with fread */
+    const uint8_t       *map;
+    size_t              map_bytes;
+    recording_access_t  access;
+
+    /* recordings split over several files are a chain of segments, the
+     * head of the chain tracks which one is being read */
+    gboolean            owns_fp;
+    recording_t         *next;
+    recording_t         *current;
+};
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static gboolean frame_reserve_image(dc1394video_frame_t *frame, uint64_t nbytes)
+{
+    if (frame->image == NULL || frame->allocated_image_bytes < nbytes) {
+        unsigned char *image = (unsigned char *)realloc(frame->image, nbytes);
+        if (image == NULL)
+            return FALSE;
+        frame->image = image;
+        frame->allocated_image_bytes = nbytes;
+    }
+    return TRUE;
+}
+
+static uint64_t frame_payload_bytes(dc1394video_frame_t *frame)
+{
+    /* padding bytes are not worth storing */
+    return frame->image_bytes ? frame->image_bytes : frame->total_bytes;
+}
+
+static void recording_index_append(recording_t *rec, uint64_t offset, uint64_t timestamp)
+{
+    index_entry_t entry;
+
+    entry.offset = offset;
+    entry.timestamp = timestamp;
+    g_array_append_val(rec->index, entry);
+}
+
+/* Loads the index trailer written by recording_close(). Returns FALSE, with
+ * the file position unchanged, if the file has none */
+static gboolean recording_load_index(recording_t *rec)
+{
+    uint8_t buf[INDEX_HEADER_BYTES];
+    uint64_t i, count;
+    uint32_t metadata_bytes;
+    off_t end, index_offset;
+
+    if (fseeko(rec->fp, -INDEX_FOOTER_BYTES, SEEK_END) != 0)
+        return FALSE;
+    end = ftello(rec->fp) + INDEX_FOOTER_BYTES;
+
+    if (fread(buf, 1, INDEX_FOOTER_BYTES, rec->fp) != INDEX_FOOTER_BYTES ||
+        memcmp(buf + 8, INDEX_MAGIC, 8) != 0)
+        goto none;
+
+    index_offset = get_le64(buf);
+    if (index_offset < rec->data_offset || index_offset + INDEX_HEADER_BYTES > end)
+        goto none;
+
+    if (fseeko(rec->fp, index_offset, SEEK_SET) != 0 ||
+        fread(buf, 1, INDEX_HEADER_BYTES, rec->fp) != INDEX_HEADER_BYTES ||
+        memcmp(buf, INDEX_SYNC, 4) != 0)
+        goto none;
+
+    metadata_bytes = get_le32(buf + 4);
+    count = get_le64(buf + 8);
+    if (index_offset + INDEX_HEADER_BYTES + (count * INDEX_ENTRY_BYTES) + metadata_bytes + INDEX_FOOTER_BYTES != end)
+        goto none;
+
+    rec->index = g_array_sized_new(FALSE, FALSE, sizeof(index_entry_t), count);
+    for (i = 0; i < count; i++) {
+        if (fread(buf, 1, INDEX_ENTRY_BYTES, rec->fp) != INDEX_ENTRY_BYTES) {
+            g_array_free(rec->index, TRUE);
+            rec->index = NULL;
+            goto none;
+        }
+        recording_index_append(rec, get_le64(buf), get_le64(buf + 8));
+    }
+    rec->data_end = index_offset;
+
+    if (metadata_bytes) {
+        rec->metadata = g_string_sized_new(metadata_bytes);
+        g_string_set_size(rec->metadata, metadata_bytes);
+        if (fread(rec->metadata->str, 1, metadata_bytes, rec->fp) != metadata_bytes) {
+            g_string_free(rec->metadata, TRUE);
+            rec->metadata = NULL;
+        }
+    }
+
+none:
+    fseeko(rec->fp, rec->pos, SEEK_SET);
+    return rec->index != NULL;
+}
+
+recording_t *recording_open_write(FILE *fp, dc1394video_frame_t *frame)
+{
+    recording_t *rec;
+    storage_t *out;
+
+    g_return_val_if_fail(fp != NULL, NULL);
+
+    out = storage_new_from_fp(fp);
+    rec = recording_open_write_storage(out, frame);
+    if (rec)
+        rec->owns_out = TRUE;
+    else
+        storage_close(out);
+    return rec;
+}
+
+recording_t *recording_open_write_storage(storage_t *out, dc1394video_frame_t *frame)
+{
+    recording_t *rec;
+    uint8_t buf[RECORDING_HEADER_BYTES];
+
+    g_return_val_if_fail(out != NULL, NULL);
+    g_return_val_if_fail(frame != NULL, NULL);
+
+    rec = g_new0(recording_t, 1);
+    rec->out = out;
+    rec->writing = TRUE;
+    rec->format = *frame;
+    rec->format.image = NULL;
+    rec->format.camera = NULL;
+    rec->frame_bytes = frame_payload_bytes(frame);
+    rec->data_offset = RECORDING_HEADER_BYTES;
+    rec->pos = RECORDING_HEADER_BYTES;
+    rec->index = g_array_new(FALSE, FALSE, sizeof(index_entry_t));
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, RECORDING_MAGIC, 8);
+    put_le32(buf + 8,  RECORDING_VERSION);
+    put_le32(buf + 12, RECORDING_HEADER_BYTES);
+    put_le32(buf + 16, frame->size[0]);
+    put_le32(buf + 20, frame->size[1]);
+    put_le32(buf + 24, frame->video_mode);
+    put_le32(buf + 28, frame->color_coding);
+    put_le32(buf + 32, frame->color_filter);
+    put_le32(buf + 36, frame->stride);
+    put_le32(buf + 40, frame->data_depth);
+    put_le32(buf + 44, frame->yuv_byte_order);
+    put_le32(buf + 48, frame->little_endian);
+    put_le64(buf + 56, rec->frame_bytes);
+
+    if (!storage_write(out, buf, sizeof(buf))) {
+        g_array_free(rec->index, TRUE);
+        g_free(rec);
+        return NULL;
+    }
+
+    return rec;
+}
+
+/* Maps regular files so frames can be read without a copy or syscall.
+ * Anything else (pipes, or a failed mmap on a 32 bit system) keeps using
+ * stdio */
+static void recording_map(recording_t *rec)
+{
+    struct stat st;
+    void *map;
+
+    if (fstat(fileno(rec->fp), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+        (uint64_t)st.st_size > (size_t)-1)
+        return;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(rec->fp), 0);
+    if (map == MAP_FAILED)
+        return;
+
+    rec->map = map;
+    rec->map_bytes = st.st_size;
+}
+
+recording_t *recording_open_read(FILE *fp)
+{
+    recording_t *rec;
+    uint8_t buf[RECORDING_HEADER_BYTES];
+    uint32_t header_bytes;
+
+    g_return_val_if_fail(fp != NULL, NULL);
+
+    if (fread(buf, 1, 8, fp) != 8)
+        return NULL;
+
+    rec = g_new0(recording_t, 1);
+    rec->fp = fp;
+
+    if (memcmp(buf, RECORDING_MAGIC, 8) != 0) {
+        /* legacy recording, starts with a raw dc1394video_frame_t. The
+         * bytes already consumed are the start of the first frame header, 
+         * so finish reading it here rather than seeking (fp may be a pipe) */
+        memcpy(&(rec->pending), buf, 8);
+        if (fread(((uint8_t *)&(rec->pending)) + 8, sizeof(dc1394video_frame_t) - 8, 1, fp) != 1) {
+            g_free(rec);
+            return NULL;
+        }
+        rec->legacy = TRUE;
+        rec->have_pending = TRUE;
+        rec->format = rec->pending;
+        rec->format.image = NULL;
+        rec->format.camera = NULL;
+        rec->frame_bytes = rec->format.total_bytes;
+        rec->data_offset = 0;
+        rec->pos = sizeof(dc1394video_frame_t);
+        recording_rebuild_index(rec);
+        recording_map(rec);
+        return rec;
+    }
+
+    if (fread(buf + 8, 1, RECORDING_HEADER_BYTES - 8, fp) != RECORDING_HEADER_BYTES - 8 ||
+        get_le32(buf + 8) > RECORDING_VERSION) {
+        g_free(rec);
+        return NULL;
+    }
+
+    header_bytes = get_le32(buf + 12);
+    if (header_bytes < RECORDING_HEADER_BYTES) {
+        g_free(rec);
+        return NULL;
+    }
+    rec->data_offset = header_bytes;
+
+    rec->format.size[0] = get_le32(buf + 16);
+    rec->format.size[1] = get_le32(buf + 20);
+    rec->format.video_mode = get_le32(buf + 24);
+    rec->format.color_coding = get_le32(buf + 28);
+    rec->format.color_filter = get_le32(buf + 32);
+    rec->format.stride = get_le32(buf + 36);
+    rec->format.data_depth = get_le32(buf + 40);
+    rec->format.yuv_byte_order = get_le32(buf + 44);
+    rec->format.little_endian = get_le32(buf + 48);
+    rec->frame_bytes = get_le64(buf + 56);
+    rec->format.total_bytes = rec->frame_bytes;
+    rec->format.image_bytes = rec->frame_bytes;
+
+    /* skip any header fields added by later versions */
+    while (header_bytes > RECORDING_HEADER_BYTES) {
+        if (fgetc(fp) == EOF) {
+            g_free(rec);
+            return NULL;
+        }
+        header_bytes--;
+    }
+    rec->pos = rec->data_offset;
+
+    /* files that can seek get random access through the index trailer, 
+     * or if the recorder did not finish cleanly, by scanning for frames */
+    if (!recording_load_index(rec))
+        recording_rebuild_index(rec);
+
+    recording_map(rec);
+    return rec;
+}
+
+void recording_close(recording_t *rec)
+{
+    recording_t *next;
+
+    if (rec == NULL)
+        return;
+
+    next = rec->next;
+
+    if (rec->writing && rec->index) {
+        uint8_t buf[INDEX_HEADER_BYTES];
+        index_entry_t *entry;
+        guint i;
+
+        memcpy(buf, INDEX_SYNC, 4);
+        put_le32(buf + 4, rec->metadata ? rec->metadata->len : 0);
+        put_le64(buf + 8, rec->index->len);
+        storage_write(rec->out, buf, INDEX_HEADER_BYTES);
+
+        for (i = 0; i < rec->index->len; i++) {
+            entry = &g_array_index(rec->index, index_entry_t, i);
+            put_le64(buf, entry->offset);
+            put_le64(buf + 8, entry->timestamp);
+            storage_write(rec->out, buf, INDEX_ENTRY_BYTES);
+        }
+
+        if (rec->metadata)
+            storage_write(rec->out, rec->metadata->str, rec->metadata->len);
+
+        put_le64(buf, rec->pos);
+        memcpy(buf + 8, INDEX_MAGIC, 8);
+        storage_write(rec->out, buf, INDEX_FOOTER_BYTES);
+    }
+
+    if (rec->owns_out)
+        storage_close(rec->out);
+
+    if (rec->index)
+        g_array_free(rec->index, TRUE);
+    if (rec->metadata)
+        g_string_free(rec->metadata, TRUE);
+    if (rec->map)
+        munmap((void *)rec->map, rec->map_bytes);
+    if (rec->owns_fp)
+        fclose(rec->fp);
+    g_free(rec->scratch);
+    free(rec->view);
+    g_free(rec);
+
+    recording_close(next);
+}
+
+long recording_write_frame(recording_t *rec, dc1394video_frame_t *frame)
+{
+    return recording_write_encoded_frame(rec, frame, CODEC_NONE, frame->image, frame_payload_bytes(frame));
+}
+
+long recording_write_encoded_frame(
+                recording_t *rec,
+                dc1394video_frame_t *frame,
+                unsigned int codec,
+                const uint8_t *payload,
+                uint32_t nbytes)
+{
+    uint8_t buf[RECORDING_FRAME_BYTES];
+    struct iovec iov[2];
+
+    memcpy(buf, FRAME_SYNC, 4);
+    put_le32(buf + 4, codec & FRAME_FLAG_CODEC_MASK);
+    put_le64(buf + 8, frame->timestamp);
+    put_le32(buf + 16, rec->next_id);
+    put_le32(buf + 20, nbytes);
+
+    iov[0].iov_base = buf;
+    iov[0].iov_len = sizeof(buf);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = nbytes;
+    if (!storage_writev(rec->out, iov, 2))
+        return -1;
+
+    recording_index_append(rec, rec->pos, frame->timestamp);
+    rec->pos += RECORDING_FRAME_BYTES + nbytes;
+    rec->next_id++;
+
+    return RECORDING_FRAME_BYTES + nbytes;
+}
+
+/* Points frame->image at a buffer of nbytes owned by rec, for views of
+ * frames that are not (or not as is) in the mapping */
+static gboolean view_reserve_image(recording_t *rec, dc1394video_frame_t *frame, uint64_t nbytes)
+{
+    frame->image = rec->view;
+    frame->allocated_image_bytes = rec->view_bytes;
+    if (!frame_reserve_image(frame, nbytes))
+        return FALSE;
+    rec->view = frame->image;
+    rec->view_bytes = frame->allocated_image_bytes;
+    return TRUE;
+}
+
+/* Returns nbytes of the segment at offset; from the mapping if there is
+ * one, otherwise read into buf from the current file position (which is
+ * offset). NULL at end of file. Does not advance rec->pos */
+static const uint8_t *segment_fetch(recording_t *rec, off_t offset, void *buf, size_t nbytes)
+{
+    if (rec->map) {
+        if ((uint64_t)offset + nbytes > rec->map_bytes)
+            return NULL;
+        return rec->map + offset;
+    }
+    if (buf == NULL || fread(buf, 1, nbytes, rec->fp) != nbytes)
+        return NULL;
+    return buf;
+}
+
+static long recording_read_legacy_frame(recording_t *rec, dc1394video_frame_t *frame, gboolean view)
+{
+    dc1394video_frame_t hdr;
+    const uint8_t *data;
+    unsigned char *image;
+    uint64_t allocated;
+    off_t offset = rec->pos;
+
+    if (rec->have_pending) {
+        hdr = rec->pending;
+        rec->have_pending = FALSE;
+    } else if ((data = segment_fetch(rec, offset, &hdr, sizeof(hdr))) == NULL) {
+        return 0;
+    } else {
+        if (data != (uint8_t *)&hdr)
+            memcpy(&hdr, data, sizeof(hdr));
+        offset += sizeof(hdr);
+        rec->pos = offset;
+    }
+
+    image = frame->image;
+    allocated = frame->allocated_image_bytes;
+    *frame = hdr;
+    frame->image = image;
+    frame->allocated_image_bytes = allocated;
+    frame->camera = NULL;
+
+    if (rec->map) {
+        if ((data = segment_fetch(rec, offset, NULL, hdr.total_bytes)) == NULL)
+            return 0;
+        if (view) {
+            frame->image = (unsigned char *)data;
+            frame->allocated_image_bytes = 0;
+        } else {
+            if (!frame_reserve_image(frame, hdr.total_bytes))
+                return -1;
+            memcpy(frame->image, data, hdr.total_bytes);
+        }
+    } else {
+        if (view ? !view_reserve_image(rec, frame, hdr.total_bytes) : !frame_reserve_image(frame, hdr.total_bytes))
+            return -1;
+        if (fread(frame->image, 1, hdr.total_bytes, rec->fp) != hdr.total_bytes)
+            return 0;
+    }
+
+    rec->pos += hdr.total_bytes;
+    return sizeof(dc1394video_frame_t) + hdr.total_bytes;
+}
+
+static long segment_read_frame(recording_t *rec, dc1394video_frame_t *frame, gboolean view)
+{
+    uint8_t hdrbuf[RECORDING_FRAME_BYTES];
+    const uint8_t *buf, *data;
+    unsigned char *image;
+    uint64_t allocated;
+    uint32_t flags, payload;
+
+    if (rec->data_end && rec->pos >= rec->data_end)
+        return 0;
+
+    if (rec->legacy)
+        return recording_read_legacy_frame(rec, frame, view);
+
+    /* a short read here is a clean (or truncated) end of file. When
+     * reading from a pipe the index trailer marks the end of the frames */
+    if ((buf = segment_fetch(rec, rec->pos, hdrbuf, sizeof(hdrbuf))) == NULL)
+        return 0;
+    if (memcmp(buf, INDEX_SYNC, 4) == 0)
+        return 0;
+    if (memcmp(buf, FRAME_SYNC, 4) != 0)
+        return -1;
+
+    flags = get_le32(buf + 4);
+    payload = get_le32(buf + 20);
+
+    image = frame->image;
+    allocated = frame->allocated_image_bytes;
+    *frame = rec->format;
+    frame->image = image;
+    frame->allocated_image_bytes = allocated;
+
+    /* mapped payloads are used in place, otherwise read after the header */
+    data = NULL;
+    if (rec->map && (data = segment_fetch(rec, rec->pos + RECORDING_FRAME_BYTES, NULL, payload)) == NULL)
+        return 0;
+
+    if (flags & FRAME_FLAG_CODEC_MASK) {
+        /* compressed frames decode to the size given in the file header */
+        if (data == NULL) {
+            if (rec->scratch_bytes < payload) {
+                rec->scratch = g_realloc(rec->scratch, payload);
+                rec->scratch_bytes = payload;
+            }
+            if (fread(rec->scratch, 1, payload, rec->fp) != payload)
+                return 0;
+            data = rec->scratch;
+        }
+        if (view ? !view_reserve_image(rec, frame, rec->frame_bytes) : !frame_reserve_image(frame, rec->frame_bytes))
+            return -1;
+        if (codec_decode_frame(flags & FRAME_FLAG_CODEC_MASK, data, payload, frame) != DC1394_SUCCESS)
+            return -1;
+        frame->total_bytes = rec->frame_bytes;
+    } else if (data && view) {
+        frame->image = (unsigned char *)data;
+        frame->allocated_image_bytes = 0;
+        frame->total_bytes = payload;
+    } else {
+        if (view ? !view_reserve_image(rec, frame, payload) : !frame_reserve_image(frame, payload))
+            return -1;
+        if (data)
+            memcpy(frame->image, data, payload);
+        else if (fread(frame->image, 1, payload, rec->fp) != payload)
+            return 0;
+        frame->total_bytes = payload;
+    }
+
+    frame->timestamp = get_le64(buf + 8);
+    frame->id = get_le32(buf + 16);
+    frame->image_bytes = frame->total_bytes;
+    frame->padding_bytes = 0;
+
+    rec->pos += RECORDING_FRAME_BYTES + payload;
+    return RECORDING_FRAME_BYTES + payload;
+}
+
+static void segment_advise(recording_t *rec, int advice, off_t offset, size_t nbytes)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = offset - (offset % page);
+
+    if (start >= rec->map_bytes)
+        return;
+    nbytes = MIN(nbytes + (offset - start), rec->map_bytes - start);
+    madvise((void *)(rec->map + start), nbytes, advice);
+}
+
+static gboolean segment_seek_frame(recording_t *rec, uint64_t n)
+{
+    off_t offset;
+
+    if (rec->index && n >= rec->index->len)
+        return FALSE;
+
+    /* already there; reading sequentially needs no fseeko, so recordings
+     * can also be played back from a pipe */
+    if (n == rec->next_frame)
+        return TRUE;
+
+    if (rec->index) {
+        offset = g_array_index(rec->index, index_entry_t, n).offset;
+    } else if (rec->legacy) {
+        offset = rec->data_offset + n * (sizeof(dc1394video_frame_t) + rec->frame_bytes);
+    } else {
+        offset = rec->data_offset + n * (RECORDING_FRAME_BYTES + rec->frame_bytes);
+    }
+
+    if (rec->map) {
+        if (offset >= rec->map_bytes)
+            return FALSE;
+        /* jumping around; start reading the frame in now */
+        if (rec->access == RECORDING_ACCESS_RANDOM)
+            segment_advise(rec, MADV_WILLNEED, offset, RECORDING_FRAME_BYTES + rec->frame_bytes);
+    } else if (fseeko(rec->fp, offset, SEEK_SET) != 0) {
+        return FALSE;
+    }
+
+    rec->pos = offset;
+    rec->have_pending = FALSE;
+    rec->next_frame = n;
+    return TRUE;
+}
+
+static uint64_t segment_n_frames(recording_t *rec)
+{
+    return rec->index ? rec->index->len : 0;
+}
+
+static long chain_read_frame(recording_t *rec, dc1394video_frame_t *frame, gboolean view)
+{
+    recording_t *seg;
+    long n;
+
+    g_return_val_if_fail(rec != NULL, -1);
+    g_return_val_if_fail(frame != NULL, -1);
+
+    seg = rec->current ? rec->current : rec;
+    n = segment_read_frame(seg, frame, view);
+
+    /* continue into the next segment file */
+    while (n == 0 && seg->next) {
+        seg->next_frame = UNKNOWN_FRAME;
+        seg = seg->next;
+        rec->current = seg;
+        if (!segment_seek_frame(seg, 0))
+            return 0;
+        n = segment_read_frame(seg, frame, view);
+    }
+
+    /* after a failed or short read the position is unknown */
+    if (n > 0 && seg->next_frame != UNKNOWN_FRAME)
+        seg->next_frame++;
+    else
+        seg->next_frame = UNKNOWN_FRAME;
+    return n;
+}
+
+long recording_read_frame(recording_t *rec, dc1394video_frame_t *frame)
+{
+    return chain_read_frame(rec, frame, FALSE);
+}
+
+long recording_read_frame_view(recording_t *rec, dc1394video_frame_t *frame)
+{
+    return chain_read_frame(rec, frame, TRUE);
+}
+
+void recording_set_access(recording_t *rec, recording_access_t access)
+{
+    g_return_if_fail(rec != NULL);
+
+    for (; rec; rec = rec->next) {
+        rec->access = access;
+        if (rec->map)
+            madvise((void *)rec->map, rec->map_bytes,
+                    access == RECORDING_ACCESS_SEQUENTIAL ? MADV_SEQUENTIAL :
+                    access == RECORDING_ACCESS_RANDOM ? MADV_RANDOM : MADV_NORMAL);
+    }
+}
+
+gboolean recording_is_mapped(recording_t *rec)
+{
+    g_return_val_if_fail(rec != NULL, FALSE);
+    return rec->map != NULL;
+}
+
+gboolean recording_seek_frame(recording_t *rec, uint64_t n)
+{
+    recording_t *seg;
+
+    g_return_val_if_fail(rec != NULL, FALSE);
+
+    for (seg = rec; seg->next && n >= segment_n_frames(seg); seg = seg->next)
+        n -= segment_n_frames(seg);
+
+    rec->current = seg;
+    return segment_seek_frame(seg, n);
+}
+
+gboolean recording_seek_time(recording_t *rec, uint64_t timestamp, uint64_t *n)
+{
+    recording_t *seg;
+    GArray *index;
+    guint lo, hi, mid;
+    uint64_t base;
+
+    g_return_val_if_fail(rec != NULL, FALSE);
+
+    /* the segment holding the first frame at or after timestamp */
+    base = 0;
+    for (seg = rec; seg->next; seg = seg->next) {
+        index = seg->index;
+        if (index && index->len &&
+            g_array_index(index, index_entry_t, index->len - 1).timestamp >= timestamp)
+            break;
+        base += segment_n_frames(seg);
+    }
+
+    index = seg->index;
+    if (index == NULL || index->len == 0)
+        return FALSE;
+
+    lo = 0;
+    hi = index->len - 1;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (g_array_index(index, index_entry_t, mid).timestamp < timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (n)
+        *n = base + lo;
+    rec->current = seg;
+    return segment_seek_frame(seg, lo);
+}
+
+uint64_t recording_get_n_frames(recording_t *rec)
+{
+    uint64_t n = 0;
+
+    g_return_val_if_fail(rec != NULL, 0);
+
+    for (; rec; rec = rec->next)
+        n += segment_n_frames(rec);
+    return n;
+}
+
+uint64_t recording_get_frame_timestamp(recording_t *rec, uint64_t n)
+{
+    g_return_val_if_fail(rec != NULL, 0);
+
+    for (; rec->next && n >= segment_n_frames(rec); rec = rec->next)
+        n -= segment_n_frames(rec);
+
+    if (n >= segment_n_frames(rec))
+        return 0;
+    return g_array_index(rec->index, index_entry_t, n).timestamp;
+}
+
+uint64_t recording_get_size(recording_t *rec)
+{
+    g_return_val_if_fail(rec != NULL, 0);
+    return rec->pos;
+}
+
+gchar *recording_segment_filename(const char *filename, unsigned int n)
+{
+    if (n == 0)
+        return g_strdup(filename);
+    return g_strdup_printf("%s.%03u", filename, n);
+}
+
+recording_t *recording_open(const char *filename)
+{
+    recording_t *rec, *seg, *tail;
+    FILE *fp;
+    gchar *name;
+    unsigned int n;
+
+    g_return_val_if_fail(filename != NULL, NULL);
+
+    if (filename[0] == '-')
+        return recording_open_read(stdin);
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return NULL;
+
+    rec = recording_open_read(fp);
+    if (rec == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    rec->owns_fp = TRUE;
+
+    for (tail = rec, n = 1; ; tail = seg, n++) {
+        name = recording_segment_filename(filename, n);
+        fp = fopen(name, "rb");
+        g_free(name);
+        if (fp == NULL)
+            break;
+
+        seg = recording_open_read(fp);
+        if (seg == NULL) {
+            fclose(fp);
+            break;
+        }
+        seg->owns_fp = TRUE;
+        tail->next = seg;
+    }
+
+    return rec;
+}
+
+gboolean recording_rebuild_index(recording_t *rec)
+{
+    uint8_t buf[RECORDING_FRAME_BYTES];
+    dc1394video_frame_t hdr;
+    off_t offset, start, end;
+    uint64_t payload, timestamp;
+    size_t header;
+
+    g_return_val_if_fail(rec != NULL, FALSE);
+
+    start = rec->pos;
+    if (fseeko(rec->fp, 0, SEEK_END) != 0)
+        return FALSE;
+    end = ftello(rec->fp);
+
+    offset = rec->data_offset;
+    if (fseeko(rec->fp, offset, SEEK_SET) != 0)
+        return FALSE;
+
+    if (rec->index)
+        g_array_free(rec->index, TRUE);
+    rec->index = g_array_new(FALSE, FALSE, sizeof(index_entry_t));
+
+    /* only the small per-frame headers are read, the image data is
+     * skipped over. A truncated final frame is left out of the index */
+    while (1) {
+        if (rec->legacy) {
+            if (fread(&hdr, sizeof(hdr), 1, rec->fp) != 1)
+                break;
+            header = sizeof(hdr);
+            payload = hdr.total_bytes;
+            timestamp = hdr.timestamp;
+        } else {
+            if (fread(buf, 1, sizeof(buf), rec->fp) != sizeof(buf) ||
+                memcmp(buf, FRAME_SYNC, 4) != 0)
+                break;
+            header = sizeof(buf);
+            payload = get_le32(buf + 20);
+            timestamp = get_le64(buf + 8);
+        }
+
+        if (offset + header + payload > end ||
+            fseeko(rec->fp, payload, SEEK_CUR) != 0)
+            break;
+
+        recording_index_append(rec, offset, timestamp);
+        offset += header + payload;
+    }
+
+    rec->data_end = offset;
+    clearerr(rec->fp);
+    fseeko(rec->fp, start, SEEK_SET);
+    return TRUE;
+}
+
+const dc1394video_frame_t *recording_get_format(recording_t *rec)
+{
+    g_return_val_if_fail(rec != NULL, NULL);
+    return &(rec->format);
+}
+
+void recording_set_metadata(recording_t *rec, const char *key, const char *value)
+{
+    g_return_if_fail(rec != NULL);
+    g_return_if_fail(key != NULL && value != NULL);
+    g_return_if_fail(strchr(key, '=') == NULL && strchr(value, '\n') == NULL);
+
+    if (rec->metadata == NULL)
+        rec->metadata = g_string_new(NULL);
+    g_string_append_printf(rec->metadata, "%s=%s\n", key, value);
+}
+
+gchar *recording_get_metadata(recording_t *rec, const char *key)
+{
+    gchar **lines;
+    gchar *value = NULL;
+    size_t keylen;
+    int i;
+
+    g_return_val_if_fail(rec != NULL, NULL);
+    g_return_val_if_fail(key != NULL, NULL);
+
+    /* later values for the same key replace earlier ones, and later
+     * segments replace earlier segments; a segmented recording stores its
+     * capture summary only in the segment open when recording stopped */
+    keylen = strlen(key);
+    for (; rec; rec = rec->next) {
+        if (rec->metadata == NULL)
+            continue;
+        lines = g_strsplit(rec->metadata->str, "\n", -1);
+        for (i = 0; lines[i]; i++) {
+            if (strncmp(lines[i], key, keylen) == 0 && lines[i][keylen] == '=') {
+                g_free(value);
+                value = g_strdup(lines[i] + keylen + 1);
+            }
+        }
+        g_strfreev(lines);
+    }
+
+    return value;
+}
+
+gboolean recording_is_legacy(recording_t *rec)
+{
+    g_return_val_if_fail(rec != NULL, FALSE);
+    return rec->legacy;
+}
+
+gboolean recording_seek_from_command_line(
+                recording_t *rec,
+                gint64 start_frame,
+                double start_time,
+                uint64_t *n)
+{
+    g_return_val_if_fail(rec != NULL, FALSE);
+
+    if (start_time >= 0) {
+        uint64_t ts = recording_get_frame_timestamp(rec, 0) + (uint64_t)(start_time * 1e6);
+        return recording_seek_time(rec, ts, n);
+    }
+
+    if (start_frame < 0)
+        start_frame = 0;
+    if (n)
+        *n = start_frame;
+
+    /* nothing to do when starting at the beginning, even on a pipe */
+    return start_frame == 0 || recording_seek_frame(rec, start_frame);
+}
+
 void app_exit(int code, GOptionContext *context, const char *msg)
 {
     if (context && msg)
@@ -27,10 +27,13 @@
 #include <glib.h>
 #include <dc1394/dc1394.h>
 
+#include "storage.h"
+
 G_BEGIN_DECLS
 
 typedef enum {
     GRAY =      'g',
+    GRAY16 =    'G',
     COLOR =     'c',
     FORMAT7 =   '7'
 } show_mode_t;
@@ -55,6 +58,42 @@ dc1394error_t setup_gray_capture(
                 dc1394camera_t *camera, 
                 dc1394video_mode_t video_mode);
 
+/**
+ * Names of the video modes the tools can capture in, e.g. for
+ * GOPTION_ENTRY_VIDEO_MODE; the libdc1394 name without its
+ * DC1394_VIDEO_MODE_ prefix, in any case
+ */
+#define VIDEO_MODE_NAMES "WxH_mono8, WxH_mono16, WxH_yuv411, WxH_yuv422, WxH_yuv444, WxH_rgb8 (the sizes of the IIDC modes) or format7_0 to format7_7"
+
+/**
+ * Parses a video mode name (see VIDEO_MODE_NAMES). Returns FALSE if the
+ * name is not recognised.
+ */
+gboolean video_mode_from_string(const char *name, dc1394video_mode_t *mode);
+
+const char *video_mode_to_string(dc1394video_mode_t mode);
+
+/**
+ * The video mode for a format: MONO8 and MONO16 at 640x480 for GRAY and
+ * GRAY16, FORMAT7_0 for FORMAT7 and for COLOR the first 640x480 RGB8,
+ * YUV422 or YUV411 mode the camera supports, falling back to MONO8 if it
+ * has none.
+ */
+dc1394video_mode_t video_mode_for_show(dc1394camera_t *camera, show_mode_t show);
+
+/**
+ * Sets the camera up to capture in mode (Format7 modes as RAW8, with
+ * setup_color_capture()) and returns the format its frames are shown in
+ * and their size. Fails with DC1394_INVALID_VIDEO_MODE, listing the modes
+ * the camera does support, if mode is not one of them.
+ */
+dc1394error_t setup_video_mode_capture(
+                dc1394camera_t *camera,
+                dc1394video_mode_t mode,
+                show_mode_t *show,
+                uint32_t *width,
+                uint32_t *height);
+
 /**
  * Sets the camera framerate to the given floating point value, if supported
  */
@@ -93,7 +132,9 @@ dc1394error_t get_exposure_and_brightness(
  * Function and macro to setup camera from GOption command line arguments
  */
 #define GOPTION_ENTRY_FORMAT(_format)                                                           \
-      { "format", 'f', 0, G_OPTION_ARG_STRING, _format, "Format of image", "g,c,7" }
+      { "format", 'f', 0, G_OPTION_ARG_STRING, _format, "Format of image", "g,G,c,7" }
+#define GOPTION_ENTRY_VIDEO_MODE(_mode)                                                         \
+      { "video-mode", 'V', 0, G_OPTION_ARG_STRING, _mode, "Camera video mode, overriding the format: " VIDEO_MODE_NAMES, "640x480_yuv422" }
 #define GOPTION_ENTRY_GUID(_guid)                                                               \
       { "guid", 'g', 0, G_OPTION_ARG_INT64, _guid, "Camera GUID", "0x456" }                     \
 
@@ -133,6 +174,194 @@ long read_frame_with_extras(dc1394video_frame_t *frame, FILE *fp, uint8_t *extra
 
 void print_frame_info(dc1394video_frame_t *frame);
 
+/**
+ * Recording container. A recording is a fixed 64 byte file header holding
+ * the geometry and color coding of the stream, followed by one small fixed
+ * size record per frame (sync word, flags, timestamp, frame id, payload
+ * length) and the image bytes. All fields are stored little endian so
+ * recordings can be read on any architecture.
+ *
+ * When the recording is closed an index trailer mapping each frame number
+ * to its file offset and timestamp is appended, giving constant time
+ * seeking by frame number and logarithmic time seeking by timestamp.
+ * The trailer can also carry free form key=value metadata about the
+ * recording, such as capture statistics.
+ *
+ * Files written with write_frame() before this format existed (raw
+ * dc1394video_frame_t dumps) are detected and read transparently.
+ */
+#define RECORDING_MAGIC             "DC1394RC"
+#define RECORDING_VERSION           1
+#define RECORDING_HEADER_BYTES      64
+#define RECORDING_FRAME_BYTES       24
+
+typedef struct __recording recording_t;
+
+typedef enum {
+    RECORDING_ACCESS_NORMAL,
+    RECORDING_ACCESS_SEQUENTIAL,
+    RECORDING_ACCESS_RANDOM
+} recording_access_t;
+
+/**
+ * Writes the file header describing frame to fp and returns a handle for
+ * appending frames with the same geometry.
+ */
+recording_t *recording_open_write(FILE *fp, dc1394video_frame_t *frame);
+
+/**
+ * As recording_open_write(), but writing through one of the storage
+ * backends. out is not closed by recording_close().
+ */
+recording_t *recording_open_write_storage(storage_t *out, dc1394video_frame_t *frame);
+
+/**
+ * Reads the file header from fp (or detects a legacy recording) and returns
+ * a handle positioned at the first frame, or NULL if fp is not a recording.
+ */
+recording_t *recording_open_read(FILE *fp);
+
+/**
+ * Opens the recording at filename ("-" for stdin) for reading. If the
+ * recording was split into segments (see recording_segment_filename()),
+ * the following segments are opened too and read as one continuous
+ * stream of frames.
+ */
+recording_t *recording_open(const char *filename);
+
+/**
+ * Returns the name of segment n of a recording split over several files;
+ * filename itself for the first segment, then filename.001, filename.002...
+ * Free with g_free.
+ */
+gchar *recording_segment_filename(const char *filename, unsigned int n);
+
+/**
+ * Frees the handle, first appending the index if the recording was opened
+ * for writing (and flushing it, for recording_open_write()). The
+ * underlying FILE is only closed if it was opened by recording_open().
+ */
+void recording_close(recording_t *rec);
+
+/**
+ * Appends a frame, assigning it the next frame id. Returns the number of
+ * bytes written, or -1 on error.
+ */
+long recording_write_frame(recording_t *rec, dc1394video_frame_t *frame);
+
+/**
+ * Appends a frame whose image has already been encoded (see codec.h) into
+ * nbytes of payload. Returns the number of bytes written, or -1 on error.
+ */
+long recording_write_encoded_frame(
+                recording_t *rec,
+                dc1394video_frame_t *frame,
+                unsigned int codec,
+                const uint8_t *payload,
+                uint32_t nbytes);
+
+/**
+ * Reads the next frame into frame, decompressing it if necessary. The
+ * image buffer is (re)allocated only if frame->image is NULL or too small,
+ * so the same frame can be reused for a whole recording. Returns the number of bytes read,
+ * 0 at end of file, or -1 on error.
+ */
+long recording_read_frame(recording_t *rec, dc1394video_frame_t *frame);
+
+/**
+ * As recording_read_frame(), but without copying. frame->image points
+ * straight into the mapped file (see recording_is_mapped()), or for
+ * compressed frames and unmapped files into a buffer owned by rec. Either
+ * way it stays valid only until the next read or recording_close(), and
+ * must not be freed, nor frame passed to recording_read_frame().
+ */
+long recording_read_frame_view(recording_t *rec, dc1394video_frame_t *frame);
+
+/**
+ * Regular files are read through mmap(). Returns FALSE if rec is read with
+ * stdio instead, e.g. because it is a pipe.
+ */
+gboolean recording_is_mapped(recording_t *rec);
+
+/**
+ * Tells the kernel how the recording will be read (madvise). Sequential
+ * access reads ahead aggressively; random access reads in just the frame
+ * being seeked to.
+ */
+void recording_set_access(recording_t *rec, recording_access_t access);
+
+/**
+ * Positions the reader so that the next recording_read_frame() returns
+ * frame number n. Returns FALSE if the underlying file cannot seek or n is
+ * past the end of the index.
+ */
+gboolean recording_seek_frame(recording_t *rec, uint64_t n);
+
+/**
+ * Positions the reader at the first frame captured at or after timestamp
+ * (microseconds, as in dc1394video_frame_t) and stores its frame number in
+ * n. Requires the index.
+ */
+gboolean recording_seek_time(recording_t *rec, uint64_t timestamp, uint64_t *n);
+
+/**
+ * Number of frames in the index, or 0 if the recording has no index (for
+ * example when reading from a pipe)
+ */
+uint64_t recording_get_n_frames(recording_t *rec);
+
+/**
+ * Timestamp of frame number n from the index, or 0 if unknown
+ */
+uint64_t recording_get_frame_timestamp(recording_t *rec, uint64_t n);
+
+/**
+ * Number of bytes written to the recording so far
+ */
+uint64_t recording_get_size(recording_t *rec);
+
+/**
+ * Rebuilds the in-memory index by scanning the per-frame headers. This
+ * happens automatically when a seekable recording without an index
+ * trailer (e.g. one that was not closed cleanly) is opened.
+ */
+gboolean recording_rebuild_index(recording_t *rec);
+
+/**
+ * Returns a frame holding the stream geometry and color coding from the
+ * file header (image is NULL)
+ */
+const dc1394video_frame_t *recording_get_format(recording_t *rec);
+
+gboolean recording_is_legacy(recording_t *rec);
+
+/**
+ * Adds a key=value line to the metadata stored in the index trailer when
+ * the recording is closed. Setting a key again replaces its value.
+ */
+void recording_set_metadata(recording_t *rec, const char *key, const char *value);
+
+/**
+ * Returns the newest value stored for key (free with g_free), or NULL if
+ * the key or the index trailer is missing. All the segments of a
+ * segmented recording are searched, the last one taking precedence.
+ */
+gchar *recording_get_metadata(recording_t *rec, const char *key);
+
+/**
+ * Function and macro to choose the first frame to read from GOption
+ * command line arguments. A negative value means the option was not given.
+ * On success stores the selected frame number in n.
+ */
+#define GOPTION_ENTRY_SEEK_ARGUMENTS(_start_frame, _start_time)                                 \
+      { "start-frame", 's', 0, G_OPTION_ARG_INT64, _start_frame, "First frame", "0" },          \
+      { "start-time", 't', 0, G_OPTION_ARG_DOUBLE, _start_time, "Seconds after the first frame", "1.5" }
+gboolean recording_seek_from_command_line(
+                recording_t *rec,
+                gint64 start_frame,
+                double start_time,
+                uint64_t *n);
+
 void app_exit(int code, GOptionContext *context, const char *msg);
 
 G_END_DECLS
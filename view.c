@@ -31,6 +31,8 @@
 #include "camera.h"
 #include "utils.h"
 #include "gtkutils.h"
+#include "demosaic.h"
+#include "mono16.h"
 
 #define FPS_TO_MS(x) ((1.0/x)*1000.0)
 
@@ -76,6 +78,11 @@ int main(int argc, char *argv[])
     unsigned int width, height;
     GtkWidget *window, *canvas;
     char *format = NULL;
+    char *bayer_method = NULL;
+    char *window16 = NULL;
+    char *video_mode_name = NULL;
+    dc1394video_mode_t video_mode;
+    dc1394bayer_method_t method = DC1394_BAYER_METHOD_NEAREST;
     double framerate;
     int exposure, brightness;
     view_t view;
@@ -87,7 +94,10 @@ int main(int argc, char *argv[])
     GOptionEntry entries[] =
     {
       GOPTION_ENTRY_FORMAT(&format),
+      GOPTION_ENTRY_VIDEO_MODE(&video_mode_name),
       GOPTION_ENTRY_CAMERA_SETUP_ARGUMENTS(&guid, &framerate, &exposure, &brightness),
+      GOPTION_ENTRY_BAYER_METHOD(&bayer_method),
+      GOPTION_ENTRY_WINDOW(&window16),
       { NULL }
     };
 
@@ -110,9 +120,17 @@ int main(int argc, char *argv[])
     }
     if (format && format[0])
         view.show = format[0];
+    if (bayer_method && !demosaic_method_from_string(bayer_method, &method))
+        app_exit(1, context, "Error: Unknown Bayer method");
+    demosaic_set_method(method);
+    if (window16 && !mono16_set_window_from_string(window16))
+        app_exit(1, context, "Error: Invalid window");
+    if (video_mode_name && !video_mode_from_string(video_mode_name, &video_mode))
+        app_exit(1, context, "Error: Unknown video mode");
 
     switch (view.show) {
         case GRAY:
+        case GRAY16:
         case COLOR:
         case FORMAT7:
             printf("Selected mode: %c\n", view.show);
@@ -131,18 +149,10 @@ int main(int argc, char *argv[])
 
     gtk_init( &argc, &argv );
 
-    // setup capture
-    switch (view.show) {
-        case GRAY:
-        case COLOR:
-            dc1394_get_image_size_from_video_mode(view.camera, DC1394_VIDEO_MODE_640x480_MONO8, &width, &height);
-            err=setup_gray_capture(view.camera, DC1394_VIDEO_MODE_640x480_MONO8);
-            break;
-        case FORMAT7:
-            dc1394_get_image_size_from_video_mode(view.camera, DC1394_VIDEO_MODE_FORMAT7_0, &width, &height);
-            err=setup_color_capture(view.camera, DC1394_VIDEO_MODE_FORMAT7_0, DC1394_COLOR_CODING_RAW8);
-            break;
-    }
+    // setup capture, in the mode for the format unless one was given
+    if (!video_mode_name)
+        video_mode = video_mode_for_show(view.camera, view.show);
+    err=setup_video_mode_capture(view.camera, video_mode, &view.show, &width, &height);
     DC1394_ERR_CLN_RTN(err,cleanup_and_exit(view.camera),"Could not setup camera");
 
     err=setup_from_command_line(view.camera, framerate, exposure, brightness);
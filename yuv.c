@@ -0,0 +1,387 @@
+/*
+ * YUV to RGB conversion with SIMD kernels chosen at runtime
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *    Each row is converted a chunk at a time into R, G and B planes, which
+ *    demosaic_pack_rgb8() then interleaves. libdc1394 computes, with U and
+ *    V centred on 0 and arithmetic shifts,
+ *
+ *      R = Y + ((V * 1436) >> 10)
+ *      G = Y - ((U * 352 + V * 731) >> 10)
+ *      B = Y + ((U * 1814) >> 10)
+ *
+ *    clamped to 0-255. The SIMD kernels get the same results in 16 bit
+ *    lanes: (V * 1436) >> 10 is the high half of (V << 6) * 1436, and the
+ *    G sum is formed in 32 bits by multiply-adding U,V pairs.
+ *
+ */
+
+#include "yuv.h"
+#include "demosaic.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define YUV_X86 1
+#include <immintrin.h>
+#define TARGET(_isa) __attribute__((target(_isa)))
+#endif
+
+/* pixels converted into the planes at a time; a multiple of every kernel's step */
+#define CHUNK   512
+
+typedef void (*row_func_t)(const uint8_t *src, uint32_t npix, uint8_t *r, uint8_t *g, uint8_t *b);
+
+typedef struct __kernels
+{
+    row_func_t  yuv411;
+    row_func_t  uyvy;
+    row_func_t  yuyv;
+    row_func_t  yuv444;
+} kernels_t;
+
+/*
+ * Scalar kernels
+ */
+static inline uint8_t
+clamp255(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static inline void
+yuv_pixel(int y, int u, int v, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    *r = clamp255(y + ((v * 1436) >> 10));
+    *g = clamp255(y - (((u * 352) + (v * 731)) >> 10));
+    *b = clamp255(y + ((u * 1814) >> 10));
+}
+
+static void
+yuv411_scalar(const uint8_t *src, uint32_t npix, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    uint32_t i;
+    int u, v;
+
+    for (i = 0; i < npix; i += 4, src += 6) {
+        u = src[0] - 128;
+        v = src[3] - 128;
+        yuv_pixel(src[1], u, v, &r[i], &g[i], &b[i]);
+        yuv_pixel(src[2], u, v, &r[i + 1], &g[i + 1], &b[i + 1]);
+        yuv_pixel(src[4], u, v, &r[i + 2], &g[i + 2], &b[i + 2]);
+        yuv_pixel(src[5], u, v, &r[i + 3], &g[i + 3], &b[i + 3]);
+    }
+}
+
+static void
+uyvy_scalar(const uint8_t *src, uint32_t npix, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    uint32_t i;
+
+    for (i = 0; i < npix; i += 2, src += 4) {
+        yuv_pixel(src[1], src[0] - 128, src[2] - 128, &r[i], &g[i], &b[i]);
+        yuv_pixel(src[3], src[0] - 128, src[2] - 128, &r[i + 1], &g[i + 1], &b[i + 1]);
+    }
+}
+
+static void
+yuyv_scalar(const uint8_t *src, uint32_t npix, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    uint32_t i;
+
+    for (i = 0; i < npix; i += 2, src += 4) {
+        yuv_pixel(src[0], src[1] - 128, src[3] - 128, &r[i], &g[i], &b[i]);
+        yuv_pixel(src[2], src[1] - 128, src[3] - 128, &r[i + 1], &g[i + 1], &b[i + 1]);
+    }
+}
+
+/* only the 160x120 mode uses it, so it has no SIMD versions */
+static void
+yuv444_scalar(const uint8_t *src, uint32_t npix, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    uint32_t i;
+
+    for (i = 0; i < npix; i++, src += 3)
+        yuv_pixel(src[1], src[0] - 128, src[2] - 128, &r[i], &g[i], &b[i]);
+}
+
+static const kernels_t kernels_scalar = { yuv411_scalar, uyvy_scalar, yuyv_scalar, yuv444_scalar };
+
+#ifdef YUV_X86
+
+/*
+ * SSE2 kernels, 16 pixels at a time. YUV411 needs a byte shuffle to
+ * gather its samples, so stays scalar.
+ */
+#define LD128(_p)       _mm_loadu_si128((const __m128i *)(_p))
+#define ST128(_p, _v)   _mm_storeu_si128((__m128i *)(_p), _v)
+
+/* y, u and v hold 8 pixels as 16 bit lanes, u and v centred on 0 */
+static inline TARGET("sse2") void
+rgb_sse2(__m128i y, __m128i u, __m128i v, __m128i *r, __m128i *g, __m128i *b)
+{
+    const __m128i guv = _mm_set1_epi32((731 << 16) | 352);
+    __m128i lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(u, v), guv), 10);
+    __m128i hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(u, v), guv), 10);
+
+    *r = _mm_add_epi16(y, _mm_mulhi_epi16(_mm_slli_epi16(v, 6), _mm_set1_epi16(1436)));
+    *g = _mm_sub_epi16(y, _mm_packs_epi32(lo, hi));
+    *b = _mm_add_epi16(y, _mm_mulhi_epi16(_mm_slli_epi16(u, 6), _mm_set1_epi16(1814)));
+}
+
+/* 8 pixels of YUV422; the chroma lanes are U0 V0 U1 V1..., each pair
+ * shared by two pixels */
+static inline TARGET("sse2") void
+yuv422_sse2(__m128i x, gboolean yuyv, __m128i *r, __m128i *g, __m128i *b)
+{
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    __m128i y, c, u, v;
+
+    y = yuyv ? _mm_and_si128(x, low) : _mm_srli_epi16(x, 8);
+    c = _mm_sub_epi16(yuyv ? _mm_srli_epi16(x, 8) : _mm_and_si128(x, low), _mm_set1_epi16(128));
+    u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+    v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+    rgb_sse2(y, u, v, r, g, b);
+}
+
+static inline TARGET("sse2") void
+yuv422_row_sse2(const uint8_t *src, uint32_t npix, gboolean yuyv, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    __m128i ra, ga, ba, rb, gb, bb;
+    uint32_t i;
+
+    for (i = 0; i + 16 <= npix; i += 16) {
+        yuv422_sse2(LD128(src + (2 * i)), yuyv, &ra, &ga, &ba);
+        yuv422_sse2(LD128(src + (2 * i) + 16), yuyv, &rb, &gb, &bb);
+        ST128(r + i, _mm_packus_epi16(ra, rb));
+        ST128(g + i, _mm_packus_epi16(ga, gb));
+        ST128(b + i, _mm_packus_epi16(ba, bb));
+    }
+    (yuyv ? yuyv_scalar : uyvy_scalar)(src + (2 * i), npix - i, r + i, g + i, b + i);
+}
+
+static TARGET("sse2") void
+uyvy_sse2(const uint8_t *src, uint32_t npix, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    yuv422_row_sse2(src, npix, FALSE, r, g, b);
+}
+
+static TARGET("sse2") void
+yuyv_sse2(const uint8_t *src, uint32_t npix, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    yuv422_row_sse2(src, npix, TRUE, r, g, b);
+}
+
+/*
+ * AVX2 kernels, 32 pixels at a time for YUV422. YUV411 gathers 8 pixels
+ * at a time with the SSSE3 byte shuffle, which every AVX2 CPU has.
+ */
+#define LD256(_p)       _mm256_loadu_si256((const __m256i *)(_p))
+#define ST256(_p, _v)   _mm256_storeu_si256((__m256i *)(_p), _v)
+
+static inline TARGET("avx2") void
+rgb_avx2(__m256i y, __m256i u, __m256i v, __m256i *r, __m256i *g, __m256i *b)
+{
+    const __m256i guv = _mm256_set1_epi32((731 << 16) | 352);
+    __m256i lo = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(u, v), guv), 10);
+    __m256i hi = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(u, v), guv), 10);
+
+    /* unpack and pack both work within 128 bit lanes, so the order comes back */
+    *r = _mm256_add_epi16(y, _mm256_mulhi_epi16(_mm256_slli_epi16(v, 6), _mm256_set1_epi16(1436)));
+    *g = _mm256_sub_epi16(y, _mm256_packs_epi32(lo, hi));
+    *b = _mm256_add_epi16(y, _mm256_mulhi_epi16(_mm256_slli_epi16(u, 6), _mm256_set1_epi16(1814)));
+}
+
+static inline TARGET("avx2") void
+yuv422_avx2(__m256i x, gboolean yuyv, __m256i *r, __m256i *g, __m256i *b)
+{
+    const __m256i low = _mm256_set1_epi16(0x00ff);
+    __m256i y, c, u, v;
+
+    y = yuyv ? _mm256_and_si256(x, low) : _mm256_srli_epi16(x, 8);
+    c = _mm256_sub_epi16(yuyv ? _mm256_srli_epi16(x, 8) : _mm256_and_si256(x, low), _mm256_set1_epi16(128));
+    u = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+    v = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+    rgb_avx2(y, u, v, r, g, b);
+}
+
+/* packus works within 128 bit lanes, so put the quarters back in order */
+static inline TARGET("avx2") __m256i
+pack_avx2(__m256i a, __m256i b)
+{
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+}
+
+static inline TARGET("avx2") void
+yuv422_row_avx2(const uint8_t *src, uint32_t npix, gboolean yuyv, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    __m256i ra, ga, ba, rb, gb, bb;
+    uint32_t i;
+
+    for (i = 0; i + 32 <= npix; i += 32) {
+        yuv422_avx2(LD256(src + (2 * i)), yuyv, &ra, &ga, &ba);
+        yuv422_avx2(LD256(src + (2 * i) + 32), yuyv, &rb, &gb, &bb);
+        ST256(r + i, pack_avx2(ra, rb));
+        ST256(g + i, pack_avx2(ga, gb));
+        ST256(b + i, pack_avx2(ba, bb));
+    }
+    yuv422_row_sse2(src + (2 * i), npix - i, yuyv, r + i, g + i, b + i);
+}
+
+static TARGET("avx2") void
+uyvy_avx2(const uint8_t *src, uint32_t npix, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    yuv422_row_avx2(src, npix, FALSE, r, g, b);
+}
+
+static TARGET("avx2") void
+yuyv_avx2(const uint8_t *src, uint32_t npix, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    yuv422_row_avx2(src, npix, TRUE, r, g, b);
+}
+
+/* spreads 8 pixels (12 bytes, U Y Y V Y Y U Y Y V Y Y) into 16 bit lanes */
+static const int8_t yuv411_shuffle[3][16] __attribute__((aligned(16))) = {
+    {  1, -1,  2, -1,  4, -1,  5, -1,  7, -1,  8, -1, 10, -1, 11, -1 },     /* Y */
+    {  0, -1,  0, -1,  0, -1,  0, -1,  6, -1,  6, -1,  6, -1,  6, -1 },     /* U */
+    {  3, -1,  3, -1,  3, -1,  3, -1,  9, -1,  9, -1,  9, -1,  9, -1 }      /* V */
+};
+
+static inline TARGET("avx2") void
+yuv411_avx2(__m128i x, __m128i *r, __m128i *g, __m128i *b)
+{
+    const __m128i bias = _mm_set1_epi16(128);
+
+    rgb_sse2(_mm_shuffle_epi8(x, LD128(yuv411_shuffle[0])),
+             _mm_sub_epi16(_mm_shuffle_epi8(x, LD128(yuv411_shuffle[1])), bias),
+             _mm_sub_epi16(_mm_shuffle_epi8(x, LD128(yuv411_shuffle[2])), bias),
+             r, g, b);
+}
+
+static TARGET("avx2") void
+yuv411_row_avx2(const uint8_t *src, uint32_t npix, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    __m128i ra, ga, ba, rb, gb, bb;
+    uint32_t i;
+
+    /* each 16 byte load uses 12, so stop while the last stays in the row */
+    for (i = 0; i + 20 <= npix; i += 16) {
+        yuv411_avx2(LD128(src + (i * 3 / 2)), &ra, &ga, &ba);
+        yuv411_avx2(LD128(src + (i * 3 / 2) + 12), &rb, &gb, &bb);
+        ST128(r + i, _mm_packus_epi16(ra, rb));
+        ST128(g + i, _mm_packus_epi16(ga, gb));
+        ST128(b + i, _mm_packus_epi16(ba, bb));
+    }
+    yuv411_scalar(src + (i * 3 / 2), npix - i, r + i, g + i, b + i);
+}
+
+static const kernels_t kernels_sse2 = { yuv411_scalar, uyvy_sse2, yuyv_sse2, yuv444_scalar };
+static const kernels_t kernels_avx2 = { yuv411_row_avx2, uyvy_avx2, yuyv_avx2, yuv444_scalar };
+
+#endif /* YUV_X86 */
+
+static const kernels_t *
+get_kernels(void)
+{
+    switch (demosaic_get_impl()) {
+#ifdef YUV_X86
+        case DEMOSAIC_IMPL_SSE2:
+            return &kernels_sse2;
+        case DEMOSAIC_IMPL_AVX2:
+            return &kernels_avx2;
+#endif
+        default:
+            return &kernels_scalar;
+    }
+}
+
+gboolean yuv_coding_supported(dc1394color_coding_t coding)
+{
+    return coding == DC1394_COLOR_CODING_YUV411 ||
+           coding == DC1394_COLOR_CODING_YUV422 ||
+           coding == DC1394_COLOR_CODING_YUV444;
+}
+
+static dc1394error_t
+yuv_rows(const uint8_t *yuv, size_t stride, uint8_t *rgb, size_t rgb_stride,
+         uint32_t width, uint32_t y0, uint32_t y1,
+         dc1394color_coding_t coding, dc1394byte_order_t order, gboolean bgr)
+{
+    const kernels_t *k;
+    uint8_t r[CHUNK], g[CHUNK], b[CHUNK];
+    row_func_t row;
+    uint32_t x, y, n, num, den;
+
+    g_return_val_if_fail(yuv != NULL && rgb != NULL, DC1394_INVALID_ARGUMENT_VALUE);
+
+    k = get_kernels();
+    switch (coding) {
+        case DC1394_COLOR_CODING_YUV411:
+            row = k->yuv411;
+            num = 3;
+            den = 2;
+            if (width % 4)
+                return DC1394_INVALID_ARGUMENT_VALUE;
+            break;
+        case DC1394_COLOR_CODING_YUV422:
+            if (order != DC1394_BYTE_ORDER_UYVY && order != DC1394_BYTE_ORDER_YUYV)
+                return DC1394_INVALID_BYTE_ORDER;
+            row = order == DC1394_BYTE_ORDER_YUYV ? k->yuyv : k->uyvy;
+            num = 2;
+            den = 1;
+            if (width % 2)
+                return DC1394_INVALID_ARGUMENT_VALUE;
+            break;
+        case DC1394_COLOR_CODING_YUV444:
+            row = k->yuv444;
+            num = 3;
+            den = 1;
+            break;
+        default:
+            return DC1394_INVALID_COLOR_CODING;
+    }
+
+    for (y = y0; y < y1; y++) {
+        const uint8_t *src = yuv + (y * stride);
+        uint8_t *dst = rgb + (y * rgb_stride);
+
+        for (x = 0; x < width; x += n) {
+            n = MIN(CHUNK, width - x);
+            row(src + (x * num / den), n, r, g, b);
+            if (bgr)
+                demosaic_pack_rgb8(b, g, r, dst + (3 * x), n);
+            else
+                demosaic_pack_rgb8(r, g, b, dst + (3 * x), n);
+        }
+    }
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t yuv_to_rgb8_rows(const uint8_t *yuv, size_t stride, uint8_t *rgb, size_t rgb_stride,
+                uint32_t width, uint32_t y0, uint32_t y1,
+                dc1394color_coding_t coding, dc1394byte_order_t order)
+{
+    return yuv_rows(yuv, stride, rgb, rgb_stride, width, y0, y1, coding, order, FALSE);
+}
+
+dc1394error_t yuv_to_bgr8_rows(const uint8_t *yuv, size_t stride, uint8_t *bgr, size_t bgr_stride,
+                uint32_t width, uint32_t y0, uint32_t y1,
+                dc1394color_coding_t coding, dc1394byte_order_t order)
+{
+    return yuv_rows(yuv, stride, bgr, bgr_stride, width, y0, y1, coding, order, TRUE);
+}
@@ -0,0 +1,64 @@
+/*
+ * YUV to RGB conversion with SIMD kernels chosen at runtime
+ *
+ * Written by agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _YUV_H_
+#define _YUV_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <glib.h>
+#include <dc1394/dc1394.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Converts the YUV411 (UYYVYY), YUV422 (UYVY or YUYV) and YUV444 (UYV)
+ * codings of the IIDC video modes with the same integer arithmetic as
+ * dc1394_convert_to_RGB8(), so the results are identical to libdc1394's.
+ * The SIMD level is the one demosaic_set_impl() chose. YUV411 rows must
+ * be a multiple of 4 pixels wide and YUV422 rows a multiple of 2, as all
+ * the IIDC modes are.
+ */
+
+/**
+ * TRUE for YUV411, YUV422 and YUV444
+ */
+gboolean yuv_coding_supported(dc1394color_coding_t coding);
+
+/**
+ * Converts rows y0 to y1-1 of a width pixel wide image into interleaved
+ * RGB8. order is the frame's yuv_byte_order and only matters for YUV422.
+ */
+dc1394error_t yuv_to_rgb8_rows(const uint8_t *yuv, size_t stride, uint8_t *rgb, size_t rgb_stride,
+                uint32_t width, uint32_t y0, uint32_t y1,
+                dc1394color_coding_t coding, dc1394byte_order_t order);
+
+/**
+ * As yuv_to_rgb8_rows() but with the samples of each pixel in B, G, R
+ * order, as OpenCV expects
+ */
+dc1394error_t yuv_to_bgr8_rows(const uint8_t *yuv, size_t stride, uint8_t *bgr, size_t bgr_stride,
+                uint32_t width, uint32_t y0, uint32_t y1,
+                dc1394color_coding_t coding, dc1394byte_order_t order);
+
+G_END_DECLS
+
+#endif